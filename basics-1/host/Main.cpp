@@ -0,0 +1,340 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+
+#include "Benchmark.h"
+#include "CpuUsage.h"
+#include "ProcessStats.h"
+
+/* One of the N pipelines hosted by this process */
+typedef struct _Stream {
+    GstElement *pipeline;
+    DecodeCounters counters;
+    guint bus_watch_id;
+    gboolean failed;            /* Did this stream post an error? */
+} Stream;
+
+/* What we measured for one value of N */
+typedef struct _StepResult {
+    guint streams;
+    guint failed;
+    guint64 frames;             /* Video frames decoded during the measurement window */
+    gint64 window;              /* Length of the measurement window, in microseconds */
+    gint64 cpu_time;            /* CPU time used by the host(s) during the window, in microseconds */
+    std::vector<double> core_usage;
+} StepResult;
+
+/* Command line options */
+static gchar *uri = NULL;
+static gint max_streams = 64;
+static gint streams = 0;
+static gint warmup = 2;
+static gint duration = 10;
+static gboolean processes = FALSE;
+static gboolean child = FALSE;
+
+static GOptionEntry entries[] = {
+    { "uri", 'u', 0, G_OPTION_ARG_STRING, &uri,
+      "Media to decode in every pipeline (a local path or an URI)", "URI" },
+    { "max-streams", 'n', 0, G_OPTION_ARG_INT, &max_streams,
+      "Double the number of pipelines from 1 up to N (default 64)", "N" },
+    { "streams", 's', 0, G_OPTION_ARG_INT, &streams,
+      "Only measure exactly N pipelines", "N" },
+    { "warmup", 'w', 0, G_OPTION_ARG_INT, &warmup,
+      "Seconds to run before measuring each step (default 2)", "S" },
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+      "Seconds to measure each step (default 10)", "S" },
+    { "processes", 'p', 0, G_OPTION_ARG_NONE, &processes,
+      "Run each pipeline in its own process instead of hosting all of them here", NULL },
+    { "child", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &child, NULL, NULL },
+    { NULL }
+};
+
+/* Bus watch shared by all the streams. Every bus is attached to the default
+ * GMainContext, so a single thread services the messages of all pipelines. */
+static gboolean bus_cb(GstBus *bus, GstMessage *msg, Stream *stream)
+{
+    switch (GST_MESSAGE_TYPE(msg))
+    {
+        case GST_MESSAGE_ERROR:
+        {
+            GError *err;
+            gchar *debug_info;
+
+            gst_message_parse_error(msg, &err, &debug_info);
+            g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
+            g_clear_error(&err);
+            g_free(debug_info);
+            stream->failed = TRUE;
+            gst_element_set_state(stream->pipeline, GST_STATE_NULL);
+            break;
+        }
+
+        case GST_MESSAGE_EOS:
+        /* Keep the load constant: start over when the media is shorter than the step */
+        gst_element_seek_simple(stream->pipeline, GST_FORMAT_TIME,
+            (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), 0);
+        break;
+
+        default:
+        break;
+    }
+    return TRUE;
+}
+
+static gboolean quit_loop_cb(GMainLoop *loop)
+{
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+}
+
+/* Services the buses of all streams for the given number of seconds */
+static void run_loop_for(GMainLoop *loop, gint seconds)
+{
+    g_timeout_add_seconds(seconds, (GSourceFunc)quit_loop_cb, loop);
+    g_main_loop_run(loop);
+}
+
+static guint64 total_frames(const std::vector<Stream *> &all)
+{
+    guint64 frames = 0;
+    for (Stream *stream : all)
+        frames += stream->counters.video_frames;
+    return frames;
+}
+
+/* Hosts n pipelines in this process and measures them */
+static StepResult run_in_process(GMainLoop *loop, const gchar *media_uri, guint n)
+{
+    std::vector<Stream *> all;
+    std::vector<CpuTimes> cores_before;
+    ProcessStats before, after;
+    guint64 frames_before;
+    StepResult result;
+
+    result.streams = n;
+    result.failed = 0;
+
+    for (guint i = 0; i < n; i++)
+    {
+        Stream *stream = new Stream;
+        GstBus *bus;
+
+        stream->failed = FALSE;
+        stream->pipeline = headless_playbin_new(media_uri, &stream->counters);
+        if (stream->pipeline == nullptr)
+        {
+            delete stream;
+            result.failed++;
+            continue;
+        }
+
+        bus = gst_element_get_bus(stream->pipeline);
+        stream->bus_watch_id = gst_bus_add_watch(bus, (GstBusFunc)bus_cb, stream);
+        gst_object_unref(bus);
+
+        gst_element_set_state(stream->pipeline, GST_STATE_PLAYING);
+        all.push_back(stream);
+    }
+
+    /* Let every pipeline preroll and reach a steady state before measuring */
+    run_loop_for(loop, warmup);
+
+    frames_before = total_frames(all);
+    process_stats_sample(&before);
+    cores_before = cpu_usage_sample();
+
+    run_loop_for(loop, duration);
+
+    result.frames = total_frames(all) - frames_before;
+    process_stats_sample(&after);
+    result.core_usage = cpu_usage_between(cores_before, cpu_usage_sample());
+    result.window = after.wall_time - before.wall_time;
+    result.cpu_time = after.cpu_time - before.cpu_time;
+
+    for (Stream *stream : all)
+    {
+        if (stream->failed)
+            result.failed++;
+        g_source_remove(stream->bus_watch_id);
+        gst_element_set_state(stream->pipeline, GST_STATE_NULL);
+        gst_object_unref(stream->pipeline);
+        delete stream;
+    }
+    return result;
+}
+
+/* Runs n copies of this program, each hosting a single pipeline, and sums
+ * what they report. Core usage is system-wide, so it covers all children. */
+static StepResult run_in_processes(const gchar *self, const gchar *media_uri, guint n)
+{
+    std::vector<GPid> pids;
+    std::vector<gint> outputs;
+    std::vector<CpuTimes> cores_before;
+    gchar *warmup_str = g_strdup_printf("%d", warmup);
+    gchar *duration_str = g_strdup_printf("%d", duration);
+    gchar *child_argv[] = {
+        (gchar *)self, (gchar *)"--child", (gchar *)"--streams", (gchar *)"1",
+        (gchar *)"--uri", (gchar *)media_uri,
+        (gchar *)"--warmup", warmup_str, (gchar *)"--duration", duration_str, NULL
+    };
+    StepResult result;
+
+    result.streams = n;
+    result.failed = 0;
+    result.frames = 0;
+    result.cpu_time = 0;
+
+    for (guint i = 0; i < n; i++)
+    {
+        GPid pid;
+        gint out_fd;
+        GError *err = NULL;
+
+        if (!g_spawn_async_with_pipes(NULL, child_argv, NULL,
+                                      (GSpawnFlags)(G_SPAWN_DO_NOT_REAP_CHILD),
+                                      NULL, NULL, &pid, NULL, &out_fd, NULL, &err))
+        {
+            g_printerr("Could not spawn child: %s\n", err->message);
+            g_clear_error(&err);
+            result.failed++;
+            continue;
+        }
+        pids.push_back(pid);
+        outputs.push_back(out_fd);
+    }
+
+    /* The children warm up on their own, we only look at the cores while they measure */
+    g_usleep((gulong)warmup * G_USEC_PER_SEC);
+    cores_before = cpu_usage_sample();
+    g_usleep((gulong)duration * G_USEC_PER_SEC);
+    result.core_usage = cpu_usage_between(cores_before, cpu_usage_sample());
+
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        std::string output;
+        char chunk[256];
+        ssize_t len;
+        guint64 frames, failed;
+        gint64 cpu_time;
+        int status;
+
+        while ((len = read(outputs[i], chunk, sizeof(chunk))) > 0)
+            output.append(chunk, len);
+        close(outputs[i]);
+        waitpid(pids[i], &status, 0);
+        g_spawn_close_pid(pids[i]);
+
+        if (sscanf(output.c_str(), "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GINT64_FORMAT,
+                   &frames, &failed, &cpu_time) == 3)
+        {
+            result.frames += frames;
+            result.failed += failed;
+            result.cpu_time += cpu_time;
+        }
+        else
+        {
+            result.failed++;
+        }
+    }
+    /* Each child counts its frames over --duration seconds of its own */
+    result.window = (gint64)duration * G_USEC_PER_SEC;
+
+    g_free(warmup_str);
+    g_free(duration_str);
+    return result;
+}
+
+static void print_header(guint cores)
+{
+    g_print("streams,failed,aggregate_fps,fps_per_stream,cpu_s_per_s");
+    for (guint i = 0; i < cores; i++)
+        g_print(",cpu%u_pct", i);
+    g_print("\n");
+}
+
+static void print_result(const StepResult &r)
+{
+    double seconds = (double)r.window / G_USEC_PER_SEC;
+    double fps = seconds > 0 ? r.frames / seconds : 0.0;
+
+    g_print("%u,%u,%.1f,%.1f,%.2f", r.streams, r.failed, fps, r.streams ? fps / r.streams : 0.0,
+        seconds > 0 ? (double)r.cpu_time / G_USEC_PER_SEC / seconds : 0.0);
+    for (double usage : r.core_usage)
+        g_print(",%.1f", usage);
+    g_print("\n");
+}
+
+int 
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    GMainLoop *loop;
+    gchar *media_uri;
+    std::vector<guint> steps;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- host many playbin pipelines in one process");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (uri == NULL || warmup < 0 || duration <= 0)
+    {
+        g_printerr("Usage: %s --uri URI [--max-streams N | --streams N] [--processes]\n", argv[0]);
+        return -1;
+    }
+
+    /* Accept plain paths as well as URIs */
+    if (gst_uri_is_valid(uri))
+        media_uri = g_strdup(uri);
+    else
+        media_uri = gst_filename_to_uri(uri, NULL);
+
+    if (streams > 0)
+    {
+        steps.push_back(streams);
+    }
+    else
+    {
+        for (gint n = 1; n <= max_streams; n *= 2)
+            steps.push_back(n);
+    }
+
+    loop = g_main_loop_new(NULL, FALSE);
+
+    if (child)
+    {
+        /* Report raw numbers to the parent, which does the aggregation */
+        StepResult r = run_in_process(loop, media_uri, steps[0]);
+        g_print("%" G_GUINT64_FORMAT " %u %" G_GINT64_FORMAT "\n", r.frames, r.failed, r.cpu_time);
+    }
+    else
+    {
+        print_header(cpu_usage_sample().size());
+        for (guint n : steps)
+        {
+            StepResult r = processes ? run_in_processes(argv[0], media_uri, n)
+                                     : run_in_process(loop, media_uri, n);
+            print_result(r);
+        }
+    }
+
+    /* Free resources */
+    g_main_loop_unref(loop);
+    g_free(media_uri);
+    return 0;
+}
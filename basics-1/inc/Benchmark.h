@@ -0,0 +1,23 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <atomic>
+#include <gst/gst.h>
+
+/* Counters updated from the streaming threads of a headless playbin */
+typedef struct _DecodeCounters {
+    std::atomic<guint64> video_frames;  /* Buffers that reached the video sink */
+    std::atomic<guint64> audio_samples; /* Audio frames (samples per channel) that reached the audio sink */
+    gint audio_bpf;                     /* Bytes per audio frame of the negotiated caps */
+} DecodeCounters;
+
+/* Creates a playbin for uri whose video and audio sinks are fakesinks with
+ * sync=false, so the file is decoded as fast as the host allows. Every buffer
+ * reaching the sinks is accounted in counters, which must outlive the pipeline. */
+GstElement *headless_playbin_new(const gchar *uri, DecodeCounters *counters);
+
+/* Decodes every regular file in dir, one after the other, and prints a report
+ * with one row per file. format is either "csv" or "json". */
+int run_benchmark(const gchar *dir, const gchar *format);
+
+#endif /* BENCHMARK_H */
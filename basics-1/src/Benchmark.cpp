@@ -0,0 +1,257 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gst/audio/audio.h>
+
+#include "ProcessStats.h"
+
+/* Everything we learned about one file */
+typedef struct _FileResult {
+    std::string path;
+    gboolean ok;
+    guint64 video_frames;
+    guint64 audio_samples;
+    gint64 wall_time;           /* In microseconds */
+    gint64 cpu_time;            /* In microseconds */
+    gint64 peak_rss;            /* In kilobytes */
+} FileResult;
+
+/* Counts video frames reaching the video fakesink */
+static GstPadProbeReturn video_probe_cb(GstPad *pad, GstPadProbeInfo *info, DecodeCounters *counters)
+{
+    counters->video_frames.fetch_add(1, std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
+
+/* Counts audio samples reaching the audio fakesink, using the caps to know the frame size */
+static GstPadProbeReturn audio_probe_cb(GstPad *pad, GstPadProbeInfo *info, DecodeCounters *counters)
+{
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+        {
+            GstCaps *caps;
+            GstAudioInfo audio_info;
+
+            gst_event_parse_caps(event, &caps);
+            if (gst_audio_info_from_caps(&audio_info, caps))
+                counters->audio_bpf = GST_AUDIO_INFO_BPF(&audio_info);
+        }
+    }
+    else if (counters->audio_bpf > 0)
+    {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        counters->audio_samples.fetch_add(gst_buffer_get_size(buffer) / counters->audio_bpf,
+                                          std::memory_order_relaxed);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* Creates a fakesink that never waits for the clock and installs probe on its sink pad */
+static GstElement *make_counting_sink(const gchar *name, GstPadProbeType mask,
+                                      GstPadProbeCallback probe, DecodeCounters *counters)
+{
+    GstElement *sink = gst_element_factory_make("fakesink", name);
+    GstPad *pad;
+
+    if (sink == nullptr)
+        return nullptr;
+
+    g_object_set(sink, "sync", FALSE, NULL);
+    pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, mask, probe, counters, NULL);
+    gst_object_unref(pad);
+    return sink;
+}
+
+GstElement *headless_playbin_new(const gchar *uri, DecodeCounters *counters)
+{
+    GstElement *playbin, *video_sink, *audio_sink;
+
+    counters->video_frames = 0;
+    counters->audio_samples = 0;
+    counters->audio_bpf = 0;
+
+    playbin = gst_element_factory_make("playbin", NULL);
+    video_sink = make_counting_sink(NULL, GST_PAD_PROBE_TYPE_BUFFER,
+                                    (GstPadProbeCallback)video_probe_cb, counters);
+    audio_sink = make_counting_sink(NULL,
+                                    (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                                    (GstPadProbeCallback)audio_probe_cb, counters);
+
+    if (playbin == nullptr || video_sink == nullptr || audio_sink == nullptr)
+    {
+        g_printerr("Not all elements could be created.\n");
+        if (playbin != nullptr)
+            gst_object_unref(playbin);
+        if (video_sink != nullptr)
+            gst_object_unref(video_sink);
+        if (audio_sink != nullptr)
+            gst_object_unref(audio_sink);
+        return nullptr;
+    }
+
+    /* playbin takes ownership of the floating sinks */
+    g_object_set(playbin, "uri", uri, "video-sink", video_sink, "audio-sink", audio_sink, NULL);
+    return playbin;
+}
+
+/* Decodes a single file until EOS or error and measures what it cost */
+static void benchmark_file(const gchar *path, FileResult *result)
+{
+    DecodeCounters counters;
+    ProcessStats before, after;
+    GstElement *playbin;
+    GstBus *bus;
+    GstMessage *msg;
+    gchar *uri;
+
+    result->path = path;
+    result->ok = FALSE;
+    result->video_frames = 0;
+    result->audio_samples = 0;
+    result->wall_time = 0;
+    result->cpu_time = 0;
+    result->peak_rss = 0;
+
+    uri = gst_filename_to_uri(path, NULL);
+    playbin = uri ? headless_playbin_new(uri, &counters) : nullptr;
+    g_free(uri);
+    if (playbin == nullptr)
+        return;
+
+    process_stats_reset_peak_rss();
+    process_stats_sample(&before);
+
+    if (gst_element_set_state(playbin, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("Unable to set the pipeline to the playing state for %s.\n", path);
+        gst_object_unref(playbin);
+        return;
+    }
+
+    bus = gst_element_get_bus(playbin);
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+
+    process_stats_sample(&after);
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+    {
+        GError *err;
+        gchar *debug_info;
+
+        gst_message_parse_error(msg, &err, &debug_info);
+        g_printerr("Error decoding %s: %s\n", path, err->message);
+        g_clear_error(&err);
+        g_free(debug_info);
+    }
+    else
+    {
+        result->ok = TRUE;
+    }
+
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(playbin, GST_STATE_NULL);
+    gst_object_unref(playbin);
+
+    result->video_frames = counters.video_frames;
+    result->audio_samples = counters.audio_samples;
+    result->wall_time = after.wall_time - before.wall_time;
+    result->cpu_time = after.cpu_time - before.cpu_time;
+    result->peak_rss = after.peak_rss;
+}
+
+static double per_second(guint64 count, gint64 usec)
+{
+    return usec > 0 ? (double)count * G_USEC_PER_SEC / usec : 0.0;
+}
+
+static void print_csv(const std::vector<FileResult> &results)
+{
+    g_print("file,status,video_frames,audio_samples,wall_s,cpu_s,fps,samples_per_s,peak_rss_kb\n");
+    for (const FileResult &r : results)
+    {
+        g_print("\"%s\",%s,%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%.3f,%.3f,%.1f,%.1f,%" G_GINT64_FORMAT "\n",
+            r.path.c_str(), r.ok ? "ok" : "error",
+            r.video_frames, r.audio_samples,
+            (double)r.wall_time / G_USEC_PER_SEC, (double)r.cpu_time / G_USEC_PER_SEC,
+            per_second(r.video_frames, r.wall_time), per_second(r.audio_samples, r.wall_time),
+            r.peak_rss);
+    }
+}
+
+static void print_json(const std::vector<FileResult> &results)
+{
+    g_print("[\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const FileResult &r = results[i];
+        gchar *escaped = g_strescape(r.path.c_str(), NULL);
+
+        g_print("  {\"file\": \"%s\", \"status\": \"%s\", \"video_frames\": %" G_GUINT64_FORMAT
+            ", \"audio_samples\": %" G_GUINT64_FORMAT ", \"wall_s\": %.3f, \"cpu_s\": %.3f"
+            ", \"fps\": %.1f, \"samples_per_s\": %.1f, \"peak_rss_kb\": %" G_GINT64_FORMAT "}%s\n",
+            escaped, r.ok ? "ok" : "error",
+            r.video_frames, r.audio_samples,
+            (double)r.wall_time / G_USEC_PER_SEC, (double)r.cpu_time / G_USEC_PER_SEC,
+            per_second(r.video_frames, r.wall_time), per_second(r.audio_samples, r.wall_time),
+            r.peak_rss, i + 1 < results.size() ? "," : "");
+        g_free(escaped);
+    }
+    g_print("]\n");
+}
+
+int run_benchmark(const gchar *dir, const gchar *format)
+{
+    std::vector<std::string> paths;
+    std::vector<FileResult> results;
+    GError *err = NULL;
+    GDir *gdir;
+    const gchar *name;
+    gboolean json = g_strcmp0(format, "json") == 0;
+
+    if (format != NULL && !json && g_strcmp0(format, "csv") != 0)
+    {
+        g_printerr("Unknown report format '%s', expected csv or json.\n", format);
+        return -1;
+    }
+
+    gdir = g_dir_open(dir, 0, &err);
+    if (gdir == NULL)
+    {
+        g_printerr("Could not open %s: %s\n", dir, err->message);
+        g_clear_error(&err);
+        return -1;
+    }
+    while ((name = g_dir_read_name(gdir)) != NULL)
+    {
+        gchar *path = g_build_filename(dir, name, NULL);
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+            paths.push_back(path);
+        g_free(path);
+    }
+    g_dir_close(gdir);
+
+    /* Always run the files in the same order so reports can be compared */
+    std::sort(paths.begin(), paths.end());
+
+    for (const std::string &path : paths)
+    {
+        FileResult result;
+        g_printerr("Decoding %s...\n", path.c_str());
+        benchmark_file(path.c_str(), &result);
+        results.push_back(result);
+    }
+
+    if (json)
+        print_json(results);
+    else
+        print_csv(results);
+    return 0;
+}
@@ -1,15 +1,48 @@
 #include <iostream>
 #include <gst/gst.h>
 
+#include "Benchmark.h"
+#include "StaticPlugins.h"
+
+/* Command line options */
+static gchar *bench_dir = NULL;
+static gchar *bench_format = NULL;
+
+static GOptionEntry entries[] = {
+    { "bench", 'b', 0, G_OPTION_ARG_FILENAME, &bench_dir,
+      "Decode every file in DIR headless, as fast as possible, and report throughput", "DIR" },
+    { "format", 'f', 0, G_OPTION_ARG_STRING, &bench_format,
+      "Benchmark report format: csv (default) or json", "FORMAT" },
+    { NULL }
+};
+
 int 
 main(int argc, char* argv[])
 {
     GstElement *pipeline;
     GstBus *bus;
     GstMessage *msg;
+    GOptionContext *context;
+    GError *err = NULL;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    static_plugins_prepare();
+    context = g_option_context_new("- playbin tutorial");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+    static_plugins_register();
 
-    /* Initialize GStreamer */
-    gst_init (&argc, &argv);
+    /* Benchmark mode: no window, no clock, just decode */
+    if (bench_dir != NULL)
+        return run_benchmark(bench_dir, bench_format);
 
     /* Build the pipeline */
     pipeline =
@@ -0,0 +1,549 @@
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <gst/gst.h>
+
+#include "ReplaySrc.h"
+#include "TrailFilter.h"
+
+/* One point of the sweep */
+typedef struct _BenchConfig {
+    std::string filter;         /* Element name, optionally followed by :KERNEL for trailfilter */
+    std::string layout;         /* "linked" or "queued" */
+    gint n_threads;             /* n-threads for trailfilter, -1 for other filters */
+    gint width;
+    gint height;
+    std::string format;         /* Raw video format, as in the caps */
+    gint framerate;             /* Frames per second announced in the caps */
+} BenchConfig;
+
+/* Queues of the queued layout: q0 in front of the filter, q1 in front of the sink */
+#define N_QUEUES 2
+
+/* Fill level of one decoupling queue, sampled while the run goes on */
+typedef struct _QueueFill {
+    guint64 sum;
+    guint samples;
+    guint max;
+} QueueFill;
+
+/* What one run measured besides its duration */
+typedef struct _RunStats {
+    std::vector<GstClockTime> entered;  /* When each frame left the source, by frame number */
+    std::vector<gdouble> latencies;     /* Source to sink of every frame, in ms */
+    guint64 received;                   /* Frames that reached the sink, the rest were dropped by leaky queues */
+    GstClockTime start;                 /* Frames that left the source before this prerolled */
+    QueueFill fill[N_QUEUES];
+} RunStats;
+
+/* Command line options */
+static gchar *filters = NULL;
+static gchar *resolutions = NULL;
+static gchar *formats = NULL;
+static gchar *framerates = NULL;
+static gchar *threads = NULL;
+static gchar *output = NULL;
+static gchar *layouts = NULL;
+static gchar *leaky = NULL;
+static gint queue_buffers = 200;
+static gint queue_time = 1000;
+static gboolean sink_sync = FALSE;
+static gint frames = 300;
+static gint warmup_runs = 1;
+static gint runs = 3;
+static gint pattern = 0;
+static gchar *source = NULL;
+static gboolean live = FALSE;
+
+static GOptionEntry entries[] = {
+    { "filters", 'f', 0, G_OPTION_ARG_STRING, &filters,
+      "Comma separated filters to compare. trailfilter:KERNEL forces a kernel "
+      "(default: identity,vertigotv,trailfilter:scalar,trailfilter:sse4.1,trailfilter:avx2)", "LIST" },
+    { "resolutions", 'r', 0, G_OPTION_ARG_STRING, &resolutions,
+      "Comma separated resolutions: 480p, 720p, 1080p, 2160p or WIDTHxHEIGHT (default: 480p,720p,1080p,2160p)", "LIST" },
+    { "formats", 'p', 0, G_OPTION_ARG_STRING, &formats,
+      "Comma separated raw video formats (default: I420,NV12,BGRx)", "LIST" },
+    { "framerates", 'F', 0, G_OPTION_ARG_STRING, &framerates,
+      "Comma separated framerates announced in the caps (default: 30)", "LIST" },
+    { "threads", 't', 0, G_OPTION_ARG_STRING, &threads,
+      "Comma separated n-threads values for trailfilter, or \"sweep\" for 1, 2, 4... up to all cores "
+      "(default: 0 = all cores). Values are capped at " G_STRINGIFY(TRAIL_FILTER_MAX_N_THREADS)
+      ", the threads column gives the count actually used", "LIST" },
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames to push through each run (default 300)", "N" },
+    { "warmup", 'w', 0, G_OPTION_ARG_INT, &warmup_runs, "Runs discarded before measuring each configuration (default 1)", "N" },
+    { "runs", 'R', 0, G_OPTION_ARG_INT, &runs, "Measured runs per configuration (default 3)", "N" },
+    { "pattern", 0, 0, G_OPTION_ARG_INT, &pattern, "videotestsrc pattern (default 0, SMPTE bars)", "N" },
+    { "source", 0, 0, G_OPTION_ARG_STRING, &source,
+      "videotestsrc (default), or replaysrc to replay frames rendered once and leave the CPU to the filter", "NAME" },
+    { "live", 0, 0, G_OPTION_ARG_NONE, &live, "Make the source live: it pushes every frame when it is due", NULL },
+    { "layouts", 'l', 0, G_OPTION_ARG_STRING, &layouts,
+      "Comma separated layouts: linked (one streaming thread) and/or queued (a queue, "
+      "and so a thread, in front of the filter and the sink) (default: linked)", "LIST" },
+    { "queue-buffers", 0, 0, G_OPTION_ARG_INT, &queue_buffers, "max-size-buffers of the queues, 0 = unlimited (default 200)", "N" },
+    { "queue-time", 0, 0, G_OPTION_ARG_INT, &queue_time, "max-size-time of each queue in ms, 0 = unlimited (default 1000, as in queue itself)", "MS" },
+    { "leaky", 0, 0, G_OPTION_ARG_STRING, &leaky, "Leaky policy of the queues: no (default), upstream or downstream", "POLICY" },
+    { "sync", 's', 0, G_OPTION_ARG_NONE, &sink_sync,
+      "Render on the clock at the caps framerate, like a real sink, instead of as fast as possible", NULL },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the CSV to FILE instead of stdout", "FILE" },
+    { NULL }
+};
+
+/* Turns "1080p" or "1920x1080" into a width and a height */
+static gboolean parse_resolution(const gchar *name, gint *width, gint *height)
+{
+    if (g_strcmp0(name, "480p") == 0)
+    {
+        *width = 854;
+        *height = 480;
+    }
+    else if (g_strcmp0(name, "720p") == 0)
+    {
+        *width = 1280;
+        *height = 720;
+    }
+    else if (g_strcmp0(name, "1080p") == 0)
+    {
+        *width = 1920;
+        *height = 1080;
+    }
+    else if (g_strcmp0(name, "2160p") == 0 || g_strcmp0(name, "4k") == 0)
+    {
+        *width = 3840;
+        *height = 2160;
+    }
+    else if (sscanf(name, "%dx%d", width, height) != 2)
+    {
+        return FALSE;
+    }
+    return *width > 0 && *height > 0;
+}
+
+/* Values of n-threads to try, from the --threads option. Each one is the
+ * slice count the filter will really use, so the CSV never reports a count
+ * the filter replaced */
+static std::vector<gint> parse_threads(const gchar *list)
+{
+    std::vector<gint> requested, values;
+
+    if (list == NULL)
+    {
+        requested.push_back(0);
+    }
+    else if (g_strcmp0(list, "sweep") == 0)
+    {
+        gint cores = trail_filter_get_n_threads_used(0);
+        for (gint n = 1; n < cores; n *= 2)
+            requested.push_back(n);
+        requested.push_back(cores);
+    }
+    else
+    {
+        gchar **parts = g_strsplit(list, ",", -1);
+        for (gchar **part = parts; *part != NULL; part++)
+            requested.push_back((gint)g_ascii_strtoll(*part, NULL, 10));
+        g_strfreev(parts);
+    }
+
+    for (gint n : requested)
+    {
+        gint used = (gint)trail_filter_get_n_threads_used((guint)MAX(n, 0));
+
+        if (n > TRAIL_FILTER_MAX_N_THREADS)
+            g_printerr("trailfilter uses at most %d threads, measuring %d instead of %d.\n", TRAIL_FILTER_MAX_N_THREADS,
+                       used, n);
+        if (std::find(values.begin(), values.end(), used) == values.end())
+            values.push_back(used);
+    }
+    return values;
+}
+
+/* Appends a queue named q<index>. Bytes are not limited, so that 2160p frames
+ * are bounded by --queue-buffers and --queue-time like any other size */
+static void describe_queue(GString *description, gint index)
+{
+    g_string_append_printf(description,
+        " ! queue name=q%d max-size-buffers=%d max-size-bytes=0 max-size-time=%" G_GUINT64_FORMAT " leaky=%s",
+        index, queue_buffers, (guint64)queue_time * GST_MSECOND, leaky ? leaky : "no");
+}
+
+/* Builds the gst-launch description of source -> capsfilter -> filter -> fakesink,
+ * with a queue in front of the filter and the sink in the queued layout */
+static gchar *describe_pipeline(const BenchConfig &config)
+{
+    gchar **parts = g_strsplit(config.filter.c_str(), ":", 2);
+    GString *description = g_string_new(NULL);
+    gboolean queued = config.layout == "queued";
+
+    g_string_append_printf(description,
+        "%s name=source num-buffers=%d pattern=%d is-live=%s ! "
+        "video/x-raw,format=%s,width=%d,height=%d,framerate=%d/1",
+        source ? source : "videotestsrc", frames, pattern, live ? "true" : "false",
+        config.format.c_str(), config.width, config.height, config.framerate);
+    if (queued)
+        describe_queue(description, 0);
+    g_string_append_printf(description, " ! %s", parts[0]);
+
+    /* trailfilter:avx2 becomes "trailfilter kernel=avx2" */
+    if (parts[1] != NULL)
+        g_string_append_printf(description, " kernel=%s", parts[1]);
+    if (config.n_threads >= 0)
+        g_string_append_printf(description, " n-threads=%d", config.n_threads);
+
+    if (queued)
+        describe_queue(description, 1);
+    g_string_append_printf(description, " ! fakesink name=sink sync=%s", sink_sync ? "true" : "false");
+    g_strfreev(parts);
+    return g_string_free(description, FALSE);
+}
+
+/* videotestsrc and replaysrc number their frames in the buffer offset, and filters copy it
+ * to their output, so it identifies the frame on both ends */
+static gboolean frame_number(GstBuffer *buffer, const RunStats *stats, guint64 *number)
+{
+    *number = GST_BUFFER_OFFSET(buffer);
+    return GST_BUFFER_OFFSET_IS_VALID(buffer) && *number < stats->entered.size();
+}
+
+/* Source pad: note when every frame enters the pipeline */
+static GstPadProbeReturn source_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    RunStats *stats = (RunStats *)user_data;
+    guint64 number;
+
+    if (frame_number(GST_PAD_PROBE_INFO_BUFFER(info), stats, &number))
+        stats->entered[number] = gst_util_get_timestamp();
+    return GST_PAD_PROBE_OK;
+}
+
+/* Sink pad: the frame leaves the pipeline. The queues in between order the
+ * source's write of entered[] before this read */
+static GstPadProbeReturn sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    RunStats *stats = (RunStats *)user_data;
+    guint64 number;
+
+    stats->received++;
+    if (frame_number(GST_PAD_PROBE_INFO_BUFFER(info), stats, &number))
+    {
+        GstClockTime entered = stats->entered[number];
+
+        /* Frames that waited for the preroll would only measure the preroll */
+        if (GST_CLOCK_TIME_IS_VALID(entered) && entered >= stats->start)
+            stats->latencies.push_back((gdouble)(gst_util_get_timestamp() - entered) / GST_MSECOND);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* Adds a buffer probe on a static pad of the element with the given name */
+static void add_probe(GstElement *pipeline, const gchar *element_name, const gchar *pad_name,
+                      GstPadProbeCallback callback, RunStats *stats)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, stats, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(element);
+}
+
+/* Samples how many buffers wait in each queue of the queued layout */
+static void sample_queues(GstElement *pipeline, RunStats *stats)
+{
+    for (gint i = 0; i < N_QUEUES; i++)
+    {
+        gchar *name = g_strdup_printf("q%d", i);
+        GstElement *queue = gst_bin_get_by_name(GST_BIN(pipeline), name);
+        guint level;
+
+        g_free(name);
+        if (queue == NULL)
+            return;
+
+        g_object_get(queue, "current-level-buffers", &level, NULL);
+        stats->fill[i].sum += level;
+        stats->fill[i].samples++;
+        stats->fill[i].max = MAX(stats->fill[i].max, level);
+        gst_object_unref(queue);
+    }
+}
+
+#define RUN_ERROR (-1)
+#define RUN_UNSUPPORTED (-2)
+
+/* How often the queue levels are sampled */
+#define QUEUE_SAMPLE_INTERVAL (5 * GST_MSECOND)
+
+/* Runs the configuration once and returns how long the frames took to go
+ * through, in nanoseconds, RUN_UNSUPPORTED when the filter cannot negotiate
+ * the format or RUN_ERROR on any other failure. Latency and queue levels
+ * are added to stats */
+static gint64 run_one(const BenchConfig &config, RunStats *stats)
+{
+    gchar *description = describe_pipeline(config);
+    GstElement *pipeline;
+    GstBus *bus;
+    GstMessage *msg;
+    GError *err = NULL;
+    gint64 elapsed = RUN_ERROR;
+
+    pipeline = gst_parse_launch(description, &err);
+    if (pipeline == NULL || err != NULL)
+    {
+        g_printerr("Could not build '%s': %s\n", description, err ? err->message : "unknown");
+        g_clear_error(&err);
+        g_free(description);
+        if (pipeline != NULL)
+            gst_object_unref(pipeline);
+        return RUN_ERROR;
+    }
+
+    stats->entered.assign(frames, GST_CLOCK_TIME_NONE);
+    stats->start = GST_CLOCK_TIME_NONE;
+    add_probe(pipeline, "source", "src", source_probe, stats);
+    add_probe(pipeline, "sink", "sink", sink_probe, stats);
+
+    /* Preroll first, so element setup and negotiation are not part of the measurement */
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    if (gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) == GST_STATE_CHANGE_FAILURE)
+    {
+        /* There is no converter in front of the filter, so a format it does
+         * not accept fails here instead of being silently converted */
+        g_printerr("'%s' could not preroll, format not supported?\n", description);
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        g_free(description);
+        return RUN_UNSUPPORTED;
+    }
+
+    stats->start = gst_util_get_timestamp();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    /* Wake up now and then to look at the queues until error or EOS */
+    bus = gst_element_get_bus(pipeline);
+    while ((msg = gst_bus_timed_pop_filtered(bus, QUEUE_SAMPLE_INTERVAL,
+                static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS))) == NULL)
+        sample_queues(pipeline, stats);
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+    {
+        gst_message_parse_error(msg, &err, NULL);
+        g_printerr("Error running '%s': %s\n", description, err->message);
+        g_clear_error(&err);
+    }
+    else
+    {
+        elapsed = (gint64)(gst_util_get_timestamp() - stats->start);
+    }
+
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    g_free(description);
+    return elapsed;
+}
+
+/* Value at the given percentile of sorted values */
+static gdouble percentile(const std::vector<gdouble> &sorted, gdouble pct)
+{
+    if (sorted.empty())
+        return 0.0;
+    return sorted[MIN(sorted.size() - 1, (size_t)(pct / 100.0 * sorted.size()))];
+}
+
+/* Writes the latency and queue columns of a CSV row from the measured runs */
+static void print_latency(FILE *csv, RunStats &stats)
+{
+    std::vector<gdouble> &latencies = stats.latencies;
+    gdouble mean = 0.0;
+
+    std::sort(latencies.begin(), latencies.end());
+    for (gdouble latency : latencies)
+        mean += latency;
+    if (!latencies.empty())
+        mean /= latencies.size();
+
+    fprintf(csv, "%" G_GUINT64_FORMAT ",%.2f,%.2f,%.2f,%.2f,", (guint64)runs * frames - stats.received,
+            mean, percentile(latencies, 50), percentile(latencies, 95), latencies.empty() ? 0.0 : latencies.back());
+
+    /* Mean and max buffers waiting in front of the filter and of the sink */
+    for (gint i = 0; i < N_QUEUES; i++)
+    {
+        if (stats.fill[i].samples > 0)
+            fprintf(csv, "%.1f,%u", (gdouble)stats.fill[i].sum / stats.fill[i].samples, stats.fill[i].max);
+        else
+            fprintf(csv, ",");
+        fputs(i + 1 < N_QUEUES ? "," : "\n", csv);
+    }
+}
+
+/* Warms up, runs the configuration and writes one CSV row. Returns the mean
+ * fps, or a negative value when the configuration could not run */
+static gdouble measure(FILE *csv, const BenchConfig &config, gdouble single_thread_fps)
+{
+    std::vector<gdouble> ns_per_frame;
+    gdouble mean = 0.0, stddev = 0.0, fps_min = G_MAXDOUBLE, fps_max = 0.0, fps_mean;
+    gchar *threads_str = config.n_threads >= 0 ? g_strdup_printf("%d", config.n_threads) : g_strdup("-");
+    RunStats stats = RunStats();
+
+    fprintf(csv, "%s,%s,%s,%dx%d,%s,%d,%d,", config.filter.c_str(), config.layout.c_str(), threads_str,
+            config.width, config.height, config.format.c_str(), config.framerate, frames);
+    g_free(threads_str);
+
+    for (gint i = 0; i < warmup_runs + runs; i++)
+    {
+        /* The first runs only warm up caches, the pool and the registry */
+        if (i == warmup_runs)
+            stats = RunStats();
+
+        gint64 elapsed = run_one(config, &stats);
+        if (elapsed <= 0)
+        {
+            fprintf(csv, "0,%s,,,,,,,,,,,,,,\n", elapsed == RUN_UNSUPPORTED ? "unsupported" : "error");
+            fflush(csv);
+            return -1.0;
+        }
+        if (i >= warmup_runs)
+            ns_per_frame.push_back((gdouble)elapsed / frames);
+    }
+
+    for (gdouble ns : ns_per_frame)
+    {
+        gdouble fps = 1e9 / ns;
+        mean += ns;
+        fps_min = MIN(fps_min, fps);
+        fps_max = MAX(fps_max, fps);
+    }
+    mean /= ns_per_frame.size();
+    for (gdouble ns : ns_per_frame)
+        stddev += (ns - mean) * (ns - mean);
+    stddev = sqrt(stddev / ns_per_frame.size());
+    fps_mean = 1e9 / mean;
+
+    fprintf(csv, "%d,%.1f,%.1f,%.1f,%.0f,%.0f,", runs, fps_mean, fps_min, fps_max, mean, stddev);
+    if (single_thread_fps > 0)
+        fprintf(csv, "%.2f", fps_mean / single_thread_fps);
+    fprintf(csv, ",");
+    print_latency(csv, stats);
+    fflush(csv);
+    return fps_mean;
+}
+
+int 
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    gchar **filter_list, **resolution_list, **format_list, **framerate_list, **layout_list;
+    std::vector<gint> thread_list;
+    FILE *csv = stdout;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- video filter throughput sweep");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+    trail_filter_register();
+    replay_src_register();
+
+    if (frames <= 0 || runs <= 0 || warmup_runs < 0)
+    {
+        g_printerr("--frames and --runs must be positive, --warmup cannot be negative.\n");
+        return -1;
+    }
+
+    if (output != NULL)
+    {
+        csv = fopen(output, "w");
+        if (csv == NULL)
+        {
+            g_printerr("Could not open %s for writing.\n", output);
+            return -1;
+        }
+    }
+
+    filter_list = g_strsplit(filters ? filters
+        : "identity,vertigotv,trailfilter:scalar,trailfilter:sse4.1,trailfilter:avx2", ",", -1);
+    resolution_list = g_strsplit(resolutions ? resolutions : "480p,720p,1080p,2160p", ",", -1);
+    format_list = g_strsplit(formats ? formats : "I420,NV12,BGRx", ",", -1);
+    framerate_list = g_strsplit(framerates ? framerates : "30", ",", -1);
+    layout_list = g_strsplit(layouts ? layouts : "linked", ",", -1);
+    thread_list = parse_threads(threads);
+
+    for (gchar **layout = layout_list; *layout != NULL; layout++)
+    {
+        if (g_strcmp0(*layout, "linked") != 0 && g_strcmp0(*layout, "queued") != 0)
+        {
+            g_printerr("Unknown layout '%s', use linked or queued.\n", *layout);
+            return -1;
+        }
+    }
+
+    fprintf(csv, "filter,layout,threads,resolution,format,framerate,frames,runs,"
+                 "fps_mean,fps_min,fps_max,ns_per_frame_mean,ns_per_frame_stddev,speedup,"
+                 "dropped,latency_ms_mean,latency_ms_p50,latency_ms_p95,latency_ms_max,"
+                 "filter_queue_mean,filter_queue_max,sink_queue_mean,sink_queue_max\n");
+
+    for (gchar **resolution = resolution_list; *resolution != NULL; resolution++)
+    {
+        BenchConfig config;
+
+        if (!parse_resolution(*resolution, &config.width, &config.height))
+        {
+            g_printerr("Unknown resolution '%s'.\n", *resolution);
+            continue;
+        }
+
+        for (gchar **format = format_list; *format != NULL; format++)
+        {
+            for (gchar **framerate = framerate_list; *framerate != NULL; framerate++)
+            {
+                config.format = *format;
+                config.framerate = (gint)g_ascii_strtoll(*framerate, NULL, 10);
+
+                for (gchar **filter = filter_list; *filter != NULL; filter++)
+                {
+                    /* Other filters run on the streaming thread only, one thread setting is enough */
+                    std::vector<gint> filter_threads = g_str_has_prefix(*filter, "trailfilter")
+                                                       ? thread_list : std::vector<gint>{ -1 };
+
+                    config.filter = *filter;
+                    for (gchar **layout = layout_list; *layout != NULL; layout++)
+                    {
+                        gdouble single_thread_fps = -1.0;
+
+                        config.layout = *layout;
+                        for (gint n_threads : filter_threads)
+                        {
+                            gdouble fps;
+
+                            config.n_threads = n_threads;
+                            fps = measure(csv, config, single_thread_fps);
+                            if (n_threads == 1)
+                                single_thread_fps = fps;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (csv != stdout)
+        fclose(csv);
+    g_strfreev(filter_list);
+    g_strfreev(resolution_list);
+    g_strfreev(format_list);
+    g_strfreev(framerate_list);
+    g_strfreev(layout_list);
+    return 0;
+}
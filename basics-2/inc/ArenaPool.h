@@ -0,0 +1,42 @@
+#ifndef ARENA_POOL_H
+#define ARENA_POOL_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+
+G_BEGIN_DECLS
+
+/* Buffer pool whose memory comes from one fixed arena.
+ *
+ * When the pool is configured it allocates a single block big enough for all
+ * its buffers, with every frame 64-byte aligned, and touches every page of it
+ * so no page faults happen while streaming. Buffers are recycled as with any
+ * GstVideoBufferPool, so once the pool is warm there is no allocator traffic
+ * at all on the streaming thread. Allocations that do not fit in the arena
+ * (too big, or arena exhausted) fall back to the heap and are counted. */
+
+#define ARENA_POOL_DEFAULT_SLOTS 6
+
+typedef struct _ArenaPoolStats {
+    guint acquired;             /* Buffers handed out by the pool */
+    guint allocated;            /* Buffers the pool had to create (pool misses) */
+    guint in_flight;            /* Buffers currently out of the pool */
+    guint peak_in_flight;       /* Most buffers out of the pool at the same time */
+    guint arena_hits;           /* Memory served from the arena */
+    guint arena_misses;         /* Memory that had to come from the heap */
+    gsize arena_size;           /* Size of the arena, in bytes */
+} ArenaPoolStats;
+
+/* Creates an unconfigured pool. max_buffers of its config (or n_slots when
+ * max_buffers is 0) decides how many frames the arena holds */
+GstBufferPool *arena_pool_new(guint n_slots);
+
+void arena_pool_get_stats(GstBufferPool *pool, ArenaPoolStats *stats);
+
+/* The same counters, as a structure named "arena-pool-stats" */
+GstStructure *arena_pool_stats_to_structure(const ArenaPoolStats *stats);
+
+G_END_DECLS
+
+#endif /* ARENA_POOL_H */
@@ -0,0 +1,51 @@
+#ifndef FILTER_SWITCHER_H
+#define FILTER_SWITCHER_H
+
+#include <gst/gst.h>
+
+/* Replaces the filter between two elements of a playing pipeline without
+ * stopping it.
+ *
+ * The upstream source pad is blocked, the old filter is drained with an EOS
+ * (so the frames it holds still come out), and once that EOS reaches its
+ * source pad the old filter is unlinked and the new one linked in its place.
+ * The sink pad of the video sink times the switch. */
+
+typedef struct _FilterSwitcher FilterSwitcher;
+
+/* How the last switch went */
+typedef struct _FilterSwitchStats {
+    guint switches;             /* Switches completed so far */
+    gdouble block_ms;           /* Request until the upstream pad was blocked */
+    gdouble drain_ms;           /* Blocked until the old filter was drained and replaced */
+    gdouble switch_ms;          /* Request until the first frame of the new filter reached the sink */
+    gdouble gap_ms;             /* Time the sink went without a frame around the switch */
+    guint64 dropped;            /* Frames missing at the sink around the switch */
+    guint64 total_dropped;      /* Over all switches */
+    gdouble max_switch_ms;      /* Slowest switch */
+} FilterSwitchStats;
+
+/* Called on the streaming thread when the first frame of a new filter reaches the sink */
+typedef void (*FilterSwitchedFunc)(const FilterSwitchStats *stats, gpointer user_data);
+
+/* filter must be linked between upstream and downstream in pipeline. sink is
+ * the element whose "sink" pad receives the output (downstream itself when it
+ * is the video sink). switched can be NULL */
+FilterSwitcher *filter_switcher_new(GstElement *pipeline, GstElement *upstream, GstElement *filter,
+                                    GstElement *downstream, GstElement *sink,
+                                    FilterSwitchedFunc switched, gpointer user_data);
+
+void filter_switcher_free(FilterSwitcher *switcher);
+
+/* Starts replacing the current filter with new_filter and returns at once,
+ * the switch happens on the streaming thread with the next frame. Takes
+ * ownership of new_filter. Returns FALSE, and drops new_filter, when a switch
+ * is still going on */
+gboolean filter_switcher_swap(FilterSwitcher *switcher, GstElement *new_filter);
+
+/* The filter currently linked, with a new reference */
+GstElement *filter_switcher_dup_filter(FilterSwitcher *switcher);
+
+void filter_switcher_get_stats(FilterSwitcher *switcher, FilterSwitchStats *stats);
+
+#endif /* FILTER_SWITCHER_H */
@@ -0,0 +1,43 @@
+#ifndef REPLAY_SRC_H
+#define REPLAY_SRC_H
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_REPLAY_SRC (gst_replay_src_get_type())
+#define GST_REPLAY_SRC(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_REPLAY_SRC, GstReplaySrc))
+
+/* Load generator that costs next to nothing per frame: once the caps are
+ * known it renders a few frames with videotestsrc (or decodes them from a
+ * local file) into a ring, then pushes them again and again as read-only
+ * references to the same memory, timestamped at the negotiated framerate. */
+typedef struct _GstReplaySrc {
+    GstPushSrc parent;
+
+    /* Properties, protected by the object lock */
+    guint n_frames;             /* Frames in the ring */
+    gint pattern;               /* videotestsrc pattern of the rendered frames */
+    gchar *location;            /* File decoded instead of videotestsrc, NULL for none */
+
+    /* Streaming thread only */
+    GstVideoInfo info;          /* Negotiated format */
+    GPtrArray *ring;            /* Pre-rendered GstBuffers, their memory is read-only */
+    guint64 n_pushed;           /* Frames pushed since start, numbers the next one */
+    GstClockTime timestamp_offset;  /* Running time of the first frame when live */
+} GstReplaySrc;
+
+typedef struct _GstReplaySrcClass {
+    GstPushSrcClass parent_class;
+} GstReplaySrcClass;
+
+GType gst_replay_src_get_type(void);
+
+/* Registers the element as "replaysrc" */
+gboolean replay_src_register(void);
+
+G_END_DECLS
+
+#endif /* REPLAY_SRC_H */
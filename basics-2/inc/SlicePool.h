@@ -0,0 +1,26 @@
+#ifndef SLICE_POOL_H
+#define SLICE_POOL_H
+
+/* Persistent worker threads to process one frame in horizontal slices.
+ *
+ * slice_pool_run() hands slice 0 to the calling thread and slices 1..N-1 to
+ * the workers, then waits for all of them (a barrier per frame). The workers
+ * sleep between frames, so an idle pool costs nothing. */
+
+typedef struct _SlicePool SlicePool;
+
+/* Called once per slice. slice goes from 0 to n_slices - 1 */
+typedef void (*SliceFunc)(void *user_data, unsigned slice, unsigned n_slices);
+
+/* Creates a pool that splits every job in n_threads slices (n_threads - 1 workers) */
+SlicePool *slice_pool_new(unsigned n_threads);
+
+/* Stops and joins the workers */
+void slice_pool_free(SlicePool *pool);
+
+unsigned slice_pool_get_n_threads(SlicePool *pool);
+
+/* Runs func on every slice and returns once all of them are done */
+void slice_pool_run(SlicePool *pool, SliceFunc func, void *user_data);
+
+#endif /* SLICE_POOL_H */
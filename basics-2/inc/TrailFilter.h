@@ -0,0 +1,62 @@
+#ifndef TRAIL_FILTER_H
+#define TRAIL_FILTER_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+
+#include "ArenaPool.h"
+#include "SlicePool.h"
+#include "TrailKernels.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_TRAIL_FILTER (gst_trail_filter_get_type())
+#define GST_TRAIL_FILTER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_TRAIL_FILTER, GstTrailFilter))
+
+/* Largest n-threads. A 480p frame cut in more slices than this gets slices of
+ * under 8 rows, where waking a worker costs more than blending its rows */
+#define TRAIL_FILTER_MAX_N_THREADS 64
+
+/* In-tree replacement for vertigotv: every frame is blended with the previous
+ * output, which leaves a fading trail behind anything that moves. The blend
+ * is done by the SIMD kernels of TrailKernels.h, picked at runtime. */
+typedef struct _GstTrailFilter {
+    GstVideoFilter parent;
+
+    /* Properties */
+    guint decay;                /* Weight of the previous output, 0 (none) to 255 */
+    gchar *kernel_name;         /* Requested kernel: auto, scalar, sse4.1 or avx2 */
+    guint n_threads;            /* Slices per frame, 0 means one per online core */
+    guint pool_size;            /* Frames in the arena of the proposed pool, 0 disables it */
+
+    /* Negotiated state */
+    TrailBlendFunc blend;       /* Kernel in use */
+    const gchar *blend_name;    /* Name of the kernel in use */
+    guint8 *history;            /* Previous output, width * 4 bytes per row */
+    gsize row_size;             /* Bytes per row of history */
+    gboolean history_valid;     /* Has history been filled by a first frame? */
+
+    /* Streaming thread only */
+    SlicePool *pool;            /* Workers processing the slices of each frame */
+
+    GstBufferPool *arena_pool;  /* Pool proposed upstream, protected by the object lock */
+    GstCaps *arena_caps;        /* Caps arena_pool was configured for */
+} GstTrailFilter;
+
+typedef struct _GstTrailFilterClass {
+    GstVideoFilterClass parent_class;
+} GstTrailFilterClass;
+
+GType gst_trail_filter_get_type(void);
+
+/* Registers the element as "trailfilter", so gst_element_factory_make and
+ * gst_parse_launch can create it like any other element */
+gboolean trail_filter_register(void);
+
+/* Slices the filter actually uses for an n-threads value */
+guint trail_filter_get_n_threads_used(guint n_threads);
+
+G_END_DECLS
+
+#endif /* TRAIL_FILTER_H */
@@ -0,0 +1,30 @@
+#ifndef TRAIL_KERNELS_H
+#define TRAIL_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Per-pixel kernels of the trailfilter element.
+ *
+ * Each kernel blends n_bytes of the current frame with the history (the
+ * previous output) and stores the result in both:
+ *
+ *     frame[i] = history[i] = (frame[i] * (256 - decay) + history[i] * decay) >> 8
+ *
+ * decay is in [0, 255]. Neither pointer needs to be aligned. */
+typedef void (*TrailBlendFunc)(uint8_t *frame, uint8_t *history, size_t n_bytes, unsigned decay);
+
+void trail_blend_scalar(uint8_t *frame, uint8_t *history, size_t n_bytes, unsigned decay);
+
+#ifdef TRAIL_HAVE_X86_KERNELS
+void trail_blend_sse41(uint8_t *frame, uint8_t *history, size_t n_bytes, unsigned decay);
+void trail_blend_avx2(uint8_t *frame, uint8_t *history, size_t n_bytes, unsigned decay);
+#endif
+
+/* Returns the kernel called name ("scalar", "sse4.1" or "avx2"), or the fastest
+ * one this CPU supports when name is NULL or "auto". The name of the returned
+ * kernel is stored in selected. Returns NULL when the requested kernel is not
+ * available on this build or CPU. */
+TrailBlendFunc trail_kernel_select(const char *name, const char **selected);
+
+#endif /* TRAIL_KERNELS_H */
@@ -0,0 +1,390 @@
+#include "ArenaPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC(arena_pool_debug);
+#define GST_CAT_DEFAULT arena_pool_debug
+
+/* Every frame in the arena starts on a 64-byte boundary (a cache line, and
+ * enough for aligned AVX-512 loads), the arena itself on a page boundary */
+#define ARENA_ALIGN 64
+#define ARENA_PAGE_SIZE 4096
+
+/* ArenaMemory.slot values that are not an index in the arena */
+#define ARENA_SLOT_HEAP   (-1)  /* Heap fallback, freed on release */
+#define ARENA_SLOT_SHARED (-2)  /* Sub-memory, the parent owns the data */
+
+/*** Allocator ***/
+
+typedef struct _ArenaAllocator {
+    GstAllocator parent;
+
+    guint8 *arena;
+    gsize slot_size;
+    guint n_slots;
+
+    GMutex lock;
+    guint *free_slots;          /* Stack of free slot indices, protected by lock */
+    guint n_free;
+
+    gint hits;                  /* Atomic */
+    gint misses;                /* Atomic */
+} ArenaAllocator;
+
+typedef struct _ArenaAllocatorClass {
+    GstAllocatorClass parent_class;
+} ArenaAllocatorClass;
+
+typedef struct _ArenaMemory {
+    GstMemory mem;
+    guint8 *data;
+    gint slot;
+} ArenaMemory;
+
+GType arena_allocator_get_type(void);
+G_DEFINE_TYPE(ArenaAllocator, arena_allocator, GST_TYPE_ALLOCATOR);
+
+#define ARENA_TYPE_ALLOCATOR (arena_allocator_get_type())
+#define ARENA_ALLOCATOR(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), ARENA_TYPE_ALLOCATOR, ArenaAllocator))
+
+static GstMemory *arena_allocator_alloc(GstAllocator *allocator, gsize size, GstAllocationParams *params)
+{
+    ArenaAllocator *arena = ARENA_ALLOCATOR(allocator);
+    ArenaMemory *mem = g_new(ArenaMemory, 1);
+    gsize maxsize = size + params->prefix + params->padding;
+    gsize align = params->align | (ARENA_ALIGN - 1);
+    gint slot = ARENA_SLOT_HEAP;
+
+    /* The arena can only honour up to ARENA_ALIGN alignment */
+    if (maxsize <= arena->slot_size && align == ARENA_ALIGN - 1)
+    {
+        g_mutex_lock(&arena->lock);
+        if (arena->n_free > 0)
+            slot = arena->free_slots[--arena->n_free];
+        g_mutex_unlock(&arena->lock);
+    }
+
+    if (slot != ARENA_SLOT_HEAP)
+    {
+        mem->data = arena->arena + (gsize)slot * arena->slot_size;
+        g_atomic_int_inc(&arena->hits);
+    }
+    else
+    {
+        void *data = NULL;
+        if (posix_memalign(&data, align + 1, maxsize) != 0)
+        {
+            g_free(mem);
+            return NULL;
+        }
+        mem->data = (guint8 *)data;
+        g_atomic_int_inc(&arena->misses);
+        GST_DEBUG_OBJECT(arena, "Arena miss for %" G_GSIZE_FORMAT " bytes", maxsize);
+    }
+    mem->slot = slot;
+
+    gst_memory_init(GST_MEMORY_CAST(mem), params->flags, allocator, NULL, maxsize, align, params->prefix, size);
+
+    if (params->prefix && (params->flags & GST_MEMORY_FLAG_ZERO_PREFIXED))
+        memset(mem->data, 0, params->prefix);
+    if (params->padding && (params->flags & GST_MEMORY_FLAG_ZERO_PADDED))
+        memset(mem->data + params->prefix + size, 0, params->padding);
+
+    return GST_MEMORY_CAST(mem);
+}
+
+static void arena_allocator_free(GstAllocator *allocator, GstMemory *memory)
+{
+    ArenaAllocator *arena = ARENA_ALLOCATOR(allocator);
+    ArenaMemory *mem = (ArenaMemory *)memory;
+
+    if (mem->slot >= 0)
+    {
+        g_mutex_lock(&arena->lock);
+        arena->free_slots[arena->n_free++] = mem->slot;
+        g_mutex_unlock(&arena->lock);
+    }
+    else if (mem->slot == ARENA_SLOT_HEAP)
+    {
+        free(mem->data);
+    }
+    g_free(mem);
+}
+
+static gpointer arena_memory_map(GstMemory *memory, gsize maxsize, GstMapFlags flags)
+{
+    return ((ArenaMemory *)memory)->data;
+}
+
+static void arena_memory_unmap(GstMemory *memory)
+{
+}
+
+static GstMemory *arena_memory_share(GstMemory *memory, gssize offset, gssize size)
+{
+    ArenaMemory *mem = (ArenaMemory *)memory;
+    ArenaMemory *sub = g_new(ArenaMemory, 1);
+    GstMemory *parent = memory->parent ? memory->parent : memory;
+
+    if (size == -1)
+        size = memory->size - offset;
+
+    /* Shared memory is always read-only and never goes back to the arena itself */
+    gst_memory_init(GST_MEMORY_CAST(sub),
+        (GstMemoryFlags)(GST_MINI_OBJECT_FLAGS(parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY),
+        memory->allocator, parent, memory->maxsize, memory->align, memory->offset + offset, size);
+    sub->data = mem->data;
+    sub->slot = ARENA_SLOT_SHARED;
+    return GST_MEMORY_CAST(sub);
+}
+
+static void arena_allocator_finalize(GObject *object)
+{
+    ArenaAllocator *arena = ARENA_ALLOCATOR(object);
+
+    free(arena->arena);
+    g_free(arena->free_slots);
+    g_mutex_clear(&arena->lock);
+
+    G_OBJECT_CLASS(arena_allocator_parent_class)->finalize(object);
+}
+
+static void arena_allocator_class_init(ArenaAllocatorClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS(klass);
+
+    gobject_class->finalize = arena_allocator_finalize;
+    allocator_class->alloc = arena_allocator_alloc;
+    allocator_class->free = arena_allocator_free;
+}
+
+static void arena_allocator_init(ArenaAllocator *arena)
+{
+    GstAllocator *allocator = GST_ALLOCATOR_CAST(arena);
+
+    allocator->mem_type = "ArenaMemory";
+    allocator->mem_map = arena_memory_map;
+    allocator->mem_unmap = arena_memory_unmap;
+    allocator->mem_share = arena_memory_share;
+    GST_OBJECT_FLAG_SET(arena, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
+
+    g_mutex_init(&arena->lock);
+}
+
+/* Creates an allocator with n_slots slots of at least size bytes, all pre-faulted */
+static ArenaAllocator *arena_allocator_new(gsize size, guint n_slots)
+{
+    ArenaAllocator *arena = (ArenaAllocator *)g_object_new(ARENA_TYPE_ALLOCATOR, NULL);
+    void *block = NULL;
+    gsize total;
+
+    /* GstObjects start floating, we own this one */
+    gst_object_ref_sink(arena);
+
+    arena->slot_size = (size + ARENA_ALIGN - 1) & ~(gsize)(ARENA_ALIGN - 1);
+    arena->n_slots = n_slots;
+    total = arena->slot_size * n_slots;
+
+    if (posix_memalign(&block, ARENA_PAGE_SIZE, total) != 0)
+    {
+        GST_ERROR("Could not allocate an arena of %" G_GSIZE_FORMAT " bytes", total);
+        gst_object_unref(arena);
+        return NULL;
+    }
+    /* Touch every page now, not on the first frame */
+    memset(block, 0, total);
+    arena->arena = (guint8 *)block;
+
+    arena->free_slots = g_new(guint, n_slots);
+    for (guint i = 0; i < n_slots; i++)
+        arena->free_slots[i] = n_slots - 1 - i;
+    arena->n_free = n_slots;
+
+    GST_INFO_OBJECT(arena, "Arena of %u slots of %" G_GSIZE_FORMAT " bytes", n_slots, arena->slot_size);
+    return arena;
+}
+
+/*** Pool ***/
+
+typedef struct _ArenaPool {
+    GstVideoBufferPool parent;
+
+    guint default_slots;
+    ArenaAllocator *allocator;  /* Replaced on every set_config that changes its layout */
+
+    gint acquired;              /* Atomic */
+    gint allocated;             /* Atomic */
+    gint in_flight;             /* Atomic */
+    gint peak_in_flight;        /* Atomic */
+    gint arena_hits;            /* Atomic, from the allocators this pool dropped */
+    gint arena_misses;          /* Atomic, from the allocators this pool dropped */
+} ArenaPool;
+
+typedef struct _ArenaPoolClass {
+    GstVideoBufferPoolClass parent_class;
+} ArenaPoolClass;
+
+GType arena_pool_get_type(void);
+G_DEFINE_TYPE(ArenaPool, arena_pool, GST_TYPE_VIDEO_BUFFER_POOL);
+
+#define ARENA_TYPE_POOL (arena_pool_get_type())
+#define ARENA_POOL(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), ARENA_TYPE_POOL, ArenaPool))
+
+/* Keeps the counters of an allocator the pool no longer uses, and drops it.
+ * Memory still out there keeps the allocator (and its arena) alive until it is freed */
+static void arena_pool_drop_allocator(ArenaPool *pool, ArenaAllocator *allocator)
+{
+    if (allocator == NULL)
+        return;
+
+    g_atomic_int_add(&pool->arena_hits, g_atomic_int_get(&allocator->hits));
+    g_atomic_int_add(&pool->arena_misses, g_atomic_int_get(&allocator->misses));
+    gst_object_unref(allocator);
+}
+
+static gboolean arena_pool_set_config(GstBufferPool *bpool, GstStructure *config)
+{
+    ArenaPool *pool = ARENA_POOL(bpool);
+    GstAllocationParams params;
+    GstCaps *caps;
+    guint size, min_buffers, max_buffers, n_slots;
+
+    if (!gst_buffer_pool_config_get_params(config, &caps, &size, &min_buffers, &max_buffers))
+        return FALSE;
+
+    /* The arena is fixed, so the pool can never grow beyond it */
+    n_slots = max_buffers > 0 ? max_buffers : MAX(min_buffers, pool->default_slots);
+    gst_buffer_pool_config_set_params(config, caps, size, MIN(min_buffers, n_slots), n_slots);
+
+    if (pool->allocator == NULL || pool->allocator->slot_size < size || pool->allocator->n_slots != n_slots)
+    {
+        /* Pre-faulting a big arena takes a while, do it before taking the lock */
+        ArenaAllocator *fresh = arena_allocator_new(size, n_slots);
+        ArenaAllocator *old;
+
+        if (fresh == NULL)
+            return FALSE;
+
+        GST_OBJECT_LOCK(pool);
+        old = pool->allocator;
+        pool->allocator = fresh;
+        GST_OBJECT_UNLOCK(pool);
+
+        arena_pool_drop_allocator(pool, old);
+    }
+
+    if (!gst_buffer_pool_config_get_allocator(config, NULL, &params))
+        gst_allocation_params_init(&params);
+    params.align |= ARENA_ALIGN - 1;
+    gst_buffer_pool_config_set_allocator(config, GST_ALLOCATOR(pool->allocator), &params);
+
+    return GST_BUFFER_POOL_CLASS(arena_pool_parent_class)->set_config(bpool, config);
+}
+
+static GstFlowReturn arena_pool_alloc_buffer(GstBufferPool *bpool, GstBuffer **buffer,
+                                             GstBufferPoolAcquireParams *params)
+{
+    g_atomic_int_inc(&ARENA_POOL(bpool)->allocated);
+    return GST_BUFFER_POOL_CLASS(arena_pool_parent_class)->alloc_buffer(bpool, buffer, params);
+}
+
+static GstFlowReturn arena_pool_acquire_buffer(GstBufferPool *bpool, GstBuffer **buffer,
+                                               GstBufferPoolAcquireParams *params)
+{
+    ArenaPool *pool = ARENA_POOL(bpool);
+    GstFlowReturn ret = GST_BUFFER_POOL_CLASS(arena_pool_parent_class)->acquire_buffer(bpool, buffer, params);
+
+    if (ret == GST_FLOW_OK)
+    {
+        gint in_flight = g_atomic_int_add(&pool->in_flight, 1) + 1;
+        gint peak = g_atomic_int_get(&pool->peak_in_flight);
+
+        g_atomic_int_inc(&pool->acquired);
+        while (in_flight > peak && !g_atomic_int_compare_and_exchange(&pool->peak_in_flight, peak, in_flight))
+            peak = g_atomic_int_get(&pool->peak_in_flight);
+    }
+    return ret;
+}
+
+static void arena_pool_release_buffer(GstBufferPool *bpool, GstBuffer *buffer)
+{
+    g_atomic_int_add(&ARENA_POOL(bpool)->in_flight, -1);
+    GST_BUFFER_POOL_CLASS(arena_pool_parent_class)->release_buffer(bpool, buffer);
+}
+
+static void arena_pool_finalize(GObject *object)
+{
+    ArenaPool *pool = ARENA_POOL(object);
+
+    arena_pool_drop_allocator(pool, pool->allocator);
+    pool->allocator = NULL;
+
+    G_OBJECT_CLASS(arena_pool_parent_class)->finalize(object);
+}
+
+static void arena_pool_class_init(ArenaPoolClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstBufferPoolClass *pool_class = GST_BUFFER_POOL_CLASS(klass);
+
+    gobject_class->finalize = arena_pool_finalize;
+    pool_class->set_config = arena_pool_set_config;
+    pool_class->alloc_buffer = arena_pool_alloc_buffer;
+    pool_class->acquire_buffer = arena_pool_acquire_buffer;
+    pool_class->release_buffer = arena_pool_release_buffer;
+
+    GST_DEBUG_CATEGORY_INIT(arena_pool_debug, "arenapool", 0, "Fixed arena buffer pool");
+}
+
+static void arena_pool_init(ArenaPool *pool)
+{
+    pool->default_slots = ARENA_POOL_DEFAULT_SLOTS;
+}
+
+GstBufferPool *arena_pool_new(guint n_slots)
+{
+    ArenaPool *pool = (ArenaPool *)g_object_new(ARENA_TYPE_POOL, NULL);
+
+    gst_object_ref_sink(pool);
+    if (n_slots > 0)
+        pool->default_slots = n_slots;
+    return GST_BUFFER_POOL(pool);
+}
+
+void arena_pool_get_stats(GstBufferPool *bpool, ArenaPoolStats *stats)
+{
+    ArenaPool *pool = ARENA_POOL(bpool);
+
+    stats->acquired = g_atomic_int_get(&pool->acquired);
+    stats->allocated = g_atomic_int_get(&pool->allocated);
+    stats->in_flight = g_atomic_int_get(&pool->in_flight);
+    stats->peak_in_flight = g_atomic_int_get(&pool->peak_in_flight);
+    stats->arena_hits = g_atomic_int_get(&pool->arena_hits);
+    stats->arena_misses = g_atomic_int_get(&pool->arena_misses);
+    stats->arena_size = 0;
+
+    GST_OBJECT_LOCK(pool);
+    if (pool->allocator != NULL)
+    {
+        stats->arena_hits += g_atomic_int_get(&pool->allocator->hits);
+        stats->arena_misses += g_atomic_int_get(&pool->allocator->misses);
+        stats->arena_size = pool->allocator->slot_size * pool->allocator->n_slots;
+    }
+    GST_OBJECT_UNLOCK(pool);
+}
+
+GstStructure *arena_pool_stats_to_structure(const ArenaPoolStats *stats)
+{
+    return gst_structure_new("arena-pool-stats",
+        "acquired", G_TYPE_UINT, stats->acquired,
+        "pool-hits", G_TYPE_UINT, stats->acquired - MIN(stats->allocated, stats->acquired),
+        "pool-misses", G_TYPE_UINT, stats->allocated,
+        "in-flight", G_TYPE_UINT, stats->in_flight,
+        "peak-in-flight", G_TYPE_UINT, stats->peak_in_flight,
+        "arena-hits", G_TYPE_UINT, stats->arena_hits,
+        "arena-misses", G_TYPE_UINT, stats->arena_misses,
+        "arena-size", G_TYPE_UINT64, (guint64)stats->arena_size,
+        NULL);
+}
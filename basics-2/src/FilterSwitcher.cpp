@@ -0,0 +1,230 @@
+#include "FilterSwitcher.h"
+
+GST_DEBUG_CATEGORY_STATIC(filter_switcher_debug);
+#define GST_CAT_DEFAULT filter_switcher_debug
+
+struct _FilterSwitcher {
+    GstElement *pipeline;
+    GstElement *upstream;
+    GstElement *downstream;
+    GstPad *block_pad;          /* Source pad of upstream, blocked during a switch */
+    GstPad *output_pad;         /* Sink pad of the video sink */
+    gulong output_probe;
+    FilterSwitchedFunc switched;
+    gpointer user_data;
+
+    GMutex lock;                /* Protects everything below */
+    GstElement *filter;         /* Filter in place, with a reference */
+    GstElement *next_filter;    /* Filter being swapped in, NULL when no switch is going on */
+    gulong block_probe;         /* Probe blocking block_pad, 0 when none */
+    gboolean awaiting_output;   /* Swapped, waiting for the first frame of the new filter */
+    GstClockTime requested;     /* gst_util_get_timestamp() when each step of the switch happened */
+    GstClockTime blocked;
+    GstClockTime drained;
+    GstClockTime last_output;   /* Last frame seen by the sink */
+    guint64 last_offset;        /* Its number, GST_BUFFER_OFFSET_NONE when unknown */
+    FilterSwitchStats stats;
+};
+
+static gdouble elapsed_ms(GstClockTime from, GstClockTime to)
+{
+    return (gdouble)GST_CLOCK_DIFF(from, to) / GST_MSECOND;
+}
+
+/* Every frame reaching the sink: closes the measurement of a switch */
+static GstPadProbeReturn filter_switcher_output_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    FilterSwitcher *switcher = (FilterSwitcher *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime now = gst_util_get_timestamp();
+    guint64 offset = GST_BUFFER_OFFSET(buffer);
+    FilterSwitchStats stats;
+    gboolean completed = FALSE;
+
+    g_mutex_lock(&switcher->lock);
+    if (switcher->awaiting_output)
+    {
+        FilterSwitchStats *s = &switcher->stats;
+
+        switcher->awaiting_output = FALSE;
+        s->switches++;
+        s->block_ms = elapsed_ms(switcher->requested, switcher->blocked);
+        s->drain_ms = elapsed_ms(switcher->blocked, switcher->drained);
+        s->switch_ms = elapsed_ms(switcher->requested, now);
+        s->gap_ms = GST_CLOCK_TIME_IS_VALID(switcher->last_output) ? elapsed_ms(switcher->last_output, now) : 0.0;
+
+        /* The source numbers its frames, a hole in the numbers is a lost frame */
+        s->dropped = 0;
+        if (GST_BUFFER_OFFSET_IS_VALID(buffer) && switcher->last_offset != GST_BUFFER_OFFSET_NONE
+            && offset > switcher->last_offset + 1)
+            s->dropped = offset - switcher->last_offset - 1;
+        s->total_dropped += s->dropped;
+        s->max_switch_ms = MAX(s->max_switch_ms, s->switch_ms);
+
+        stats = *s;
+        completed = TRUE;
+    }
+    switcher->last_output = now;
+    switcher->last_offset = GST_BUFFER_OFFSET_IS_VALID(buffer) ? offset : GST_BUFFER_OFFSET_NONE;
+    g_mutex_unlock(&switcher->lock);
+
+    if (completed && switcher->switched != NULL)
+        switcher->switched(&stats, switcher->user_data);
+    return GST_PAD_PROBE_OK;
+}
+
+/* The EOS sent into the old filter came out: all its frames went downstream,
+ * so it can be replaced. Runs on the streaming thread */
+static GstPadProbeReturn filter_switcher_eos_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    FilterSwitcher *switcher = (FilterSwitcher *)user_data;
+    GstElement *old_filter, *new_filter;
+    gulong block_probe;
+
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+        return GST_PAD_PROBE_PASS;
+    gst_pad_remove_probe(pad, GST_PAD_PROBE_INFO_ID(info));
+
+    g_mutex_lock(&switcher->lock);
+    old_filter = switcher->filter;
+    new_filter = switcher->next_filter;
+    g_mutex_unlock(&switcher->lock);
+
+    GST_INFO("Replacing %s with %s", GST_OBJECT_NAME(old_filter), GST_OBJECT_NAME(new_filter));
+
+    gst_element_set_state(old_filter, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(switcher->pipeline), old_filter);
+
+    gst_bin_add(GST_BIN(switcher->pipeline), new_filter);
+    if (!gst_element_link_many(switcher->upstream, new_filter, switcher->downstream, NULL))
+        GST_ELEMENT_ERROR(switcher->pipeline, CORE, PAD, ("Could not link %s in place of %s",
+                          GST_OBJECT_NAME(new_filter), GST_OBJECT_NAME(old_filter)), (NULL));
+    gst_element_sync_state_with_parent(new_filter);
+
+    g_mutex_lock(&switcher->lock);
+    switcher->filter = new_filter;
+    switcher->next_filter = NULL;
+    switcher->drained = gst_util_get_timestamp();
+    switcher->awaiting_output = TRUE;
+    block_probe = switcher->block_probe;
+    switcher->block_probe = 0;
+    g_mutex_unlock(&switcher->lock);
+
+    gst_object_unref(old_filter);
+
+    /* Let the frame waiting upstream go into the new filter */
+    gst_pad_remove_probe(switcher->block_pad, block_probe);
+
+    /* This EOS was only for the old filter */
+    return GST_PAD_PROBE_DROP;
+}
+
+/* Upstream is blocked with a frame in hand: drain the old filter. With the
+ * usual filters the EOS goes through on this thread and filter_switcher_eos_cb
+ * has swapped them before gst_pad_send_event returns. If it goes through a
+ * thread of the filter instead, the pad stays blocked until it is done */
+static GstPadProbeReturn filter_switcher_block_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    FilterSwitcher *switcher = (FilterSwitcher *)user_data;
+    GstElement *old_filter;
+    GstPad *old_src, *old_sink;
+
+    g_mutex_lock(&switcher->lock);
+    switcher->blocked = gst_util_get_timestamp();
+    old_filter = (GstElement *)gst_object_ref(switcher->filter);
+    g_mutex_unlock(&switcher->lock);
+
+    old_src = gst_element_get_static_pad(old_filter, "src");
+    gst_pad_add_probe(old_src, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BLOCK | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      filter_switcher_eos_cb, switcher, NULL);
+    gst_object_unref(old_src);
+
+    old_sink = gst_element_get_static_pad(old_filter, "sink");
+    gst_pad_send_event(old_sink, gst_event_new_eos());
+    gst_object_unref(old_sink);
+    gst_object_unref(old_filter);
+
+    /* filter_switcher_eos_cb removes this probe, which unblocks the pad */
+    return GST_PAD_PROBE_OK;
+}
+
+FilterSwitcher *filter_switcher_new(GstElement *pipeline, GstElement *upstream, GstElement *filter,
+                                    GstElement *downstream, GstElement *sink,
+                                    FilterSwitchedFunc switched, gpointer user_data)
+{
+    FilterSwitcher *switcher = g_new0(FilterSwitcher, 1);
+
+    if (filter_switcher_debug == NULL)
+        GST_DEBUG_CATEGORY_INIT(filter_switcher_debug, "filterswitcher", 0, "Runtime filter switching");
+
+    switcher->pipeline = pipeline;
+    switcher->upstream = upstream;
+    switcher->downstream = downstream;
+    switcher->block_pad = gst_element_get_static_pad(upstream, "src");
+    switcher->output_pad = gst_element_get_static_pad(sink, "sink");
+    switcher->switched = switched;
+    switcher->user_data = user_data;
+
+    g_mutex_init(&switcher->lock);
+    switcher->filter = (GstElement *)gst_object_ref(filter);
+    switcher->last_output = GST_CLOCK_TIME_NONE;
+    switcher->last_offset = GST_BUFFER_OFFSET_NONE;
+
+    switcher->output_probe = gst_pad_add_probe(switcher->output_pad, GST_PAD_PROBE_TYPE_BUFFER,
+                                               filter_switcher_output_cb, switcher, NULL);
+    return switcher;
+}
+
+void filter_switcher_free(FilterSwitcher *switcher)
+{
+    gst_pad_remove_probe(switcher->output_pad, switcher->output_probe);
+    if (switcher->block_probe != 0)
+        gst_pad_remove_probe(switcher->block_pad, switcher->block_probe);
+
+    gst_object_unref(switcher->block_pad);
+    gst_object_unref(switcher->output_pad);
+    gst_object_unref(switcher->filter);
+    if (switcher->next_filter != NULL)
+        gst_object_unref(switcher->next_filter);
+    g_mutex_clear(&switcher->lock);
+    g_free(switcher);
+}
+
+gboolean filter_switcher_swap(FilterSwitcher *switcher, GstElement *new_filter)
+{
+    gst_object_ref_sink(new_filter);
+
+    g_mutex_lock(&switcher->lock);
+    if (switcher->next_filter != NULL)
+    {
+        g_mutex_unlock(&switcher->lock);
+        gst_object_unref(new_filter);
+        return FALSE;
+    }
+    switcher->next_filter = new_filter;
+    switcher->requested = gst_util_get_timestamp();
+
+    /* Under the lock: filter_switcher_block_cb may run on the streaming
+     * thread right away and must find the probe id in place */
+    switcher->block_probe = gst_pad_add_probe(switcher->block_pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                                              filter_switcher_block_cb, switcher, NULL);
+    g_mutex_unlock(&switcher->lock);
+    return TRUE;
+}
+
+GstElement *filter_switcher_dup_filter(FilterSwitcher *switcher)
+{
+    GstElement *filter;
+
+    g_mutex_lock(&switcher->lock);
+    filter = (GstElement *)gst_object_ref(switcher->filter);
+    g_mutex_unlock(&switcher->lock);
+    return filter;
+}
+
+void filter_switcher_get_stats(FilterSwitcher *switcher, FilterSwitchStats *stats)
+{
+    g_mutex_lock(&switcher->lock);
+    *stats = switcher->stats;
+    g_mutex_unlock(&switcher->lock);
+}
@@ -1,6 +1,211 @@
 #include <iostream>
+#include <stdio.h>
 #include <gst/gst.h>
 
+#include "FilterSwitcher.h"
+#include "ReplaySrc.h"
+#include "StartupTimer.h"
+#include "StaticPlugins.h"
+#include "TrailFilter.h"
+
+/* Command line options */
+static gchar *startup_report = NULL;
+static gchar *filter_name = NULL;
+static gchar *source_name = NULL;
+static gint filter_threads = -1;
+static gint num_buffers = -1;
+static gboolean queued = FALSE;
+static gint queue_buffers = 200;
+static gint queue_time = 1000;
+static gchar *leaky = NULL;
+static gchar *swap_filters = NULL;
+static gint swap_interval = 0;
+
+static GOptionEntry entries[] = {
+    { "filter", 'f', 0, G_OPTION_ARG_STRING, &filter_name,
+      "Element between source and sink: vertigotv (default), trailfilter or any other video filter", "NAME" },
+    { "source", 's', 0, G_OPTION_ARG_STRING, &source_name,
+      "Source element: videotestsrc (default) or replaysrc, which replays frames rendered once", "NAME" },
+    { "num-buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers,
+      "Stop (EOS) after N frames instead of running forever", "N" },
+    { "threads", 't', 0, G_OPTION_ARG_INT, &filter_threads,
+      "Slices processed in parallel per frame by trailfilter (0 = one per online core, "
+      G_STRINGIFY(TRAIL_FILTER_MAX_N_THREADS) " at most)", "N" },
+    { "queued", 'q', 0, G_OPTION_ARG_NONE, &queued,
+      "Put a queue in front of the filter and the sink, so every stage runs on its own thread", NULL },
+    { "queue-buffers", 0, 0, G_OPTION_ARG_INT, &queue_buffers,
+      "Frames each queue holds with --queued, 0 = unlimited (default 200)", "N" },
+    { "queue-time", 0, 0, G_OPTION_ARG_INT, &queue_time,
+      "max-size-time of each queue with --queued in ms, 0 = unlimited (default 1000, as in queue itself)", "MS" },
+    { "leaky", 0, 0, G_OPTION_ARG_STRING, &leaky,
+      "What full queues do with --queued: no (block, default), upstream (drop new frames) or downstream (drop old frames)", "POLICY" },
+    { "swap-filters", 'w', 0, G_OPTION_ARG_STRING, &swap_filters,
+      "Comma separated filters to cycle through while playing: Enter switches to the next one, "
+      "a filter name to that filter, q quits", "LIST" },
+    { "swap-interval", 0, 0, G_OPTION_ARG_INT, &swap_interval,
+      "With --swap-filters, also switch to the next filter every MS milliseconds", "MS" },
+    { "startup-report", 0, 0, G_OPTION_ARG_STRING, &startup_report,
+      "Print how long each startup phase took and quit once playing. MODE is cold or warm (registry)", "MODE" },
+    { NULL }
+};
+
+/* Creates one of the --queued decoupling queues. The number of frames and
+ * --queue-time bound it, a 10 MB byte limit would hold a single 2160p frame */
+static GstElement *decoupling_queue_new(const gchar *name)
+{
+    GstElement *queue = gst_element_factory_make("queue", name);
+
+    if (queue != NULL)
+    {
+        g_object_set(queue, "max-size-buffers", (guint)queue_buffers, "max-size-bytes", 0,
+                     "max-size-time", (guint64)queue_time * GST_MSECOND, NULL);
+        if (leaky != NULL)
+            gst_util_set_object_arg(G_OBJECT(queue), "leaky", leaky);
+    }
+    return queue;
+}
+
+/* Creates a filter and applies the options that concern it */
+static GstElement *filter_new(const gchar *factory_name, const gchar *name)
+{
+    GstElement *filter = gst_element_factory_make(factory_name, name);
+
+    /* Only the in-tree filter knows how to split frames in slices */
+    if (filter != NULL && filter_threads >= 0)
+    {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(filter), "n-threads") != NULL)
+            g_object_set(filter, "n-threads", (guint)filter_threads, NULL);
+        else
+            g_printerr("%s does not support --threads, ignoring it.\n", factory_name);
+    }
+    return filter;
+}
+
+/* State of the --swap-filters mode */
+typedef struct _SwapData {
+    GMainLoop *loop;
+    FilterSwitcher *switcher;
+    gchar **filters;            /* Filters to cycle through */
+    guint next;                 /* Index of the next one */
+    GstMessage *msg;            /* ERROR or EOS that ended the loop, NULL if the user quit */
+    guint stdin_watch;          /* Source reading commands, 0 once stdin is closed */
+    guint timeout;              /* --swap-interval source, 0 if none */
+} SwapData;
+
+/* Called on the streaming thread once the new filter's first frame is out */
+static void print_switch(const FilterSwitchStats *stats, gpointer user_data)
+{
+    g_print("Switch %u took %.1f ms (blocked after %.1f ms, drained and relinked in %.1f ms), "
+            "%.1f ms without output, %" G_GUINT64_FORMAT " frames dropped\n",
+            stats->switches, stats->switch_ms, stats->block_ms, stats->drain_ms,
+            stats->gap_ms, stats->dropped);
+}
+
+static void swap_to(SwapData *data, const gchar *factory_name)
+{
+    GstElement *next = filter_new(factory_name, NULL);
+
+    if (next == NULL)
+        g_printerr("Could not create %s.\n", factory_name);
+    else if (!filter_switcher_swap(data->switcher, next))
+        g_printerr("The previous switch is still going on, try again.\n");
+    else
+        g_print("Switching to %s...\n", factory_name);
+}
+
+static void swap_to_next(SwapData *data)
+{
+    swap_to(data, data->filters[data->next]);
+    data->next = (data->next + 1) % g_strv_length(data->filters);
+}
+
+/* One command per line on stdin */
+static gboolean swap_stdin_cb(GIOChannel *source, GIOCondition cond, SwapData *data)
+{
+    gchar *line = NULL;
+    GIOStatus status = g_io_channel_read_line(source, &line, NULL, NULL, NULL);
+
+    /* stdin closed: only the bus or the timer can end the loop now */
+    if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR)
+    {
+        data->stdin_watch = 0;
+        return FALSE;
+    }
+    if (status != G_IO_STATUS_NORMAL)
+        return TRUE;
+
+    g_strstrip(line);
+    if (g_strcmp0(line, "q") == 0)
+        g_main_loop_quit(data->loop);
+    else if (*line == '\0')
+        swap_to_next(data);
+    else
+        swap_to(data, line);
+
+    g_free(line);
+    return TRUE;
+}
+
+static gboolean swap_timeout_cb(SwapData *data)
+{
+    swap_to_next(data);
+    return TRUE;
+}
+
+static gboolean swap_bus_cb(GstBus *bus, GstMessage *msg, SwapData *data)
+{
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR || GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS)
+    {
+        data->msg = gst_message_ref(msg);
+        g_main_loop_quit(data->loop);
+    }
+    return TRUE;
+}
+
+/* Plays until error, EOS or q, switching filters on command. Returns the
+ * message that ended playback, if any */
+static GstMessage *run_swap_loop(GstBus *bus, FilterSwitcher *switcher, const gchar *current)
+{
+    SwapData data;
+    GIOChannel *io_stdin;
+    FilterSwitchStats stats;
+
+    data.loop = g_main_loop_new(NULL, FALSE);
+    data.switcher = switcher;
+    data.filters = g_strsplit(swap_filters, ",", -1);
+    data.msg = NULL;
+    data.timeout = 0;
+
+    /* Do not start the cycle by switching to the filter already playing */
+    data.next = g_strv_length(data.filters) > 1 && g_strcmp0(data.filters[0], current) == 0 ? 1 : 0;
+
+    g_print("Press Enter to switch to the next filter of %s, type a filter name to switch to it, q to quit.\n",
+            swap_filters);
+
+    gst_bus_add_watch(bus, (GstBusFunc)swap_bus_cb, &data);
+    io_stdin = g_io_channel_unix_new(fileno(stdin));
+    data.stdin_watch = g_io_add_watch(io_stdin, G_IO_IN, (GIOFunc)swap_stdin_cb, &data);
+    if (swap_interval > 0)
+        data.timeout = g_timeout_add(swap_interval, (GSourceFunc)swap_timeout_cb, &data);
+
+    g_main_loop_run(data.loop);
+
+    filter_switcher_get_stats(switcher, &stats);
+    g_print("%u switches, slowest %.1f ms, %" G_GUINT64_FORMAT " frames dropped in total\n",
+            stats.switches, stats.max_switch_ms, stats.total_dropped);
+
+    /* The sources point at data, which is gone once we return */
+    gst_bus_remove_watch(bus);
+    if (data.stdin_watch != 0)
+        g_source_remove(data.stdin_watch);
+    if (data.timeout != 0)
+        g_source_remove(data.timeout);
+    g_io_channel_unref(io_stdin);
+    g_strfreev(data.filters);
+    g_main_loop_unref(data.loop);
+    return data.msg;
+}
+
 int 
 main(int argc, char* argv[])
 {
@@ -8,24 +213,64 @@ main(int argc, char* argv[])
 
     // Exercise section of the tutorial
     GstElement *filter;
+    GstElement *filter_queue = NULL, *sink_queue = NULL;
+    FilterSwitcher *switcher = NULL;
 
     GstBus *bus;
     GstMessage *msg;
     GstStateChangeReturn ret;
+    GOptionContext *context;
+    GError *err = NULL;
+
+    startup_timer_init();
+
+    /* Parse our own options. GStreamer's ones are left in argv for gst_init */
+    context = g_option_context_new("- test pattern tutorial");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_set_ignore_unknown_options(context, TRUE);
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (g_strcmp0(startup_report, "cold") == 0)
+        startup_timer_use_cold_registry();
 
     /* Initialize GStreamer */
+    static_plugins_prepare();
     gst_init (&argc, &argv);
+    static_plugins_register();
+    trail_filter_register();
+    replay_src_register();
+    startup_timer_mark("registry-ready");
 
     /* Create the elements */
-    source = gst_element_factory_make("videotestsrc", "video_source");
+    source = gst_element_factory_make(source_name ? source_name : "videotestsrc", "video_source");
     sink = gst_element_factory_make("autovideosink", "video_sink");
 
     // Exercise section of the tutorial
-    filter = gst_element_factory_make("vertigotv", "video_filter");
+    filter = filter_new(filter_name ? filter_name : "vertigotv", "video_filter");
 
     /* Create the empty pipeline */
     pipeline = gst_pipeline_new("test-pipeline");
 
+    if (queued)
+    {
+        filter_queue = decoupling_queue_new("filter_queue");
+        sink_queue = decoupling_queue_new("sink_queue");
+    }
+
+    if (!pipeline || !source || !filter || !sink || (queued && (!filter_queue || !sink_queue)))
+    {
+        g_printerr("Not all elements could be created.\n");
+        return -1;
+    }
+    startup_timer_mark("elements-created");
+
     /* Build the pipeline */
     gst_bin_add_many(GST_BIN(pipeline), 
                             source,
@@ -33,9 +278,20 @@ main(int argc, char* argv[])
                             sink,
                             NULL);
     
-    if (gst_element_link(source, filter) != TRUE || 
-        gst_element_link(filter, sink)   != TRUE
-        )
+    if (queued)
+    {
+        /* source -> queue -> filter -> queue -> sink, each queue starts a streaming thread */
+        gst_bin_add_many(GST_BIN(pipeline), filter_queue, sink_queue, NULL);
+        if (gst_element_link_many(source, filter_queue, filter, sink_queue, sink, NULL) != TRUE)
+        {
+            g_printerr("Elements could not be linked");
+            gst_object_unref(pipeline);
+            return -1;
+        }
+    }
+    else if (gst_element_link(source, filter) != TRUE || 
+             gst_element_link(filter, sink)   != TRUE
+            )
     {
         g_printerr("Elements could not be linked");
         gst_object_unref(pipeline);
@@ -49,6 +305,15 @@ main(int argc, char* argv[])
      * or using gst-inspect-1.0 tool
      */
     g_object_set(source, "pattern", 0, NULL);
+    g_object_set(source, "num-buffers", num_buffers, NULL);
+
+    /* The filter can be replaced while playing, between whatever is around it */
+    if (swap_filters != NULL)
+        switcher = filter_switcher_new(pipeline, queued ? filter_queue : source, filter,
+                                       queued ? sink_queue : sink, sink, print_switch, NULL);
+
+    /* Timestamp the first frame reaching the sink */
+    startup_timer_watch_first_buffer(sink, "first-buffer:video_sink");
 
     /* Start playing */
     ret = gst_element_set_state(pipeline, GST_STATE_PLAYING);
@@ -61,8 +326,28 @@ main(int argc, char* argv[])
 
     /* Wait until error or EOS */
     bus = gst_element_get_bus (pipeline);
-    msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
-        static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    if (startup_report != NULL)
+    {
+        /* In report mode we only wait for the pipeline to preroll and start playing */
+        msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+            static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_ASYNC_DONE));
+        if (msg != NULL && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ASYNC_DONE)
+        {
+            startup_timer_mark("async-done");
+            startup_timer_print_report();
+            gst_message_unref(msg);
+            msg = NULL;
+        }
+    }
+    else if (switcher != NULL)
+    {
+        msg = run_swap_loop(bus, switcher, filter_name ? filter_name : "vertigotv");
+    }
+    else
+    {
+        msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+            static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    }
 
     /* Parse error msg */
     if (msg != NULL)
@@ -95,6 +380,23 @@ main(int argc, char* argv[])
         gst_message_unref(msg);
     }
 
+    /* Report how the arena pool of the in-tree filter behaved. The filter may
+     * have been switched since, ask for the one in place */
+    filter = switcher ? filter_switcher_dup_filter(switcher) : (GstElement *)gst_object_ref(filter);
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(filter), "pool-stats") != NULL)
+    {
+        GstStructure *stats = NULL;
+        g_object_get(filter, "pool-stats", &stats, NULL);
+        if (stats != NULL)
+        {
+            gchar *str = gst_structure_to_string(stats);
+            g_print("Pool statistics: %s\n", str);
+            g_free(str);
+            gst_structure_free(stats);
+        }
+    }
+    gst_object_unref(filter);
+
     /* Free resources */
     gst_object_unref (bus);
 
@@ -104,7 +406,15 @@ main(int argc, char* argv[])
      * Finally, unreferencing the pipeline will destroy it, and all its contents."
      */ 
     gst_element_set_state (pipeline, GST_STATE_NULL);
+    if (switcher != NULL)
+        filter_switcher_free(switcher);
     gst_object_unref (pipeline);
+    startup_timer_cleanup();
+    g_free(startup_report);
+    g_free(filter_name);
+    g_free(source_name);
+    g_free(leaky);
+    g_free(swap_filters);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,431 @@
+#include "ReplaySrc.h"
+
+GST_DEBUG_CATEGORY_STATIC(replay_src_debug);
+#define GST_CAT_DEFAULT replay_src_debug
+
+enum {
+    PROP_0,
+    PROP_FRAMES,
+    PROP_PATTERN,
+    PROP_LOCATION,
+    PROP_IS_LIVE,
+};
+
+#define DEFAULT_FRAMES 30
+#define DEFAULT_PATTERN 0
+#define DEFAULT_WIDTH 1280
+#define DEFAULT_HEIGHT 720
+#define DEFAULT_FPS_N 30
+
+/* Formats videotestsrc and videoconvert both produce */
+#define REPLAY_SRC_CAPS GST_VIDEO_CAPS_MAKE("{ BGRx, RGBx, xRGB, xBGR, BGRA, RGBA, ARGB, ABGR, " \
+                                            "I420, YV12, NV12, NV21, YUY2, UYVY, GRAY8 }")
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(REPLAY_SRC_CAPS));
+
+/* Frames collected by the rendering pipeline */
+typedef struct _RenderJob {
+    GPtrArray *frames;
+    guint wanted;
+} RenderJob;
+
+G_DEFINE_TYPE(GstReplaySrc, gst_replay_src, GST_TYPE_PUSH_SRC);
+
+static void gst_replay_src_set_property(GObject *object, guint prop_id,
+                                        const GValue *value, GParamSpec *pspec)
+{
+    GstReplaySrc *src = GST_REPLAY_SRC(object);
+
+    switch (prop_id)
+    {
+        case PROP_FRAMES:
+        GST_OBJECT_LOCK(src);
+        src->n_frames = g_value_get_uint(value);
+        GST_OBJECT_UNLOCK(src);
+        break;
+
+        case PROP_PATTERN:
+        GST_OBJECT_LOCK(src);
+        src->pattern = g_value_get_int(value);
+        GST_OBJECT_UNLOCK(src);
+        break;
+
+        case PROP_LOCATION:
+        GST_OBJECT_LOCK(src);
+        g_free(src->location);
+        src->location = g_value_dup_string(value);
+        GST_OBJECT_UNLOCK(src);
+        break;
+
+        case PROP_IS_LIVE:
+        gst_base_src_set_live(GST_BASE_SRC(src), g_value_get_boolean(value));
+        break;
+
+        default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void gst_replay_src_get_property(GObject *object, guint prop_id,
+                                        GValue *value, GParamSpec *pspec)
+{
+    GstReplaySrc *src = GST_REPLAY_SRC(object);
+
+    switch (prop_id)
+    {
+        case PROP_FRAMES:
+        GST_OBJECT_LOCK(src);
+        g_value_set_uint(value, src->n_frames);
+        GST_OBJECT_UNLOCK(src);
+        break;
+
+        case PROP_PATTERN:
+        GST_OBJECT_LOCK(src);
+        g_value_set_int(value, src->pattern);
+        GST_OBJECT_UNLOCK(src);
+        break;
+
+        case PROP_LOCATION:
+        GST_OBJECT_LOCK(src);
+        g_value_set_string(value, src->location);
+        GST_OBJECT_UNLOCK(src);
+        break;
+
+        case PROP_IS_LIVE:
+        g_value_set_boolean(value, gst_base_src_is_live(GST_BASE_SRC(src)));
+        break;
+
+        default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void gst_replay_src_clear_ring(GstReplaySrc *src)
+{
+    if (src->ring != NULL)
+    {
+        g_ptr_array_unref(src->ring);
+        src->ring = NULL;
+    }
+}
+
+static void gst_replay_src_finalize(GObject *object)
+{
+    GstReplaySrc *src = GST_REPLAY_SRC(object);
+
+    gst_replay_src_clear_ring(src);
+    g_free(src->location);
+
+    G_OBJECT_CLASS(gst_replay_src_parent_class)->finalize(object);
+}
+
+/* fakesink handoff of the rendering pipeline: keeps the first frames */
+static void gst_replay_src_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data)
+{
+    RenderJob *job = (RenderJob *)user_data;
+    GstBuffer *copy;
+
+    if (job->frames->len >= job->wanted)
+        return;
+
+    /* A deep copy, holding on to the upstream buffers would empty their pool.
+     * Nobody may write into the ring: downstream gets a copy if it tries */
+    copy = gst_buffer_copy_deep(buffer);
+    for (guint i = 0; i < gst_buffer_n_memory(copy); i++)
+        GST_MINI_OBJECT_FLAG_SET(gst_buffer_peek_memory(copy, i), GST_MEMORY_FLAG_READONLY);
+    g_ptr_array_add(job->frames, copy);
+
+    /* A file can be much longer than the ring, no need to decode it all */
+    if (job->frames->len == job->wanted)
+        gst_element_post_message(sink, gst_message_new_application(GST_OBJECT(sink),
+                                       gst_structure_new_empty("replaysrc-ring-full")));
+}
+
+/* Runs videotestsrc, or the decoder of the file, until the ring holds
+ * n_frames frames in the negotiated format */
+static gboolean gst_replay_src_render_ring(GstReplaySrc *src, GstCaps *caps)
+{
+    GstElement *pipeline, *capsfilter, *sink;
+    GstCaps *render_caps;
+    GstBus *bus;
+    GstMessage *msg;
+    GError *err = NULL;
+    RenderJob job;
+    gchar *description, *location;
+    gint pattern;
+    gboolean ok = TRUE;
+
+    GST_OBJECT_LOCK(src);
+    job.wanted = src->n_frames;
+    pattern = src->pattern;
+    location = g_strdup(src->location);
+    GST_OBJECT_UNLOCK(src);
+
+    if (location != NULL)
+        description = g_strdup("filesrc name=source ! decodebin ! videoconvert ! videoscale ! "
+                               "capsfilter name=caps ! fakesink name=sink sync=false signal-handoffs=true");
+    else
+        description = g_strdup_printf("videotestsrc pattern=%d num-buffers=%u ! "
+                                      "capsfilter name=caps ! fakesink name=sink sync=false signal-handoffs=true",
+                                      pattern, job.wanted);
+
+    pipeline = gst_parse_launch(description, &err);
+    g_free(description);
+    if (pipeline == NULL || err != NULL)
+    {
+        GST_ELEMENT_ERROR(src, CORE, FAILED, ("Could not create the rendering pipeline"),
+                          ("%s", err ? err->message : "unknown error"));
+        g_clear_error(&err);
+        g_free(location);
+        if (pipeline != NULL)
+            gst_object_unref(pipeline);
+        return FALSE;
+    }
+
+    if (location != NULL)
+    {
+        GstElement *filesrc = gst_bin_get_by_name(GST_BIN(pipeline), "source");
+        g_object_set(filesrc, "location", location, NULL);
+        gst_object_unref(filesrc);
+    }
+
+    /* The framerate is ours to set through the timestamps, the file can have any */
+    render_caps = gst_caps_copy(caps);
+    gst_structure_remove_field(gst_caps_get_structure(render_caps, 0), "framerate");
+    capsfilter = gst_bin_get_by_name(GST_BIN(pipeline), "caps");
+    g_object_set(capsfilter, "caps", render_caps, NULL);
+    gst_object_unref(capsfilter);
+    gst_caps_unref(render_caps);
+
+    job.frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+    sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    g_signal_connect(sink, "handoff", G_CALLBACK(gst_replay_src_handoff), &job);
+    gst_object_unref(sink);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    bus = gst_element_get_bus(pipeline);
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_APPLICATION));
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+    {
+        gst_message_parse_error(msg, &err, NULL);
+        GST_ELEMENT_ERROR(src, RESOURCE, FAILED, ("Could not render the frames to replay"),
+                          ("%s: %s", GST_OBJECT_NAME(msg->src), err->message));
+        g_clear_error(&err);
+        ok = FALSE;
+    }
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+
+    /* The handoffs are over once the pipeline is stopped */
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    if (ok && job.frames->len == 0)
+    {
+        GST_ELEMENT_ERROR(src, RESOURCE, FAILED, ("Could not render the frames to replay"),
+                          ("%s produced no frame", location ? location : "videotestsrc"));
+        ok = FALSE;
+    }
+
+    if (ok)
+    {
+        GST_INFO_OBJECT(src, "Replaying %u frames of %" GST_PTR_FORMAT, job.frames->len, caps);
+        gst_replay_src_clear_ring(src);
+        src->ring = job.frames;
+    }
+    else
+    {
+        g_ptr_array_unref(job.frames);
+    }
+    g_free(location);
+    return ok;
+}
+
+static GstCaps *gst_replay_src_fixate(GstBaseSrc *bsrc, GstCaps *caps)
+{
+    GstStructure *structure;
+
+    caps = gst_caps_make_writable(caps);
+    structure = gst_caps_get_structure(caps, 0);
+    gst_structure_fixate_field_nearest_int(structure, "width", DEFAULT_WIDTH);
+    gst_structure_fixate_field_nearest_int(structure, "height", DEFAULT_HEIGHT);
+    gst_structure_fixate_field_nearest_fraction(structure, "framerate", DEFAULT_FPS_N, 1);
+    if (gst_structure_has_field(structure, "pixel-aspect-ratio"))
+        gst_structure_fixate_field_nearest_fraction(structure, "pixel-aspect-ratio", 1, 1);
+
+    return GST_BASE_SRC_CLASS(gst_replay_src_parent_class)->fixate(bsrc, caps);
+}
+
+static gboolean gst_replay_src_set_caps(GstBaseSrc *bsrc, GstCaps *caps)
+{
+    GstReplaySrc *src = GST_REPLAY_SRC(bsrc);
+    GstVideoInfo info;
+
+    if (!gst_video_info_from_caps(&info, caps))
+        return FALSE;
+
+    if (GST_VIDEO_INFO_FPS_N(&info) <= 0 || GST_VIDEO_INFO_FPS_D(&info) <= 0)
+    {
+        GST_ELEMENT_ERROR(src, CORE, NEGOTIATION, (NULL), ("A framerate is needed to timestamp the frames"));
+        return FALSE;
+    }
+
+    /* Renegotiated to the same format: the ring is still good */
+    if (src->ring != NULL && gst_video_info_is_equal(&info, &src->info))
+        return TRUE;
+
+    src->info = info;
+    return gst_replay_src_render_ring(src, caps);
+}
+
+static gboolean gst_replay_src_start(GstBaseSrc *bsrc)
+{
+    GstReplaySrc *src = GST_REPLAY_SRC(bsrc);
+
+    src->n_pushed = 0;
+    src->timestamp_offset = 0;
+    return TRUE;
+}
+
+static gboolean gst_replay_src_stop(GstBaseSrc *bsrc)
+{
+    gst_replay_src_clear_ring(GST_REPLAY_SRC(bsrc));
+    return TRUE;
+}
+
+/* Live: let the base class wait for the clock until each frame is due */
+static void gst_replay_src_get_times(GstBaseSrc *bsrc, GstBuffer *buffer, GstClockTime *start, GstClockTime *end)
+{
+    *start = GST_CLOCK_TIME_NONE;
+    *end = GST_CLOCK_TIME_NONE;
+
+    if (gst_base_src_is_live(bsrc) && GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        *start = GST_BUFFER_PTS(buffer);
+        if (GST_BUFFER_DURATION_IS_VALID(buffer))
+            *end = *start + GST_BUFFER_DURATION(buffer);
+    }
+}
+
+/* Live: a frame is only pushed once its whole duration has passed */
+static gboolean gst_replay_src_query(GstBaseSrc *bsrc, GstQuery *query)
+{
+    GstReplaySrc *src = GST_REPLAY_SRC(bsrc);
+
+    if (GST_QUERY_TYPE(query) == GST_QUERY_LATENCY && GST_VIDEO_INFO_FPS_N(&src->info) > 0)
+    {
+        GstClockTime latency = gst_util_uint64_scale(GST_SECOND, GST_VIDEO_INFO_FPS_D(&src->info),
+                                                     GST_VIDEO_INFO_FPS_N(&src->info));
+        gst_query_set_latency(query, gst_base_src_is_live(bsrc), latency, latency);
+        return TRUE;
+    }
+    return GST_BASE_SRC_CLASS(gst_replay_src_parent_class)->query(bsrc, query);
+}
+
+static GstFlowReturn gst_replay_src_create(GstPushSrc *psrc, GstBuffer **outbuf)
+{
+    GstReplaySrc *src = GST_REPLAY_SRC(psrc);
+    GstBaseSrc *bsrc = GST_BASE_SRC(psrc);
+    GstBuffer *frame;
+    guint64 n = src->n_pushed;
+    gint fps_n = GST_VIDEO_INFO_FPS_N(&src->info);
+    gint fps_d = GST_VIDEO_INFO_FPS_D(&src->info);
+
+    if (src->ring == NULL || src->ring->len == 0)
+        return GST_FLOW_NOT_NEGOTIATED;
+
+    /* Live: the first frame is due now, not at the running time 0 long gone */
+    if (n == 0 && gst_base_src_is_live(bsrc))
+    {
+        GstClock *clock = gst_element_get_clock(GST_ELEMENT(src));
+        if (clock != NULL)
+        {
+            src->timestamp_offset = gst_clock_get_time(clock) - gst_element_get_base_time(GST_ELEMENT(src));
+            gst_object_unref(clock);
+        }
+    }
+
+    /* Only a new GstBuffer around the memory of the ring: no frame is
+     * allocated, copied or drawn */
+    frame = gst_buffer_copy((GstBuffer *)g_ptr_array_index(src->ring, n % src->ring->len));
+    GST_BUFFER_PTS(frame) = src->timestamp_offset + gst_util_uint64_scale(n, GST_SECOND * fps_d, fps_n);
+    GST_BUFFER_DTS(frame) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION(frame) = src->timestamp_offset + gst_util_uint64_scale(n + 1, GST_SECOND * fps_d, fps_n)
+                                 - GST_BUFFER_PTS(frame);
+    GST_BUFFER_OFFSET(frame) = n;
+    GST_BUFFER_OFFSET_END(frame) = n + 1;
+    if (n == 0)
+        GST_BUFFER_FLAG_SET(frame, GST_BUFFER_FLAG_DISCONT);
+    else
+        GST_BUFFER_FLAG_UNSET(frame, GST_BUFFER_FLAG_DISCONT);
+
+    src->n_pushed++;
+    *outbuf = frame;
+    return GST_FLOW_OK;
+}
+
+static void gst_replay_src_class_init(GstReplaySrcClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseSrcClass *bsrc_class = GST_BASE_SRC_CLASS(klass);
+    GstPushSrcClass *psrc_class = GST_PUSH_SRC_CLASS(klass);
+
+    gobject_class->set_property = gst_replay_src_set_property;
+    gobject_class->get_property = gst_replay_src_get_property;
+    gobject_class->finalize = gst_replay_src_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_FRAMES,
+        g_param_spec_uint("frames", "Frames", "Frames rendered once and replayed in a loop",
+            1, 1024, DEFAULT_FRAMES, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    g_object_class_install_property(gobject_class, PROP_PATTERN,
+        g_param_spec_int("pattern", "Pattern", "videotestsrc pattern of the rendered frames",
+            0, G_MAXINT, DEFAULT_PATTERN, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    g_object_class_install_property(gobject_class, PROP_LOCATION,
+        g_param_spec_string("location", "Location",
+            "Local media file whose first frames are replayed instead of a test pattern",
+            NULL, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    g_object_class_install_property(gobject_class, PROP_IS_LIVE,
+        g_param_spec_boolean("is-live", "Is live",
+            "Push every frame when it is due on the clock instead of as fast as possible",
+            FALSE, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    gst_element_class_set_static_metadata(element_class, "Replay source", "Source/Video",
+        "Pushes pre-rendered frames from memory, for load tests", "gstreamer-tutorials");
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+
+    bsrc_class->fixate = GST_DEBUG_FUNCPTR(gst_replay_src_fixate);
+    bsrc_class->set_caps = GST_DEBUG_FUNCPTR(gst_replay_src_set_caps);
+    bsrc_class->start = GST_DEBUG_FUNCPTR(gst_replay_src_start);
+    bsrc_class->stop = GST_DEBUG_FUNCPTR(gst_replay_src_stop);
+    bsrc_class->get_times = GST_DEBUG_FUNCPTR(gst_replay_src_get_times);
+    bsrc_class->query = GST_DEBUG_FUNCPTR(gst_replay_src_query);
+
+    psrc_class->create = GST_DEBUG_FUNCPTR(gst_replay_src_create);
+}
+
+static void gst_replay_src_init(GstReplaySrc *src)
+{
+    src->n_frames = DEFAULT_FRAMES;
+    src->pattern = DEFAULT_PATTERN;
+    src->location = NULL;
+    src->ring = NULL;
+    src->n_pushed = 0;
+    src->timestamp_offset = 0;
+    gst_video_info_init(&src->info);
+
+    gst_base_src_set_format(GST_BASE_SRC(src), GST_FORMAT_TIME);
+}
+
+gboolean replay_src_register(void)
+{
+    GST_DEBUG_CATEGORY_INIT(replay_src_debug, "replaysrc", 0, "Replay source");
+    return gst_element_register(NULL, "replaysrc", GST_RANK_NONE, GST_TYPE_REPLAY_SRC);
+}
@@ -0,0 +1,110 @@
+#include "SlicePool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct _SlicePool {
+    unsigned n_threads;
+    std::vector<std::thread> workers;
+
+    std::mutex lock;
+    std::condition_variable job_ready;  /* Signalled when a new job (or shutdown) is posted */
+    std::condition_variable job_done;   /* Signalled when the last worker finishes its slice */
+
+    /* Protected by lock */
+    SliceFunc func;
+    void *user_data;
+    unsigned long generation;           /* Incremented for every job */
+    unsigned pending;                   /* Workers still busy with the current job */
+    bool shutdown;
+};
+
+static void worker_loop(SlicePool *pool, unsigned slice)
+{
+    unsigned long seen = 0;
+
+    for (;;)
+    {
+        SliceFunc func;
+        void *user_data;
+
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            pool->job_ready.wait(guard, [&] { return pool->shutdown || pool->generation != seen; });
+            if (pool->shutdown)
+                return;
+            seen = pool->generation;
+            func = pool->func;
+            user_data = pool->user_data;
+        }
+
+        func(user_data, slice, pool->n_threads);
+
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            if (--pool->pending == 0)
+                pool->job_done.notify_one();
+        }
+    }
+}
+
+SlicePool *slice_pool_new(unsigned n_threads)
+{
+    SlicePool *pool = new SlicePool;
+
+    pool->n_threads = n_threads > 0 ? n_threads : 1;
+    pool->func = nullptr;
+    pool->user_data = nullptr;
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->shutdown = false;
+
+    for (unsigned slice = 1; slice < pool->n_threads; slice++)
+        pool->workers.emplace_back(worker_loop, pool, slice);
+    return pool;
+}
+
+void slice_pool_free(SlicePool *pool)
+{
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->shutdown = true;
+    }
+    pool->job_ready.notify_all();
+
+    for (std::thread &worker : pool->workers)
+        worker.join();
+    delete pool;
+}
+
+unsigned slice_pool_get_n_threads(SlicePool *pool)
+{
+    return pool->n_threads;
+}
+
+void slice_pool_run(SlicePool *pool, SliceFunc func, void *user_data)
+{
+    /* Nothing to hand out, skip the synchronisation entirely */
+    if (pool->workers.empty())
+    {
+        func(user_data, 0, 1);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->func = func;
+        pool->user_data = user_data;
+        pool->pending = pool->workers.size();
+        pool->generation++;
+    }
+    pool->job_ready.notify_all();
+
+    /* The caller is a worker too */
+    func(user_data, 0, pool->n_threads);
+
+    std::unique_lock<std::mutex> guard(pool->lock);
+    pool->job_done.wait(guard, [&] { return pool->pending == 0; });
+}
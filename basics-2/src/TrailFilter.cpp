@@ -0,0 +1,392 @@
+#include "TrailFilter.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC(trail_filter_debug);
+#define GST_CAT_DEFAULT trail_filter_debug
+
+enum {
+    PROP_0,
+    PROP_DECAY,
+    PROP_KERNEL,
+    PROP_N_THREADS,
+    PROP_POOL_SIZE,
+    PROP_POOL_STATS,
+};
+
+#define DEFAULT_DECAY 192
+#define DEFAULT_KERNEL "auto"
+#define DEFAULT_N_THREADS 0
+#define DEFAULT_POOL_SIZE ARENA_POOL_DEFAULT_SLOTS
+
+/* Packed 4 bytes per pixel formats: the blend does not care about the channel order */
+#define TRAIL_FILTER_CAPS GST_VIDEO_CAPS_MAKE("{ BGRx, RGBx, xRGB, xBGR, BGRA, RGBA, ARGB, ABGR }")
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS(TRAIL_FILTER_CAPS));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(TRAIL_FILTER_CAPS));
+
+/* One frame, as seen by every slice */
+typedef struct _TrailJob {
+    GstTrailFilter *filter;
+    guint8 *data;
+    gint stride;
+    gint height;
+    guint decay;
+    gboolean seed;              /* Copy the frame into the history instead of blending */
+} TrailJob;
+
+G_DEFINE_TYPE(GstTrailFilter, gst_trail_filter, GST_TYPE_VIDEO_FILTER);
+
+static void gst_trail_filter_set_property(GObject *object, guint prop_id,
+                                          const GValue *value, GParamSpec *pspec)
+{
+    GstTrailFilter *filter = GST_TRAIL_FILTER(object);
+
+    GST_OBJECT_LOCK(filter);
+    switch (prop_id)
+    {
+        case PROP_DECAY:
+        filter->decay = g_value_get_uint(value);
+        break;
+
+        case PROP_KERNEL:
+        g_free(filter->kernel_name);
+        filter->kernel_name = g_value_dup_string(value);
+        break;
+
+        case PROP_N_THREADS:
+        filter->n_threads = g_value_get_uint(value);
+        break;
+
+        case PROP_POOL_SIZE:
+        filter->pool_size = g_value_get_uint(value);
+        break;
+
+        default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK(filter);
+}
+
+static void gst_trail_filter_get_property(GObject *object, guint prop_id,
+                                          GValue *value, GParamSpec *pspec)
+{
+    GstTrailFilter *filter = GST_TRAIL_FILTER(object);
+
+    GST_OBJECT_LOCK(filter);
+    switch (prop_id)
+    {
+        case PROP_DECAY:
+        g_value_set_uint(value, filter->decay);
+        break;
+
+        case PROP_KERNEL:
+        /* Once negotiated, report the kernel actually in use */
+        g_value_set_string(value, filter->blend_name ? filter->blend_name : filter->kernel_name);
+        break;
+
+        case PROP_N_THREADS:
+        g_value_set_uint(value, filter->n_threads);
+        break;
+
+        case PROP_POOL_SIZE:
+        g_value_set_uint(value, filter->pool_size);
+        break;
+
+        case PROP_POOL_STATS:
+        if (filter->arena_pool != NULL)
+        {
+            ArenaPoolStats stats;
+            arena_pool_get_stats(filter->arena_pool, &stats);
+            g_value_take_boxed(value, arena_pool_stats_to_structure(&stats));
+        }
+        else
+        {
+            g_value_set_boxed(value, NULL);
+        }
+        break;
+
+        default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK(filter);
+}
+
+static void gst_trail_filter_free_history(GstTrailFilter *filter)
+{
+    g_free(filter->history);
+    filter->history = NULL;
+    filter->history_valid = FALSE;
+}
+
+static void gst_trail_filter_finalize(GObject *object)
+{
+    GstTrailFilter *filter = GST_TRAIL_FILTER(object);
+
+    gst_trail_filter_free_history(filter);
+    g_free(filter->kernel_name);
+    if (filter->pool != NULL)
+        slice_pool_free(filter->pool);
+    if (filter->arena_pool != NULL)
+        gst_object_unref(filter->arena_pool);
+    if (filter->arena_caps != NULL)
+        gst_caps_unref(filter->arena_caps);
+
+    G_OBJECT_CLASS(gst_trail_filter_parent_class)->finalize(object);
+}
+
+static gboolean gst_trail_filter_set_info(GstVideoFilter *vfilter, GstCaps *incaps,
+                                          GstVideoInfo *in_info, GstCaps *outcaps, GstVideoInfo *out_info)
+{
+    GstTrailFilter *filter = GST_TRAIL_FILTER(vfilter);
+    const gchar *selected = NULL;
+    gchar *requested;
+
+    GST_OBJECT_LOCK(filter);
+    requested = g_strdup(filter->kernel_name);
+    GST_OBJECT_UNLOCK(filter);
+
+    filter->blend = trail_kernel_select(requested, &selected);
+    if (filter->blend == NULL)
+    {
+        GST_ELEMENT_ERROR(filter, CORE, NEGOTIATION, (NULL),
+            ("Kernel '%s' is not available on this build or CPU", requested));
+        g_free(requested);
+        return FALSE;
+    }
+    g_free(requested);
+    GST_OBJECT_LOCK(filter);
+    filter->blend_name = selected;
+    GST_OBJECT_UNLOCK(filter);
+    GST_INFO_OBJECT(filter, "Using the %s kernel", selected);
+
+    /* A new size means the old history is meaningless */
+    gst_trail_filter_free_history(filter);
+    filter->row_size = (gsize)GST_VIDEO_INFO_WIDTH(in_info) * 4;
+    filter->history = (guint8 *)g_malloc(filter->row_size * GST_VIDEO_INFO_HEIGHT(in_info));
+    return TRUE;
+}
+
+static gboolean gst_trail_filter_stop(GstBaseTransform *trans)
+{
+    GstTrailFilter *filter = GST_TRAIL_FILTER(trans);
+
+    gst_trail_filter_free_history(filter);
+    if (filter->pool != NULL)
+    {
+        slice_pool_free(filter->pool);
+        filter->pool = NULL;
+    }
+    return TRUE;
+}
+
+/* Offers upstream a pool backed by a pre-faulted arena, so the frames we
+ * process in place never come from the system allocator */
+static gboolean gst_trail_filter_propose_allocation(GstBaseTransform *trans, GstQuery *decide_query,
+                                                    GstQuery *query)
+{
+    GstTrailFilter *filter = GST_TRAIL_FILTER(trans);
+    GstBufferPool *pool = NULL;
+    GstStructure *config;
+    GstAllocationParams params;
+    GstVideoInfo info;
+    GstCaps *caps;
+    gboolean need_pool;
+    guint pool_size;
+
+    gst_query_parse_allocation(query, &caps, &need_pool);
+    if (caps == NULL || !gst_video_info_from_caps(&info, caps))
+        return FALSE;
+
+    GST_OBJECT_LOCK(filter);
+    pool_size = filter->pool_size;
+    if (filter->arena_pool != NULL && filter->arena_caps != NULL && gst_caps_is_equal(caps, filter->arena_caps))
+        pool = (GstBufferPool *)gst_object_ref(filter->arena_pool);
+    GST_OBJECT_UNLOCK(filter);
+
+    /* Without a pool of our own, behave like any other video filter */
+    if (pool_size == 0)
+        return GST_BASE_TRANSFORM_CLASS(gst_trail_filter_parent_class)->propose_allocation(trans, decide_query, query);
+
+    gst_allocation_params_init(&params);
+    params.align = 63;
+
+    if (need_pool)
+    {
+        if (pool == NULL)
+        {
+            pool = arena_pool_new(pool_size);
+            config = gst_buffer_pool_get_config(pool);
+            gst_buffer_pool_config_set_params(config, caps, info.size, pool_size, pool_size);
+            gst_buffer_pool_config_set_allocator(config, NULL, &params);
+            gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+            if (!gst_buffer_pool_set_config(pool, config))
+            {
+                GST_WARNING_OBJECT(filter, "Could not configure the arena pool");
+                gst_object_unref(pool);
+                return FALSE;
+            }
+
+            GST_OBJECT_LOCK(filter);
+            gst_object_replace((GstObject **)&filter->arena_pool, GST_OBJECT(pool));
+            gst_caps_replace(&filter->arena_caps, caps);
+            GST_OBJECT_UNLOCK(filter);
+        }
+        gst_query_add_allocation_pool(query, pool, info.size, pool_size, pool_size);
+    }
+    if (pool != NULL)
+        gst_object_unref(pool);
+
+    gst_query_add_allocation_param(query, NULL, &params);
+    gst_query_add_allocation_meta(query, GST_VIDEO_META_API_TYPE, NULL);
+    return TRUE;
+}
+
+/* Processes rows [height * slice / n_slices, height * (slice + 1) / n_slices) of the frame */
+static void gst_trail_filter_process_slice(void *user_data, unsigned slice, unsigned n_slices)
+{
+    TrailJob *job = (TrailJob *)user_data;
+    GstTrailFilter *filter = job->filter;
+    gint first = (gint)((gint64)job->height * slice / n_slices);
+    gint last = (gint)((gint64)job->height * (slice + 1) / n_slices);
+
+    for (gint y = first; y < last; y++)
+    {
+        guint8 *row = job->data + (gsize)y * job->stride;
+        guint8 *history = filter->history + y * filter->row_size;
+
+        if (job->seed)
+            memcpy(history, row, filter->row_size);
+        else
+            filter->blend(row, history, filter->row_size, job->decay);
+    }
+}
+
+/* Makes sure the pool matches the n-threads property */
+static SlicePool *gst_trail_filter_ensure_pool(GstTrailFilter *filter)
+{
+    guint n_threads;
+
+    GST_OBJECT_LOCK(filter);
+    n_threads = filter->n_threads;
+    GST_OBJECT_UNLOCK(filter);
+
+    n_threads = trail_filter_get_n_threads_used(n_threads);
+
+    if (filter->pool != NULL && slice_pool_get_n_threads(filter->pool) != n_threads)
+    {
+        slice_pool_free(filter->pool);
+        filter->pool = NULL;
+    }
+    if (filter->pool == NULL)
+    {
+        GST_INFO_OBJECT(filter, "Processing frames in %u slices", n_threads);
+        filter->pool = slice_pool_new(n_threads);
+    }
+    return filter->pool;
+}
+
+static GstFlowReturn gst_trail_filter_transform_frame_ip(GstVideoFilter *vfilter, GstVideoFrame *frame)
+{
+    GstTrailFilter *filter = GST_TRAIL_FILTER(vfilter);
+    TrailJob job;
+
+    job.filter = filter;
+    job.data = (guint8 *)GST_VIDEO_FRAME_PLANE_DATA(frame, 0);
+    job.stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+    job.height = GST_VIDEO_FRAME_HEIGHT(frame);
+
+    GST_OBJECT_LOCK(filter);
+    job.decay = filter->decay;
+    GST_OBJECT_UNLOCK(filter);
+
+    /* The first frame has nothing to blend with, it just seeds the history */
+    job.seed = !filter->history_valid;
+    filter->history_valid = TRUE;
+
+    slice_pool_run(gst_trail_filter_ensure_pool(filter), gst_trail_filter_process_slice, &job);
+    return GST_FLOW_OK;
+}
+
+static void gst_trail_filter_class_init(GstTrailFilterClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS(klass);
+    GstVideoFilterClass *vfilter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+    gobject_class->set_property = gst_trail_filter_set_property;
+    gobject_class->get_property = gst_trail_filter_get_property;
+    gobject_class->finalize = gst_trail_filter_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_DECAY,
+        g_param_spec_uint("decay", "Decay", "Weight of the previous output in every frame (0 = no trail)",
+            0, 255, DEFAULT_DECAY,
+            (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE)));
+
+    g_object_class_install_property(gobject_class, PROP_KERNEL,
+        g_param_spec_string("kernel", "Kernel",
+            "Blend kernel: auto, scalar, sse4.1 or avx2. Reads back the kernel in use once negotiated",
+            DEFAULT_KERNEL, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    g_object_class_install_property(gobject_class, PROP_N_THREADS,
+        g_param_spec_uint("n-threads", "Number of threads",
+            "Horizontal slices processed in parallel for each frame (0 = one per online core, "
+            G_STRINGIFY(TRAIL_FILTER_MAX_N_THREADS) " at most)",
+            0, TRAIL_FILTER_MAX_N_THREADS, DEFAULT_N_THREADS, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    g_object_class_install_property(gobject_class, PROP_POOL_SIZE,
+        g_param_spec_uint("pool-size", "Pool size",
+            "Frames in the pre-faulted arena pool proposed upstream (0 = do not propose a pool)",
+            0, 64, DEFAULT_POOL_SIZE, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    g_object_class_install_property(gobject_class, PROP_POOL_STATS,
+        g_param_spec_boxed("pool-stats", "Pool statistics",
+            "Hit/miss and in-flight counters of the proposed pool (NULL until one was proposed)",
+            GST_TYPE_STRUCTURE, (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+    gst_element_class_set_static_metadata(element_class, "Trail filter", "Filter/Effect/Video",
+        "Blends every frame with the previous output, using SIMD kernels", "gstreamer-tutorials");
+    gst_element_class_add_static_pad_template(element_class, &sink_template);
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+
+    trans_class->stop = GST_DEBUG_FUNCPTR(gst_trail_filter_stop);
+    trans_class->propose_allocation = GST_DEBUG_FUNCPTR(gst_trail_filter_propose_allocation);
+
+    vfilter_class->set_info = GST_DEBUG_FUNCPTR(gst_trail_filter_set_info);
+    vfilter_class->transform_frame_ip = GST_DEBUG_FUNCPTR(gst_trail_filter_transform_frame_ip);
+}
+
+static void gst_trail_filter_init(GstTrailFilter *filter)
+{
+    filter->decay = DEFAULT_DECAY;
+    filter->kernel_name = g_strdup(DEFAULT_KERNEL);
+    filter->n_threads = DEFAULT_N_THREADS;
+    filter->pool_size = DEFAULT_POOL_SIZE;
+    filter->pool = NULL;
+    filter->blend = NULL;
+    filter->blend_name = NULL;
+    filter->history = NULL;
+    filter->row_size = 0;
+    filter->history_valid = FALSE;
+    filter->arena_pool = NULL;
+    filter->arena_caps = NULL;
+}
+
+gboolean trail_filter_register(void)
+{
+    GST_DEBUG_CATEGORY_INIT(trail_filter_debug, "trailfilter", 0, "Trail filter");
+    return gst_element_register(NULL, "trailfilter", GST_RANK_NONE, GST_TYPE_TRAIL_FILTER);
+}
+
+guint trail_filter_get_n_threads_used(guint n_threads)
+{
+    if (n_threads == 0)
+        n_threads = g_get_num_processors();
+    return MIN(n_threads, TRAIL_FILTER_MAX_N_THREADS);
+}
@@ -0,0 +1,52 @@
+#include "TrailKernels.h"
+
+#include <string.h>
+
+void trail_blend_scalar(uint8_t *frame, uint8_t *history, size_t n_bytes, unsigned decay)
+{
+    unsigned keep = 256 - decay;
+
+    for (size_t i = 0; i < n_bytes; i++)
+    {
+        uint8_t value = (uint8_t)((frame[i] * keep + history[i] * decay) >> 8);
+        frame[i] = value;
+        history[i] = value;
+    }
+}
+
+/* Only x86 builds get the SIMD kernels, and only if the CPU runs them */
+static bool cpu_supports(const char *feature)
+{
+#ifdef TRAIL_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (strcmp(feature, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(feature, "sse4.1") == 0)
+        return __builtin_cpu_supports("sse4.1");
+#endif
+    return false;
+}
+
+TrailBlendFunc trail_kernel_select(const char *name, const char **selected)
+{
+    bool automatic = name == NULL || strcmp(name, "auto") == 0;
+
+#ifdef TRAIL_HAVE_X86_KERNELS
+    if ((automatic || strcmp(name, "avx2") == 0) && cpu_supports("avx2"))
+    {
+        *selected = "avx2";
+        return trail_blend_avx2;
+    }
+    if ((automatic || strcmp(name, "sse4.1") == 0) && cpu_supports("sse4.1"))
+    {
+        *selected = "sse4.1";
+        return trail_blend_sse41;
+    }
+#endif
+    if (automatic || strcmp(name, "scalar") == 0)
+    {
+        *selected = "scalar";
+        return trail_blend_scalar;
+    }
+    return NULL;
+}
@@ -0,0 +1,36 @@
+/* Built with -mavx2, only called after checking the CPU supports it */
+#include "TrailKernels.h"
+
+#include <immintrin.h>
+
+void trail_blend_avx2(uint8_t *frame, uint8_t *history, size_t n_bytes, unsigned decay)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i keep_w = _mm256_set1_epi16((short)(256 - decay));
+    const __m256i decay_w = _mm256_set1_epi16((short)decay);
+    size_t i = 0;
+
+    for (; i + 32 <= n_bytes; i += 32)
+    {
+        __m256i cur = _mm256_loadu_si256((const __m256i *)(frame + i));
+        __m256i old = _mm256_loadu_si256((const __m256i *)(history + i));
+
+        /* unpack and packus both work per 128-bit lane, so together they keep the byte order */
+        __m256i cur_lo = _mm256_unpacklo_epi8(cur, zero);
+        __m256i cur_hi = _mm256_unpackhi_epi8(cur, zero);
+        __m256i old_lo = _mm256_unpacklo_epi8(old, zero);
+        __m256i old_hi = _mm256_unpackhi_epi8(old, zero);
+
+        __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(cur_lo, keep_w),
+                                                        _mm256_mullo_epi16(old_lo, decay_w)), 8);
+        __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(cur_hi, keep_w),
+                                                        _mm256_mullo_epi16(old_hi, decay_w)), 8);
+        __m256i out = _mm256_packus_epi16(lo, hi);
+
+        _mm256_storeu_si256((__m256i *)(frame + i), out);
+        _mm256_storeu_si256((__m256i *)(history + i), out);
+    }
+
+    /* Tail of the row */
+    trail_blend_scalar(frame + i, history + i, n_bytes - i, decay);
+}
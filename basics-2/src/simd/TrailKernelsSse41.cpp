@@ -0,0 +1,36 @@
+/* Built with -msse4.1, only called after checking the CPU supports it */
+#include "TrailKernels.h"
+
+#include <smmintrin.h>
+
+void trail_blend_sse41(uint8_t *frame, uint8_t *history, size_t n_bytes, unsigned decay)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i keep_w = _mm_set1_epi16((short)(256 - decay));
+    const __m128i decay_w = _mm_set1_epi16((short)decay);
+    size_t i = 0;
+
+    for (; i + 16 <= n_bytes; i += 16)
+    {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(frame + i));
+        __m128i old = _mm_loadu_si128((const __m128i *)(history + i));
+
+        /* Widen to 16 bits: 255 * 256 still fits, so no saturation is needed */
+        __m128i cur_lo = _mm_cvtepu8_epi16(cur);
+        __m128i cur_hi = _mm_unpackhi_epi8(cur, zero);
+        __m128i old_lo = _mm_cvtepu8_epi16(old);
+        __m128i old_hi = _mm_unpackhi_epi8(old, zero);
+
+        __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(cur_lo, keep_w),
+                                                  _mm_mullo_epi16(old_lo, decay_w)), 8);
+        __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(cur_hi, keep_w),
+                                                  _mm_mullo_epi16(old_hi, decay_w)), 8);
+        __m128i out = _mm_packus_epi16(lo, hi);
+
+        _mm_storeu_si128((__m128i *)(frame + i), out);
+        _mm_storeu_si128((__m128i *)(history + i), out);
+    }
+
+    /* Tail of the row */
+    trail_blend_scalar(frame + i, history + i, n_bytes - i, decay);
+}
@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "KeyframeIndex.h"
+
+/* Time range of the input encoded by one pipeline, and what came out of it */
+typedef struct _Chunk {
+    guint index;
+    GstClockTime start;         /* Keyframe the range starts at */
+    GstClockTime stop;          /* Keyframe of the next range, or NONE for the last one */
+    gchar *path;                /* Annex-B output of this range */
+    std::vector<GstClockTime> pts;  /* Timestamps of the frames fed to the encoder */
+    guint64 encoded;            /* Frames out of the encoder */
+    gint64 elapsed;             /* Wall time, in microseconds */
+    gboolean ok;
+} Chunk;
+
+/* What the keyframe probe found */
+typedef struct _Probe {
+    std::vector<GstClockTime> keyframes;
+    guint64 frames;
+    GstClockTime duration;
+} Probe;
+
+/* Command line options */
+static gchar *input = NULL;
+static gchar *output = NULL;
+static gint chunks = 0;
+static gint jobs = 0;
+static gchar *speed_preset = NULL;
+static gint video_bitrate = 2048;
+static gboolean verify = FALSE;
+
+static GOptionEntry entries[] = {
+    { "input", 'i', 0, G_OPTION_ARG_FILENAME, &input, "File to encode", "FILE" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "H.264 elementary stream (Annex-B) to write. Video only, other streams are dropped", "FILE" },
+    { "chunks", 'c', 0, G_OPTION_ARG_INT, &chunks,
+      "Time ranges to split the input into (default: 0, one per job)", "N" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Ranges encoded at the same time (default: 0, one per two cores)", "N" },
+    { "speed-preset", 0, 0, G_OPTION_ARG_STRING, &speed_preset,
+      "x264enc speed-preset (default: veryfast)", "PRESET" },
+    { "video-bitrate", 0, 0, G_OPTION_ARG_INT, &video_bitrate,
+      "x264enc bitrate in kbit/s (default: 2048)", "KBPS" },
+    { "verify", 0, 0, G_OPTION_ARG_NONE, &verify,
+      "Encode the whole file in one pipeline too, compare the frames fed to the encoders and "
+      "the frames parsed back from both outputs", NULL },
+    { NULL }
+};
+
+static guint encoder_threads = 1;
+
+/* Runs pipeline until EOS or an error. Returns TRUE on EOS */
+static gboolean run_to_eos(GstElement *pipeline, const gchar *what)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg;
+    gboolean ok;
+
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    ok = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (!ok)
+    {
+        GError *err;
+        gchar *debug_info;
+
+        gst_message_parse_error(msg, &err, &debug_info);
+        g_printerr("%s: error from %s: %s\n", what, GST_OBJECT_NAME(msg->src), err->message);
+        g_clear_error(&err);
+        g_free(debug_info);
+    }
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+    return ok;
+}
+
+/* Waits for the pending state change of pipeline. Returns FALSE if it failed */
+static gboolean wait_state(GstElement *pipeline, GstState state)
+{
+    if (gst_element_set_state(pipeline, state) == GST_STATE_CHANGE_FAILURE)
+        return FALSE;
+    return gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) != GST_STATE_CHANGE_FAILURE;
+}
+
+/* Finds where the input can be cut, from the stored keyframe index or by
+ * demuxing and parsing the input, nothing is decoded */
+static gboolean probe_keyframes(Probe *probe)
+{
+    KeyframeIndex *index = keyframe_index_open(input);
+
+    if (index == NULL)
+        return FALSE;
+    for (guint i = 0; i < keyframe_index_get_size(index); i++)
+        probe->keyframes.push_back(keyframe_index_get_keyframe(index, i));
+    probe->frames = keyframe_index_get_frames(index);
+    probe->duration = keyframe_index_get_duration(index);
+    keyframe_index_free(index);
+    return TRUE;
+}
+
+/* Takes ownership of path */
+static Chunk *chunk_new(guint index, GstClockTime start, GstClockTime stop, gchar *path)
+{
+    Chunk *chunk = new Chunk;
+
+    chunk->index = index;
+    chunk->start = start;
+    chunk->stop = stop;
+    chunk->path = path;
+    chunk->encoded = 0;
+    chunk->elapsed = 0;
+    chunk->ok = FALSE;
+    return chunk;
+}
+
+/* Splits the input at the keyframes closest to n equal parts. Ranges that
+ * would be empty are merged, so fewer than n can come back */
+static std::vector<Chunk *> split(const Probe &probe, guint n)
+{
+    std::vector<Chunk *> ranges;
+    GstClockTime end = GST_CLOCK_TIME_IS_VALID(probe.duration) ? probe.duration : probe.keyframes.back();
+    std::vector<GstClockTime> starts;
+
+    starts.push_back(probe.keyframes.front());
+    for (guint i = 1; i < n; i++)
+    {
+        GstClockTime target = gst_util_uint64_scale(end, i, n);
+        auto it = std::lower_bound(probe.keyframes.begin(), probe.keyframes.end(), target);
+
+        if (it == probe.keyframes.end())
+            break;
+        if (it != probe.keyframes.begin() && target - *(it - 1) < *it - target)
+            it--;
+        if (*it > starts.back())
+            starts.push_back(*it);
+    }
+
+    for (size_t i = 0; i < starts.size(); i++)
+        ranges.push_back(chunk_new(i, starts[i], i + 1 < starts.size() ? starts[i + 1] : GST_CLOCK_TIME_NONE,
+                                   g_strdup_printf("%s.part%02u", output, (guint)i)));
+    return ranges;
+}
+
+/** Encoding one range **/
+
+static GstPadProbeReturn raw_frame_probe_cb(GstPad *pad, GstPadProbeInfo *info, Chunk *chunk)
+{
+    chunk->pts.push_back(GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)));
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn encoded_frame_probe_cb(GstPad *pad, GstPadProbeInfo *info, Chunk *chunk)
+{
+    chunk->encoded++;
+    return GST_PAD_PROBE_OK;
+}
+
+/* Links the first raw video pad to the encoder, the rest to fakesinks: the
+ * Annex-B output has no room for audio or a second video stream */
+static void decoder_pad_added_cb(GstElement *src, GstPad *pad, GstElement *convert)
+{
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstPad *sink_pad = gst_element_get_static_pad(convert, "sink");
+    gboolean video = caps != NULL && g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/x-raw");
+
+    if (video && !gst_pad_is_linked(sink_pad))
+    {
+        gst_pad_link(pad, sink_pad);
+    }
+    else
+    {
+        GstElement *pipeline = GST_ELEMENT(gst_element_get_parent(src));
+        GstElement *sink = gst_element_factory_make("fakesink", NULL);
+        GstPad *fake_pad = gst_element_get_static_pad(sink, "sink");
+
+        g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+        gst_bin_add(GST_BIN(pipeline), sink);
+        gst_pad_link(pad, fake_pad);
+        gst_element_sync_state_with_parent(sink);
+        gst_object_unref(fake_pad);
+        gst_object_unref(pipeline);
+    }
+    gst_object_unref(sink_pad);
+    if (caps != NULL)
+        gst_caps_unref(caps);
+}
+
+/* Encodes the range of chunk to chunk->path. Runs on a worker thread */
+static void encode_chunk(Chunk *chunk, gpointer user_data)
+{
+    GstElement *pipeline, *source, *convert;
+    GstPad *pad;
+    gchar *description, *uri;
+    GError *err = NULL;
+    gint64 start = g_get_monotonic_time();
+    gchar *what = g_strdup_printf("chunk %u", chunk->index);
+
+    /* Annex-B with the headers in front of every IDR, so the parts can be concatenated */
+    description = g_strdup_printf("uridecodebin name=src videoconvert name=convert ! "
+        "x264enc name=enc speed-preset=%s bitrate=%d threads=%u ! "
+        "video/x-h264,stream-format=byte-stream,alignment=au ! filesink location=\"%s\"",
+        speed_preset, video_bitrate, encoder_threads, chunk->path);
+    pipeline = gst_parse_launch(description, &err);
+    g_free(description);
+    if (pipeline == NULL)
+    {
+        g_printerr("%s: could not create the pipeline: %s\n", what, err->message);
+        g_clear_error(&err);
+        g_free(what);
+        return;
+    }
+
+    source = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    convert = gst_bin_get_by_name(GST_BIN(pipeline), "convert");
+    uri = gst_filename_to_uri(input, NULL);
+    g_object_set(source, "uri", uri, NULL);
+    g_free(uri);
+    g_signal_connect(source, "pad-added", G_CALLBACK(decoder_pad_added_cb), convert);
+
+    pad = gst_element_get_static_pad(convert, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)raw_frame_probe_cb, chunk, NULL);
+    gst_object_unref(pad);
+    {
+        GstElement *enc = gst_bin_get_by_name(GST_BIN(pipeline), "enc");
+        pad = gst_element_get_static_pad(enc, "src");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)encoded_frame_probe_cb, chunk, NULL);
+        gst_object_unref(pad);
+        gst_object_unref(enc);
+    }
+
+    /* Preroll, then restrict the playback to the range. Starting on a keyframe,
+     * the accurate seek decodes nothing before it, and frames at stop or after
+     * are clipped, so neighbouring ranges do not overlap */
+    chunk->ok = wait_state(pipeline, GST_STATE_PAUSED);
+    if (chunk->ok && (chunk->start > 0 || GST_CLOCK_TIME_IS_VALID(chunk->stop)))
+    {
+        chunk->pts.clear();
+        chunk->encoded = 0;
+        chunk->ok = gst_element_seek(pipeline, 1.0, GST_FORMAT_TIME,
+            (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE),
+            GST_SEEK_TYPE_SET, chunk->start,
+            GST_CLOCK_TIME_IS_VALID(chunk->stop) ? GST_SEEK_TYPE_SET : GST_SEEK_TYPE_NONE,
+            GST_CLOCK_TIME_IS_VALID(chunk->stop) ? chunk->stop : GST_CLOCK_TIME_NONE);
+        chunk->ok = chunk->ok && gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) != GST_STATE_CHANGE_FAILURE;
+    }
+    if (chunk->ok)
+    {
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        chunk->ok = run_to_eos(pipeline, what);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(convert);
+    gst_object_unref(source);
+    gst_object_unref(pipeline);
+    chunk->elapsed = g_get_monotonic_time() - start;
+    g_free(what);
+}
+
+static GstPadProbeReturn parsed_frame_probe_cb(GstPad *pad, GstPadProbeInfo *info, guint64 *frames)
+{
+    (*frames)++;
+    return GST_PAD_PROBE_OK;
+}
+
+/* Counts the access units h264parse finds in the Annex-B file at path */
+static gboolean count_parsed_frames(const gchar *path, guint64 *frames)
+{
+    GstElement *pipeline, *sink;
+    GstPad *pad;
+    gchar *description;
+    GError *err = NULL;
+    gboolean ok;
+
+    *frames = 0;
+    description = g_strdup_printf("filesrc location=\"%s\" ! h264parse ! "
+        "video/x-h264,alignment=au ! fakesink name=sink sync=false", path);
+    pipeline = gst_parse_launch(description, &err);
+    g_free(description);
+    if (pipeline == NULL)
+    {
+        g_printerr("verify: could not create the pipeline: %s\n", err->message);
+        g_clear_error(&err);
+        return FALSE;
+    }
+
+    sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)parsed_frame_probe_cb, frames, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(sink);
+
+    ok = gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE && run_to_eos(pipeline, path);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return ok;
+}
+
+static void chunk_free(Chunk *chunk)
+{
+    g_unlink(chunk->path);
+    g_free(chunk->path);
+    delete chunk;
+}
+
+/* Appends the parts to output, in order, byte for byte. A part is copied a
+ * buffer at a time, it can be far bigger than what we want to hold in memory */
+static gboolean concatenate(const std::vector<Chunk *> &ranges)
+{
+    FILE *out = g_fopen(output, "wb");
+    gboolean ok = out != NULL;
+    static gchar buffer[64 * 1024];
+
+    for (Chunk *chunk : ranges)
+    {
+        FILE *in;
+        size_t length;
+
+        if (!ok || (in = g_fopen(chunk->path, "rb")) == NULL)
+        {
+            ok = FALSE;
+            break;
+        }
+        while (ok && (length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+            ok = fwrite(buffer, 1, length, out) == length;
+        ok = ok && !ferror(in);
+        fclose(in);
+    }
+    if (out != NULL && fclose(out) != 0)
+        ok = FALSE;
+    return ok;
+}
+
+static const gchar *when(GstClockTime t, gchar *buf)
+{
+    if (!GST_CLOCK_TIME_IS_VALID(t))
+        return "end";
+    g_snprintf(buf, 32, "%" GST_TIME_FORMAT, GST_TIME_ARGS(t));
+    return buf;
+}
+
+int
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    guint cores = g_get_num_processors();
+    Probe probe;
+    std::vector<Chunk *> ranges;
+    GThreadPool *pool;
+    gint64 start, parallel;
+    guint64 encoded = 0;
+    std::vector<GstClockTime> pts;
+    gboolean ok = TRUE;
+    gchar a[32], b[32];
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- encode one file in GOP-aligned parts, in parallel");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (input == NULL || output == NULL || chunks < 0 || jobs < 0)
+    {
+        g_printerr("Usage: %s --input FILE --output FILE.h264 [--chunks N] [--jobs N] [--verify]\n", argv[0]);
+        return -1;
+    }
+    if (speed_preset == NULL)
+        speed_preset = g_strdup("veryfast");
+    if (jobs == 0)
+        jobs = MAX(1, cores / 2);
+    if (chunks == 0)
+        chunks = jobs;
+    encoder_threads = MAX(1, cores / jobs);
+
+    /* 1. Where can we cut? */
+    start = g_get_monotonic_time();
+    if (!probe_keyframes(&probe))
+    {
+        g_printerr("No keyframes found in %s\n", input);
+        return -1;
+    }
+    g_print("probe: %zu keyframes, %" G_GUINT64_FORMAT " frames, %s, in %.2f s\n",
+        probe.keyframes.size(), probe.frames, when(probe.duration, a),
+        (double)(g_get_monotonic_time() - start) / G_USEC_PER_SEC);
+
+    /* 2. Encode the ranges, jobs at a time */
+    ranges = split(probe, chunks);
+    for (Chunk *chunk : ranges)
+        g_print("chunk %u: %s - %s\n", chunk->index, when(chunk->start, a), when(chunk->stop, b));
+
+    start = g_get_monotonic_time();
+    pool = g_thread_pool_new((GFunc)encode_chunk, NULL, jobs, TRUE, NULL);
+    for (Chunk *chunk : ranges)
+        g_thread_pool_push(pool, chunk, NULL);
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    /* 3. Put them back together */
+    for (Chunk *chunk : ranges)
+    {
+        g_print("chunk %u: %s, %zu frames in, %" G_GUINT64_FORMAT " out, %.2f s\n", chunk->index,
+            chunk->ok ? "ok" : "failed", chunk->pts.size(), chunk->encoded, (double)chunk->elapsed / G_USEC_PER_SEC);
+        ok = ok && chunk->ok;
+        encoded += chunk->encoded;
+        pts.insert(pts.end(), chunk->pts.begin(), chunk->pts.end());
+    }
+    ok = ok && concatenate(ranges);
+    parallel = g_get_monotonic_time() - start;
+    g_print("parallel: %zu chunks, %" G_GUINT64_FORMAT " frames in %.2f s, realtime x%.1f\n",
+        ranges.size(), encoded, (double)parallel / G_USEC_PER_SEC,
+        GST_CLOCK_TIME_IS_VALID(probe.duration) && parallel > 0 ?
+            (double)probe.duration / GST_USECOND / parallel : 0.0);
+
+    /* 4. The whole file in one pipeline must give the same frames, and the
+     * concatenated parts must parse back to as many frames as its output */
+    if (ok && verify)
+    {
+        Chunk *serial = chunk_new(0, 0, GST_CLOCK_TIME_NONE, g_strdup_printf("%s.serial", output));
+        guint64 parsed = 0, serial_parsed = 0;
+
+        encode_chunk(serial, NULL);
+        serial->ok = serial->ok && count_parsed_frames(serial->path, &serial_parsed);
+        ok = count_parsed_frames(output, &parsed);
+
+        std::sort(pts.begin(), pts.end());
+        std::sort(serial->pts.begin(), serial->pts.end());
+        g_print("serial: %" G_GUINT64_FORMAT " frames in %.2f s, parallel is x%.1f faster\n",
+            serial->encoded, (double)serial->elapsed / G_USEC_PER_SEC,
+            parallel > 0 ? (double)serial->elapsed / parallel : 0.0);
+
+        if (!ok || !serial->ok || serial->pts != pts || parsed != serial_parsed)
+        {
+            g_printerr("verify: MISMATCH, serial run has %zu frames in and %" G_GUINT64_FORMAT " parsed from %s, "
+                "parallel run %zu in and %" G_GUINT64_FORMAT " parsed from %s\n",
+                serial->pts.size(), serial_parsed, serial->path, pts.size(), parsed, output);
+            ok = FALSE;
+        }
+        else
+        {
+            g_print("verify: %" G_GUINT64_FORMAT " frames parsed from %s, timestamps match\n", parsed, output);
+        }
+        chunk_free(serial);
+    }
+
+    /* Free resources */
+    for (Chunk *chunk : ranges)
+        chunk_free(chunk);
+    g_free(input);
+    g_free(output);
+    g_free(speed_preset);
+    return ok ? 0 : 1;
+}
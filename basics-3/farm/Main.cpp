@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "ProcessStats.h"
+
+/* A file to transcode */
+typedef struct _Job {
+    gchar *input;               /* Local path */
+    gchar *output;              /* Path of the .mkv written */
+    goffset size;               /* Input size in bytes, to schedule big files first */
+} Job;
+
+typedef struct _Farm Farm;
+
+/* A pipeline transcoding one job */
+typedef struct _Slot {
+    Farm *farm;
+    Job *job;
+    GstElement *pipeline;
+    GstElement *mux;
+    guint bus_watch_id;
+    gint64 start;               /* Monotonic time the job started, in microseconds */
+} Slot;
+
+/* The whole batch. Only touched from the main loop */
+struct _Farm {
+    GMainLoop *loop;
+    std::deque<Job *> queue;    /* Jobs not started yet, biggest first */
+    std::vector<Slot *> running;
+    guint total;
+    guint done;
+    guint failed;
+    guint encoder_threads;
+    gint64 media_time;          /* Duration of the media transcoded so far, in nanoseconds */
+    ProcessStats start;
+};
+
+/* Command line options */
+static gchar *manifest = NULL;
+static gchar *input_dir = NULL;
+static gchar *output_dir = NULL;
+static gint jobs = 0;
+static gchar *speed_preset = NULL;
+static gint video_bitrate = 2048;
+static gint audio_bitrate = 128000;
+static gint report_interval = 5;
+
+static GOptionEntry entries[] = {
+    { "manifest", 'm', 0, G_OPTION_ARG_FILENAME, &manifest,
+      "File listing the media to transcode, one path per line ('#' starts a comment)", "FILE" },
+    { "input-dir", 'i', 0, G_OPTION_ARG_FILENAME, &input_dir,
+      "Transcode every file of this directory", "DIR" },
+    { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir,
+      "Directory the .mkv files are written to", "DIR" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Files transcoded at the same time (default: 0, one per two cores)", "N" },
+    { "speed-preset", 0, 0, G_OPTION_ARG_STRING, &speed_preset,
+      "x264enc speed-preset (default: veryfast)", "PRESET" },
+    { "video-bitrate", 0, 0, G_OPTION_ARG_INT, &video_bitrate,
+      "x264enc bitrate in kbit/s (default: 2048)", "KBPS" },
+    { "audio-bitrate", 0, 0, G_OPTION_ARG_INT, &audio_bitrate,
+      "opusenc bitrate in bit/s (default: 128000)", "BPS" },
+    { "report-interval", 'r', 0, G_OPTION_ARG_INT, &report_interval,
+      "Seconds between progress lines, 0 for none (default: 5)", "S" },
+    { NULL }
+};
+
+static void farm_start_next(Farm *farm);
+
+/* Queues a job. Its output is only named once every input is known */
+static void add_job(std::vector<Job *> &all, const gchar *input)
+{
+    Job *job = g_new0(Job, 1);
+    GStatBuf st;
+
+    /* Canonical, so the same file is recognised whichever way it was named */
+    job->input = g_canonicalize_filename(input, NULL);
+    job->size = g_stat(input, &st) == 0 ? st.st_size : 0;
+    all.push_back(job);
+}
+
+/* Is path an input, or the output of a job already named? */
+static gboolean output_taken(const std::vector<Job *> &all, const gchar *path)
+{
+    for (Job *job : all)
+    {
+        if (g_strcmp0(job->input, path) == 0 || g_strcmp0(job->output, path) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Names every output <stem>.mkv, or <stem>-N.mkv if that file is an input or
+ * another job's output, so no job writes over a file another one reads */
+static void name_outputs(std::vector<Job *> &all)
+{
+    for (Job *job : all)
+    {
+        gchar *base = g_path_get_basename(job->input);
+        gchar *dot = strrchr(base, '.');
+
+        if (dot != NULL && dot != base)
+            *dot = '\0';
+        for (guint n = 1; job->output == NULL; n++)
+        {
+            gchar *name = n == 1 ? g_strdup_printf("%s.mkv", base) : g_strdup_printf("%s-%u.mkv", base, n);
+            gchar *path = g_build_filename(output_dir, name, NULL);
+            gchar *output = g_canonicalize_filename(path, NULL);
+
+            if (!output_taken(all, output))
+                job->output = output;
+            else
+                g_free(output);
+            g_free(path);
+            g_free(name);
+        }
+        g_free(base);
+    }
+}
+
+static void job_free(Job *job)
+{
+    g_free(job->input);
+    g_free(job->output);
+    g_free(job);
+}
+
+/* Reads the inputs from the manifest or the directory. Returns FALSE if neither can be read */
+static gboolean collect_jobs(std::vector<Job *> &all)
+{
+    GError *err = NULL;
+
+    if (manifest != NULL)
+    {
+        gchar *contents;
+        gchar **lines;
+
+        if (!g_file_get_contents(manifest, &contents, NULL, &err))
+        {
+            g_printerr("Could not read the manifest: %s\n", err->message);
+            g_clear_error(&err);
+            return FALSE;
+        }
+        lines = g_strsplit(contents, "\n", -1);
+        for (gchar **line = lines; *line != NULL; line++)
+        {
+            gchar *path = g_strstrip(*line);
+            if (*path != '\0' && *path != '#')
+                add_job(all, path);
+        }
+        g_strfreev(lines);
+        g_free(contents);
+    }
+
+    if (input_dir != NULL)
+    {
+        GDir *dir = g_dir_open(input_dir, 0, &err);
+        const gchar *name;
+
+        if (dir == NULL)
+        {
+            g_printerr("Could not open the input directory: %s\n", err->message);
+            g_clear_error(&err);
+            return FALSE;
+        }
+        while ((name = g_dir_read_name(dir)) != NULL)
+        {
+            gchar *path = g_build_filename(input_dir, name, NULL);
+            if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+                add_job(all, path);
+            g_free(path);
+        }
+        g_dir_close(dir);
+    }
+    return TRUE;
+}
+
+/* Links a decoded stream to an encoder and the muxer. Other streams are left unlinked */
+static void pad_added_cb(GstElement *src, GstPad *pad, Slot *slot)
+{
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    const gchar *type;
+    gchar *description = NULL;
+    GstElement *branch;
+    GstPad *sink_pad;
+    GError *err = NULL;
+
+    if (caps == NULL)
+        return;
+    type = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+    if (g_str_has_prefix(type, "video/x-raw"))
+        description = g_strdup_printf("queue ! videoconvert ! x264enc speed-preset=%s bitrate=%d threads=%u",
+            speed_preset, video_bitrate, slot->farm->encoder_threads);
+    else if (g_str_has_prefix(type, "audio/x-raw"))
+        description = g_strdup_printf("queue ! audioconvert ! audioresample ! opusenc bitrate=%d", audio_bitrate);
+    gst_caps_unref(caps);
+    if (description == NULL)
+        return;
+
+    branch = gst_parse_bin_from_description(description, TRUE, &err);
+    g_free(description);
+    if (branch == NULL)
+    {
+        g_printerr("%s: could not create an encoder: %s\n", slot->job->input, err->message);
+        g_clear_error(&err);
+        return;
+    }
+
+    gst_bin_add(GST_BIN(slot->pipeline), branch);
+    sink_pad = gst_element_get_static_pad(branch, "sink");
+    if (GST_PAD_LINK_FAILED(gst_pad_link(pad, sink_pad)) || !gst_element_link(branch, slot->mux))
+        g_printerr("%s: could not link the %s stream\n", slot->job->input, type);
+    gst_object_unref(sink_pad);
+    gst_element_sync_state_with_parent(branch);
+}
+
+static Slot *slot_new(Farm *farm, Job *job)
+{
+    Slot *slot = g_new0(Slot, 1);
+    GstElement *source, *sink;
+    gchar *uri;
+
+    slot->farm = farm;
+    slot->job = job;
+    slot->pipeline = gst_pipeline_new(NULL);
+    source = gst_element_factory_make("uridecodebin", NULL);
+    slot->mux = gst_element_factory_make("matroskamux", NULL);
+    sink = gst_element_factory_make("filesink", NULL);
+    if (source == NULL || slot->mux == NULL || sink == NULL)
+    {
+        g_printerr("Not all elements could be created.\n");
+        if (source != NULL)
+            gst_object_unref(source);
+        if (slot->mux != NULL)
+            gst_object_unref(slot->mux);
+        if (sink != NULL)
+            gst_object_unref(sink);
+        gst_object_unref(slot->pipeline);
+        g_free(slot);
+        return NULL;
+    }
+
+    uri = gst_filename_to_uri(job->input, NULL);
+    g_object_set(source, "uri", uri, NULL);
+    g_object_set(sink, "location", job->output, NULL);
+    g_free(uri);
+
+    gst_bin_add_many(GST_BIN(slot->pipeline), source, slot->mux, sink, NULL);
+    gst_element_link(slot->mux, sink);
+    g_signal_connect(source, "pad-added", G_CALLBACK(pad_added_cb), slot);
+    return slot;
+}
+
+static void slot_free(Slot *slot)
+{
+    g_source_remove(slot->bus_watch_id);
+    gst_element_set_state(slot->pipeline, GST_STATE_NULL);
+    gst_object_unref(slot->pipeline);
+    job_free(slot->job);
+    g_free(slot);
+}
+
+static void print_progress(Farm *farm)
+{
+    ProcessStats now;
+    double seconds, media;
+
+    process_stats_sample(&now);
+    seconds = (double)(now.wall_time - farm->start.wall_time) / G_USEC_PER_SEC;
+    media = (double)farm->media_time / GST_SECOND;
+    g_print("progress: %u/%u done, %u failed, %zu running, %.1f files/min, realtime x%.1f, cpu %.1f s/s\n",
+        farm->done, farm->total, farm->failed, farm->running.size(),
+        seconds > 0 ? farm->done * 60.0 / seconds : 0.0,
+        seconds > 0 ? media / seconds : 0.0,
+        seconds > 0 ? (double)(now.cpu_time - farm->start.cpu_time) / G_USEC_PER_SEC / seconds : 0.0);
+}
+
+/* Retires a finished slot and gives it the next job */
+static void farm_finish(Farm *farm, Slot *slot, gboolean ok)
+{
+    gint64 duration = 0;
+    double seconds = (double)(g_get_monotonic_time() - slot->start) / G_USEC_PER_SEC;
+
+    if (ok && !gst_element_query_duration(slot->pipeline, GST_FORMAT_TIME, &duration))
+        gst_element_query_position(slot->pipeline, GST_FORMAT_TIME, &duration);
+
+    farm->done++;
+    if (ok)
+    {
+        farm->media_time += duration;
+        g_print("[%u/%u] %s: %.1f s of media in %.1f s (x%.1f)\n", farm->done, farm->total, slot->job->output,
+            (double)duration / GST_SECOND, seconds, seconds > 0 ? (double)duration / GST_SECOND / seconds : 0.0);
+    }
+    else
+    {
+        farm->failed++;
+        g_print("[%u/%u] %s: failed after %.1f s\n", farm->done, farm->total, slot->job->input, seconds);
+        g_unlink(slot->job->output);
+    }
+
+    farm->running.erase(std::find(farm->running.begin(), farm->running.end(), slot));
+    slot_free(slot);
+    farm_start_next(farm);
+}
+
+/* Bus watch of every slot, all on the default GMainContext */
+static gboolean bus_cb(GstBus *bus, GstMessage *msg, Slot *slot)
+{
+    Farm *farm = slot->farm;
+
+    switch (GST_MESSAGE_TYPE(msg))
+    {
+        case GST_MESSAGE_ERROR:
+        {
+            GError *err;
+            gchar *debug_info;
+
+            gst_message_parse_error(msg, &err, &debug_info);
+            g_printerr("%s: error from %s: %s\n", slot->job->input, GST_OBJECT_NAME(msg->src), err->message);
+            g_clear_error(&err);
+            g_free(debug_info);
+            farm_finish(farm, slot, FALSE);
+            return G_SOURCE_REMOVE;
+        }
+
+        case GST_MESSAGE_EOS:
+        farm_finish(farm, slot, TRUE);
+        return G_SOURCE_REMOVE;
+
+        default:
+        break;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* Fills the free slots with queued jobs, and quits once nothing is left to do */
+static void farm_start_next(Farm *farm)
+{
+    while (farm->running.size() < (size_t)jobs && !farm->queue.empty())
+    {
+        Job *job = farm->queue.front();
+        Slot *slot;
+        GstBus *bus;
+
+        farm->queue.pop_front();
+        slot = slot_new(farm, job);
+        if (slot == NULL)
+        {
+            farm->done++;
+            farm->failed++;
+            job_free(job);
+            continue;
+        }
+
+        bus = gst_element_get_bus(slot->pipeline);
+        slot->bus_watch_id = gst_bus_add_watch(bus, (GstBusFunc)bus_cb, slot);
+        gst_object_unref(bus);
+
+        slot->start = g_get_monotonic_time();
+        farm->running.push_back(slot);
+        if (gst_element_set_state(slot->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        {
+            g_printerr("%s: could not start\n", job->input);
+            farm_finish(farm, slot, FALSE);
+            return;
+        }
+    }
+
+    if (farm->running.empty() && farm->queue.empty())
+        g_main_loop_quit(farm->loop);
+}
+
+static gboolean progress_cb(Farm *farm)
+{
+    print_progress(farm);
+    return G_SOURCE_CONTINUE;
+}
+
+int
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    std::vector<Job *> all;
+    guint cores = g_get_num_processors();
+    guint progress_id = 0;
+    Farm farm;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- transcode a batch of files to H.264/Opus in Matroska");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if ((manifest == NULL && input_dir == NULL) || output_dir == NULL || jobs < 0)
+    {
+        g_printerr("Usage: %s (--manifest FILE | --input-dir DIR) --output-dir DIR [--jobs N]\n", argv[0]);
+        return -1;
+    }
+    if (speed_preset == NULL)
+        speed_preset = g_strdup("veryfast");
+    if (g_mkdir_with_parents(output_dir, 0755) != 0)
+    {
+        g_printerr("Could not create %s\n", output_dir);
+        return -1;
+    }
+
+    /* Each job keeps a decoder, the converters and the muxer busy besides the
+     * encoder, so one job per two cores, and the encoders share the cores */
+    if (jobs == 0)
+        jobs = MAX(1, cores / 2);
+    farm.encoder_threads = MAX(1, cores / jobs);
+
+    if (!collect_jobs(all))
+        return -1;
+    name_outputs(all);
+
+    /* Biggest files first, so a long one does not start last and leave the
+     * other cores idle at the end */
+    std::stable_sort(all.begin(), all.end(), [](const Job *a, const Job *b) { return a->size > b->size; });
+    farm.queue.assign(all.begin(), all.end());
+    farm.total = all.size();
+    farm.done = 0;
+    farm.failed = 0;
+    farm.media_time = 0;
+    farm.loop = g_main_loop_new(NULL, FALSE);
+
+    g_print("Transcoding %u files, %d at a time, %u encoder threads each\n", farm.total, jobs, farm.encoder_threads);
+    process_stats_sample(&farm.start);
+    if (report_interval > 0)
+        progress_id = g_timeout_add_seconds(report_interval, (GSourceFunc)progress_cb, &farm);
+
+    farm_start_next(&farm);
+    if (!farm.running.empty())
+        g_main_loop_run(farm.loop);
+
+    print_progress(&farm);
+
+    /* Free resources */
+    if (progress_id != 0)
+        g_source_remove(progress_id);
+    g_main_loop_unref(farm.loop);
+    g_free(manifest);
+    g_free(input_dir);
+    g_free(output_dir);
+    g_free(speed_preset);
+    return farm.failed > 0 ? 1 : 0;
+}
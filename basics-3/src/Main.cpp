@@ -1,43 +1,132 @@
 #include <iostream>
 #include <gst/gst.h>
 
+#include "BusDispatcher.h"
+#include "StartupTimer.h"
+#include "StaticPlugins.h"
+#include "StreamRouter.h"
+
 /* Structure to contain all our information, so we can pass it to CBs */
 typedef struct _CustomData {
     GstElement *pipeline;
     GstElement *source;
-    GstElement *video_convert;
-    GstElement *audio_convert;
-    GstElement *resample;
-    GstElement *video_sink;
-    GstElement *audio_sink;
+    StreamRouter *router;       /* Links each decoded stream to a branch of its own */
+    BusDispatcher *bus_dispatcher;
+    GMutex lock;
+    GCond terminated;
+    gboolean terminate;         /* Should we terminate the execution? Protected by lock */
 } CustomData;
 
+/* Called by the router once a new pad is linked */
+static void stream_linked_handler(GstPad *pad, GstElement *branch, StreamKind kind, guint index, gpointer user_data);
 /* Handler for the pad-added signal */
 static void pad_added_handler(GstElement *src, GstPad *pad, CustomData *data);
 static bool check_error_elements_created(CustomData &data);
-static void retrive_pad_info(GstPad *pad);
+
+/* Bus callbacks, called on the dispatcher's thread */
+static void error_cb(GstObject *src, const GError *err, const gchar *debug_info, gpointer user_data);
+static void eos_cb(gpointer user_data);
+static void state_changed_cb(GstState old_state, GstState new_state, GstState pending_state, gpointer user_data);
+static void async_done_cb(gpointer user_data);
+static void request_terminate(CustomData *data);
+
+static const BusDispatcherCallbacks bus_callbacks = {
+    error_cb, eos_cb, state_changed_cb, NULL, async_done_cb
+};
+
+/* Command line options */
+static gchar *uri = NULL;
+static gchar *startup_report = NULL;
+static gboolean startup_compare = FALSE;
+static gint video_branches = 1;
+static gint audio_branches = 1;
+static gchar *decode = NULL;
+
+static GOptionEntry entries[] = {
+    { "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play instead of the tutorial's trailer", "URI" },
+    { "startup-report", 0, 0, G_OPTION_ARG_STRING, &startup_report,
+      "Print how long each startup phase took and quit once playing. MODE is cold or warm (registry)", "MODE" },
+    { "startup-compare", 0, 0, G_OPTION_ARG_NONE, &startup_compare,
+      "Run the startup report with a cold and a warm registry and compare them", NULL },
+    { "video-branches", 0, 0, G_OPTION_ARG_INT, &video_branches,
+      "Video branches to build ahead of the decoder's pads (default: 1)", "N" },
+    { "audio-branches", 0, 0, G_OPTION_ARG_INT, &audio_branches,
+      "Audio branches to build ahead of the decoder's pads (default: 1)", "N" },
+    { "decode", 'd', 0, G_OPTION_ARG_STRING, &decode,
+      "Streams to decode: both, video or audio. The others are never decoded (default: both)", "KIND" },
+    { NULL }
+};
 
 int 
 main(int argc, char* argv[])
 {
     CustomData data;
-    GstBus *bus;
-    GstMessage *msg;
     GstStateChangeReturn ret;
-    gboolean terminate = FALSE;
+    GOptionContext *context;
+    GError *err = NULL;
+    StreamRouterStats router_stats;
+    BusDispatcherStats bus_stats;
+    StreamDecode decode_mode;
+
+    startup_timer_init();
+
+    /* Parse our own options. GStreamer's ones are left in argv for gst_init */
+    context = g_option_context_new("- dynamic pipeline tutorial");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_set_ignore_unknown_options(context, TRUE);
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (!stream_decode_from_string(decode != NULL ? decode : "both", &decode_mode))
+    {
+        g_printerr("Unknown --decode '%s', expected both, video or audio.\n", decode);
+        return -1;
+    }
+
+    /* Skip the sink of the streams we do not decode */
+    if (decode_mode == STREAM_DECODE_AUDIO)
+        video_branches = 0;
+    else if (decode_mode == STREAM_DECODE_VIDEO)
+        audio_branches = 0;
+
+    if (startup_compare)
+    {
+        /* Forward the options that change what is played to both runs */
+        gchar *child_args[5] = { NULL };
+        gint n_args = 0;
+
+        if (uri != NULL)
+        {
+            child_args[n_args++] = (gchar *)"--uri";
+            child_args[n_args++] = uri;
+        }
+        if (decode != NULL)
+        {
+            child_args[n_args++] = (gchar *)"--decode";
+            child_args[n_args++] = decode;
+        }
+        return startup_timer_compare(argv[0], n_args > 0 ? child_args : NULL);
+    }
+
+    if (g_strcmp0(startup_report, "cold") == 0)
+        startup_timer_use_cold_registry();
 
     /* Initialize GStreamer */
     std::cout << "Init gst\n";
+    static_plugins_prepare();
     gst_init(&argc, &argv);
+    static_plugins_register();
+    startup_timer_mark("registry-ready");
 
     /* Create the elements */
     std::cout << "Create elements\n";
     data.source = gst_element_factory_make("uridecodebin", "source");
-    data.video_convert = gst_element_factory_make("videoconvert", "video_convert");
-    data.audio_convert = gst_element_factory_make("audioconvert", "audio_convert");
-    data.resample = gst_element_factory_make("audioresample", "resample");
-    data.video_sink = gst_element_factory_make("autovideosink", "video_sink");
-    data.audio_sink = gst_element_factory_make("autoaudiosink", "audio_sink");
 
     /* Create the empty pipeline */
     std::cout << "Create the empty pipeline\n";
@@ -47,178 +136,153 @@ main(int argc, char* argv[])
     std::cout << "Test if everything went well with element creation\n";
     if (check_error_elements_created(data) == TRUE)
         return -1;
+    startup_timer_mark("elements-created");
 
-    /* Build the pipeline. We are NOT linking the source at this
-     * point. We will do it later. 
-     */
+    /* Build the pipeline. The source is linked later, one branch per stream.
+     * The branches are built in the background meanwhile */
     std::cout << "Build the pipeline without link\n";
-    gst_bin_add_many(GST_BIN(data.pipeline), 
-                    data.source,
-                    data.video_convert,
-                    data.video_sink,
-                    data.audio_convert, 
-                    data.resample,
-                    data.audio_sink,
-                    NULL);
-
-    gboolean retval = gst_element_link_many(data.video_convert, data.video_sink, NULL);
-    if (retval == FALSE)
-    {
-        g_printerr("Elements in video chain could not be linked.\n");
-        gst_object_unref(data.pipeline);
-        return -1;
-    }
-
-    retval = gst_element_link_many(data.audio_convert, data.resample, data.audio_sink, NULL);
-    if (retval == FALSE)
-    {
-        g_printerr("Elements audio chain could not be linked.\n");
-        gst_object_unref(data.pipeline);
-        return -1;
-    }
-    
+    gst_bin_add(GST_BIN(data.pipeline), data.source);
+    data.router = stream_router_new(data.pipeline, MAX(video_branches, 0), MAX(audio_branches, 0),
+                                    stream_linked_handler, &data);
+    stream_router_set_decode(data.router, decode_mode);
 
     /* Set the URI to play */
-    g_object_set(data.source, "uri", "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm", NULL);
+    if (uri == NULL)
+        uri = g_strdup("https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm");
+    g_object_set(data.source, "uri", uri, NULL);
     
-    /* Connect to the pad-added signal */
+    /* Connect to the pad-added signal. Ours runs first and only marks the
+     * startup phase, the router does the linking */
     g_signal_connect(data.source, "pad-added", G_CALLBACK(pad_added_handler), &data);
+    stream_router_attach(data.router, data.source);
+
+    /* Timestamp typefinding. The first buffers are watched once the branches are linked */
+    startup_timer_watch_typefind(data.pipeline);
+
+    /* Handle the bus from now on, so no message of the startup is missed */
+    g_mutex_init(&data.lock);
+    g_cond_init(&data.terminated);
+    data.terminate = FALSE;
+    data.bus_dispatcher = bus_dispatcher_new(data.pipeline, &bus_callbacks, &data);
 
     /* Start playing */
     ret = gst_element_set_state(data.pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE)
     {
         g_printerr("Unable to set the pipeline to the playing state.\n");
+        gst_element_set_state(data.pipeline, GST_STATE_NULL);
+        bus_dispatcher_free(data.bus_dispatcher);
+        stream_router_free(data.router);
         gst_object_unref(data.pipeline);
         return -1;
     }
 
-    /* Listen to the bus */
-    bus = gst_element_get_bus(data.pipeline);
-    do 
-    {
-        msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
-            (GstMessageType)(GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
-        
-        /* Parse message */
-        if (msg != NULL)
-        {
-            GError *err;
-            gchar *debug_info;
-
-            switch (GST_MESSAGE_TYPE(msg)) 
-            {
-                case GST_MESSAGE_ERROR:
-                gst_message_parse_error(msg, &err, &debug_info);
-                g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
-                g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
-                g_clear_error(&err);
-                g_free(debug_info);
-                terminate = TRUE;
-                break;
-
-                case GST_MESSAGE_EOS:
-                g_print("End-Of-Stream reached.\n");
-                terminate = TRUE;
-                break;
-
-                case GST_MESSAGE_STATE_CHANGED:
-                /* We are only interested in state-changed messages from the pipeline */
-                if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data.pipeline)) {
-                    GstState old_state, new_state, pending_state;
-                    gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
-                    g_print("Pipeline state changed from %s to %s:\n",
-                        gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
-                }
-                break;
-
-                default:
-                /* We should not reach here */
-                g_printerr("Unexpected message received.\n");
-                break;
-            }
-            gst_message_unref(msg);
-        }
-    } while (!terminate);
+    /* The bus is handled by the dispatcher's thread, until a callback asks us to stop */
+    g_mutex_lock(&data.lock);
+    while (!data.terminate)
+        g_cond_wait(&data.terminated, &data.lock);
+    g_mutex_unlock(&data.lock);
+
+    if (startup_report != NULL)
+        startup_timer_print_report();
+
+    stream_router_get_stats(data.router, &router_stats);
+    g_print("Streams linked: %u video, %u audio. Branches ready when needed: %u of %u\n",
+        router_stats.linked[STREAM_KIND_VIDEO], router_stats.linked[STREAM_KIND_AUDIO],
+        router_stats.pool_hits, router_stats.pool_hits + router_stats.pool_misses);
+    bus_dispatcher_get_stats(data.bus_dispatcher, &bus_stats);
+    g_print("Bus messages: %u posted, %u dropped at the source, %u wakeups\n",
+        bus_stats.posted, bus_stats.dropped, bus_stats.wakeups);
 
     /* Free resources */
-    gst_object_unref(bus);
     gst_element_set_state(data.pipeline, GST_STATE_NULL);
+    bus_dispatcher_free(data.bus_dispatcher);
+    stream_router_free(data.router);
+    g_cond_clear(&data.terminated);
+    g_mutex_clear(&data.lock);
     gst_object_unref(data.pipeline);
+    startup_timer_cleanup();
+    g_free(uri);
+    g_free(startup_report);
+    g_free(decode);
     return 0;
 }
 
 /* This is the definition of the callback funcion for when the pad is added */
 static void pad_added_handler(GstElement *src, GstPad *new_pad, CustomData *data)
 {
-    GstPad *sink_pad = NULL;
-    GstPadLinkReturn ret;
-    GstCaps *new_pad_caps = NULL;
-    GstStructure *new_pad_struct = NULL;
-    const gchar *new_pad_type = NULL;
+    gchar *phase = NULL;
 
     g_print("Received new pad '%s' from '%s': \n", GST_PAD_NAME(new_pad), GST_ELEMENT_NAME(src));
 
-    /* Check the new pad's type and Attempt the link */
-    new_pad_caps = gst_pad_get_current_caps(new_pad);
-    new_pad_struct = gst_caps_get_structure(new_pad_caps, 0);
-    new_pad_type = gst_structure_get_name(new_pad_struct);
-
-    if (g_str_has_prefix(new_pad_type, "video/x-raw"))
-    {
-        std::cout << "Linking video pads\n";
-        sink_pad = gst_element_get_compatible_pad(data->video_convert, new_pad, new_pad_caps);
+    phase = g_strdup_printf("pad-added:%s", GST_PAD_NAME(new_pad));
+    startup_timer_mark(phase);
+    g_free(phase);
+}
 
-        /* Try to get info on the compatible pad */
-        retrive_pad_info(sink_pad);
+static void stream_linked_handler(GstPad *pad, GstElement *branch, StreamKind kind, guint index, gpointer user_data)
+{
+    /* Only the first stream of each kind is on the path to the first frame */
+    if (index != 0)
+        return;
 
-        if (gst_pad_is_linked(sink_pad))
-        {
-            g_print("Video pad already linked. Ignoring...\n");
-            goto exit;
-        }
-        ret = gst_pad_link(new_pad, sink_pad);
-    }
-    else if (g_str_has_prefix(new_pad_type, "audio/x-raw"))
+    if (kind == STREAM_KIND_VIDEO)
     {
-        std::cout << "Linking audio pads\n";
-        sink_pad = gst_element_get_compatible_pad(data->audio_convert, new_pad, new_pad_caps);
-
-        /* Try to get info on the compatible pad */
-        retrive_pad_info(sink_pad);
-
-        if (gst_pad_is_linked(sink_pad))
-        {
-            g_print("Audio pad already linked. Ignoring...\n");
-            goto exit;
-        }
-        ret = gst_pad_link(new_pad, sink_pad);
+        startup_timer_mark("pipeline-linked:video");
+        startup_timer_watch_first_buffer(branch, "first-buffer:video_sink");
     }
     else
     {
-        g_print("It has type '%s' which is not necessary. Ignoring...\n", new_pad_type);
-        goto exit;
+        startup_timer_mark("pipeline-linked:audio");
+        startup_timer_watch_first_buffer(branch, "first-buffer:audio_sink");
     }
+}
 
-    if (GST_PAD_LINK_FAILED(ret))
-    {
-        g_print("Type is '%s' but link failed. \n", new_pad_type);
-    }
-    else
-    {
-        g_print("Link succeeded (type '%s'). \n", new_pad_type);
-    }
+static void request_terminate(CustomData *data)
+{
+    g_mutex_lock(&data->lock);
+    data->terminate = TRUE;
+    g_cond_signal(&data->terminated);
+    g_mutex_unlock(&data->lock);
+}
+
+static void error_cb(GstObject *src, const GError *err, const gchar *debug_info, gpointer user_data)
+{
+    CustomData *data = (CustomData *)user_data;
+
+    g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(src), err->message);
+    g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
+    request_terminate(data);
+}
 
-exit:
-    /* Unreference the new pad's caps, if we got them */
-    if (new_pad_caps != NULL)
+static void eos_cb(gpointer user_data)
+{
+    CustomData *data = (CustomData *)user_data;
+
+    g_print("End-Of-Stream reached.\n");
+    request_terminate(data);
+}
+
+static void state_changed_cb(GstState old_state, GstState new_state, GstState pending_state, gpointer user_data)
+{
+    CustomData *data = (CustomData *)user_data;
+
+    g_print("Pipeline state changed from %s to %s:\n",
+        gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
+
+    /* In report mode we are done as soon as the first frame is being played */
+    if (new_state == GST_STATE_PLAYING)
     {
-        gst_caps_unref(new_pad_caps);
+        startup_timer_mark("playing");
+        if (startup_report != NULL)
+            request_terminate(data);
     }
+}
 
-    /* Unreference the sink pads */
-    if (sink_pad != nullptr)
-        gst_object_unref(sink_pad);
+static void async_done_cb(gpointer user_data)
+{
+    /* The sinks have prerolled */
+    startup_timer_mark("async-done");
 }
 
 static bool check_error_elements_created(CustomData &data)
@@ -234,51 +298,5 @@ static bool check_error_elements_created(CustomData &data)
         g_printerr("Source element could not be created. \n");
         err_detected = true;
     }
-    if (data.video_convert == nullptr)
-    {
-        g_printerr("Video convert element could not be created. \n");
-        err_detected = true;
-    }
-    if (data.audio_convert == nullptr)
-    {
-        g_printerr("Audio convert element could not be created. \n");
-        err_detected = true;
-    }
-    if (data.resample == nullptr)
-    {
-        g_printerr("Resample element could not be created. \n");
-        err_detected = true;
-    }
-    if (data.video_sink == nullptr)
-    {
-        g_printerr("Video sink element could not be created. \n");
-        err_detected = true;
-    }
-    if (data.audio_sink == nullptr)
-    {
-        g_printerr("Audio sink element could not be created. \n");
-        err_detected = true;
-    }
     return err_detected;
-}
-
-static void retrive_pad_info(GstPad *pad)
-{
-    GstCaps *pad_caps = nullptr;
-    GstStructure *pad_struct = nullptr;
-    const gchar *pad_type = nullptr;
-
-    std::cout << "Trying to retrieve pad info about "<< GST_PAD_NAME(pad) << " pad\n";
-
-    if (gst_pad_has_current_caps(pad))
-    {
-            pad_caps = gst_pad_get_current_caps(pad);
-            pad_struct = gst_caps_get_structure(pad_caps, 0);
-            pad_type = gst_structure_get_name(pad_struct);
-            std::cout << "Compatible pad name is " << pad_type << "\n"; 
-    }
-    else
-    {
-        std::cout << "No current caps for "<< GST_PAD_NAME(pad) << " pad\n";
-    }
 }
\ No newline at end of file
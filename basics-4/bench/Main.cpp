@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <gst/gst.h>
+
+#include "Preroll.h"
+
+/* One sink of the pipeline. Armed by the flush that ends a seek, so the
+ * first buffer it sees afterwards is known to come from the new position */
+typedef struct _SinkWatch {
+    gint armed;
+    gint64 first_buffer;        /* Monotonic time, in microseconds. 0 until a buffer came */
+} SinkWatch;
+
+/* The file being measured */
+typedef struct _Bench {
+    GstElement *pipeline;
+    GMutex lock;
+    std::vector<SinkWatch *> watches;   /* One per stream, protected by lock */
+    GstClockTime duration;
+} Bench;
+
+/* A seek policy to compare, as given on the command line */
+typedef struct _FlagSet {
+    std::string name;
+    GstSeekFlags flags;
+} FlagSet;
+
+/* What the seeks of one flag set measured, in ms */
+typedef struct _SeekStats {
+    std::vector<gdouble> async_done;    /* Seek call to ASYNC_DONE */
+    std::vector<gdouble> first_buffer;  /* Seek call to the first buffer at a sink */
+    std::vector<gdouble> landing;       /* Distance between the target and where the seek landed */
+    guint failed;
+} SeekStats;
+
+/* Command line options */
+static gchar *flag_sets = NULL;
+static gint seeks = 50;
+static gint warmup_seeks = 3;
+static gint seed = 1;
+static gint timeout = 10;
+static gchar *output = NULL;
+static gchar **files = NULL;
+
+static GOptionEntry entries[] = {
+    { "flags", 'f', 0, G_OPTION_ARG_STRING, &flag_sets,
+      "Comma separated flag sets to compare. A set joins flush, key-unit, accurate, snap-before, "
+      "snap-after and snap-nearest with '+' "
+      "(default: flush,flush+key-unit,flush+key-unit+snap-before,flush+key-unit+snap-after,"
+      "flush+key-unit+snap-nearest,flush+accurate)", "LIST" },
+    { "seeks", 'n', 0, G_OPTION_ARG_INT, &seeks, "Measured seeks per file and flag set (default 50)", "N" },
+    { "warmup", 'w', 0, G_OPTION_ARG_INT, &warmup_seeks, "Seeks discarded before measuring each flag set (default 3)", "N" },
+    { "seed", 's', 0, G_OPTION_ARG_INT, &seed,
+      "Seed of the random seek targets. Every flag set seeks to the same targets (default 1)", "N" },
+    { "timeout", 't', 0, G_OPTION_ARG_INT, &timeout, "Seconds to wait for a seek to complete (default 10)", "S" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the CSV to FILE instead of stdout", "FILE" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, "FILE..." },
+    { NULL }
+};
+
+/* Turns "flush+key-unit+snap-before" into seek flags */
+static gboolean parse_flag_set(const gchar *name, FlagSet *set)
+{
+    gchar **parts = g_strsplit(name, "+", -1);
+    gboolean ok = TRUE;
+
+    set->name = name;
+    set->flags = GST_SEEK_FLAG_NONE;
+    for (gchar **part = parts; *part != NULL && ok; part++)
+    {
+        if (g_strcmp0(*part, "flush") == 0)
+            set->flags = (GstSeekFlags)(set->flags | GST_SEEK_FLAG_FLUSH);
+        else if (g_strcmp0(*part, "key-unit") == 0)
+            set->flags = (GstSeekFlags)(set->flags | GST_SEEK_FLAG_KEY_UNIT);
+        else if (g_strcmp0(*part, "accurate") == 0)
+            set->flags = (GstSeekFlags)(set->flags | GST_SEEK_FLAG_ACCURATE);
+        else if (g_strcmp0(*part, "snap-before") == 0)
+            set->flags = (GstSeekFlags)(set->flags | GST_SEEK_FLAG_SNAP_BEFORE);
+        else if (g_strcmp0(*part, "snap-after") == 0)
+            set->flags = (GstSeekFlags)(set->flags | GST_SEEK_FLAG_SNAP_AFTER);
+        else if (g_strcmp0(*part, "snap-nearest") == 0)
+            set->flags = (GstSeekFlags)(set->flags | GST_SEEK_FLAG_SNAP_NEAREST);
+        else
+        {
+            g_printerr("Unknown seek flag '%s' in '%s'.\n", *part, name);
+            ok = FALSE;
+        }
+    }
+    g_strfreev(parts);
+
+    /* Without a flush the seek waits behind the data already queued and no
+     * new preroll, so no ASYNC_DONE, marks its end */
+    if (ok && !(set->flags & GST_SEEK_FLAG_FLUSH))
+    {
+        g_printerr("Flag set '%s' needs flush: a non-flushing seek has no end to measure.\n", name);
+        ok = FALSE;
+    }
+    return ok;
+}
+
+static GstPadProbeReturn sink_probe_cb(GstPad *pad, GstPadProbeInfo *info, SinkWatch *watch)
+{
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+    {
+        if (g_atomic_int_compare_and_exchange(&watch->armed, TRUE, FALSE))
+            watch->first_buffer = g_get_monotonic_time();
+    }
+    else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+    {
+        g_atomic_int_set(&watch->armed, TRUE);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* Every stream goes to a sink of its own, like in the player */
+static void pad_added_cb(GstElement *source, GstPad *pad, Bench *bench)
+{
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+    GstPad *sink_pad;
+    SinkWatch *watch = g_new0(SinkWatch, 1);
+
+    gst_bin_add(GST_BIN(bench->pipeline), sink);
+    sink_pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(sink_pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH),
+        (GstPadProbeCallback)sink_probe_cb, watch, g_free);
+    gst_pad_link(pad, sink_pad);
+    gst_object_unref(sink_pad);
+    gst_element_sync_state_with_parent(sink);
+
+    g_mutex_lock(&bench->lock);
+    bench->watches.push_back(watch);
+    g_mutex_unlock(&bench->lock);
+}
+
+/* Builds the pipeline of path and prerolls it */
+static gboolean bench_open(Bench *bench, const gchar *path)
+{
+    GstElement *source = gst_element_factory_make("uridecodebin", NULL);
+    gchar *uri = gst_filename_to_uri(path, NULL);
+    gint64 duration;
+
+    bench->pipeline = gst_pipeline_new(NULL);
+    if (source == NULL || uri == NULL)
+    {
+        g_printerr("Could not create the source of %s.\n", path);
+        if (source != NULL)
+            gst_object_unref(source);
+        g_free(uri);
+        return FALSE;
+    }
+    g_object_set(source, "uri", uri, NULL);
+    g_free(uri);
+    gst_bin_add(GST_BIN(bench->pipeline), source);
+    g_signal_connect(source, "pad-added", G_CALLBACK(pad_added_cb), bench);
+
+    /* Seeks are measured in PAUSED: each one ends with the new preroll */
+    if (gst_element_set_state(bench->pipeline, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE ||
+        !preroll_wait(bench->pipeline, timeout * GST_SECOND, path))
+        return FALSE;
+
+    if (!gst_element_query_duration(bench->pipeline, GST_FORMAT_TIME, &duration) || duration <= GST_SECOND)
+    {
+        g_printerr("%s has no usable duration.\n", path);
+        return FALSE;
+    }
+    bench->duration = duration;
+    return TRUE;
+}
+
+static void bench_close(Bench *bench)
+{
+    gst_element_set_state(bench->pipeline, GST_STATE_NULL);
+    gst_object_unref(bench->pipeline);
+    bench->watches.clear();
+}
+
+/* Performs one seek and records how long it took. Returns FALSE if it did not complete */
+static gboolean measure_seek(Bench *bench, const FlagSet &set, GstClockTime target, SeekStats *stats)
+{
+    gint64 start, async_done, first_buffer = 0;
+    gint64 landed;
+
+    g_mutex_lock(&bench->lock);
+    for (SinkWatch *watch : bench->watches)
+    {
+        g_atomic_int_set(&watch->armed, FALSE);
+        watch->first_buffer = 0;
+    }
+    g_mutex_unlock(&bench->lock);
+
+    start = g_get_monotonic_time();
+    if (!gst_element_seek_simple(bench->pipeline, GST_FORMAT_TIME, set.flags, target) ||
+        !preroll_wait(bench->pipeline, timeout * GST_SECOND, NULL))
+    {
+        stats->failed++;
+        return FALSE;
+    }
+    async_done = g_get_monotonic_time();
+
+    /* The buffers reached the sinks before they could preroll and post ASYNC_DONE */
+    g_mutex_lock(&bench->lock);
+    for (SinkWatch *watch : bench->watches)
+    {
+        if (watch->first_buffer != 0 && (first_buffer == 0 || watch->first_buffer < first_buffer))
+            first_buffer = watch->first_buffer;
+    }
+    g_mutex_unlock(&bench->lock);
+
+    stats->async_done.push_back((gdouble)(async_done - start) / 1000.0);
+    if (first_buffer != 0)
+        stats->first_buffer.push_back((gdouble)(first_buffer - start) / 1000.0);
+    if (gst_element_query_position(bench->pipeline, GST_FORMAT_TIME, &landed))
+        stats->landing.push_back(ABS(GST_CLOCK_DIFF(target, (GstClockTime)landed)) / (gdouble)GST_MSECOND);
+    return TRUE;
+}
+
+/* Value at the given percentile of sorted values */
+static gdouble percentile(const std::vector<gdouble> &sorted, gdouble pct)
+{
+    if (sorted.empty())
+        return 0.0;
+    return sorted[MIN(sorted.size() - 1, (size_t)(pct / 100.0 * sorted.size()))];
+}
+
+/* Writes p50, p95, p99 and max of values */
+static void print_percentiles(FILE *csv, std::vector<gdouble> &values)
+{
+    std::sort(values.begin(), values.end());
+    fprintf(csv, "%.2f,%.2f,%.2f,%.2f", percentile(values, 50), percentile(values, 95), percentile(values, 99),
+            values.empty() ? 0.0 : values.back());
+}
+
+/* Runs the seeks of one flag set on an open file and writes its CSV row */
+static void measure(FILE *csv, Bench *bench, const gchar *path, guint file_index, const FlagSet &set)
+{
+    /* The same targets for every flag set of a file */
+    GRand *rand = g_rand_new_with_seed((guint32)seed + file_index);
+    SeekStats stats = {};
+    gchar *basename = g_path_get_basename(path);
+
+    for (gint i = 0; i < warmup_seeks + seeks; i++)
+    {
+        GstClockTime target = (GstClockTime)g_rand_double_range(rand, 0, (gdouble)(bench->duration - GST_SECOND));
+        SeekStats *sink = &stats, warmup = {};
+
+        if (i < warmup_seeks)
+            sink = &warmup;
+        if (!measure_seek(bench, set, target, sink) && sink->failed > 3)
+            break;
+    }
+
+    fprintf(csv, "%s,%s,%zu,%u,", basename, set.name.c_str(), stats.async_done.size(), stats.failed);
+    print_percentiles(csv, stats.async_done);
+    fprintf(csv, ",");
+    print_percentiles(csv, stats.first_buffer);
+    fprintf(csv, ",");
+    print_percentiles(csv, stats.landing);
+    fprintf(csv, "\n");
+    fflush(csv);
+
+    g_free(basename);
+    g_rand_free(rand);
+}
+
+int 
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    gchar **set_list;
+    std::vector<FlagSet> sets;
+    FILE *csv = stdout;
+    guint file_index = 0;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- seek latency per seek flag set");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (files == NULL || seeks <= 0 || warmup_seeks < 0 || timeout <= 0)
+    {
+        g_printerr("Usage: %s [--flags LIST] [--seeks N] [--seed N] FILE...\n", argv[0]);
+        return -1;
+    }
+
+    set_list = g_strsplit(flag_sets ? flag_sets
+        : "flush,flush+key-unit,flush+key-unit+snap-before,flush+key-unit+snap-after,"
+          "flush+key-unit+snap-nearest,flush+accurate", ",", -1);
+    for (gchar **name = set_list; *name != NULL; name++)
+    {
+        FlagSet set;
+
+        if (!parse_flag_set(*name, &set))
+        {
+            g_strfreev(set_list);
+            return -1;
+        }
+        sets.push_back(set);
+    }
+    g_strfreev(set_list);
+
+    if (output != NULL)
+    {
+        csv = fopen(output, "w");
+        if (csv == NULL)
+        {
+            g_printerr("Could not open %s for writing.\n", output);
+            return -1;
+        }
+    }
+
+    fprintf(csv, "file,flags,seeks,failed,"
+                 "async_done_ms_p50,async_done_ms_p95,async_done_ms_p99,async_done_ms_max,"
+                 "first_buffer_ms_p50,first_buffer_ms_p95,first_buffer_ms_p99,first_buffer_ms_max,"
+                 "landing_error_ms_p50,landing_error_ms_p95,landing_error_ms_p99,landing_error_ms_max\n");
+
+    for (gchar **file = files; *file != NULL; file++, file_index++)
+    {
+        Bench bench;
+
+        g_mutex_init(&bench.lock);
+        if (bench_open(&bench, *file))
+        {
+            for (const FlagSet &set : sets)
+                measure(csv, &bench, *file, file_index, set);
+        }
+        bench_close(&bench);
+        g_mutex_clear(&bench.lock);
+    }
+
+    if (csv != stdout)
+        fclose(csv);
+    g_strfreev(files);
+    g_free(flag_sets);
+    g_free(output);
+    return 0;
+}
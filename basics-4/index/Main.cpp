@@ -0,0 +1,94 @@
+#include <stdio.h>
+
+#include <gst/gst.h>
+
+#include "KeyframeIndex.h"
+
+/* Command line options */
+static gboolean force = FALSE;
+static gboolean print = FALSE;
+static gchar **files = NULL;
+
+static GOptionEntry entries[] = {
+    { "force", 'f', 0, G_OPTION_ARG_NONE, &force, "Rebuild the index even if a stored one is up to date", NULL },
+    { "print", 'p', 0, G_OPTION_ARG_NONE, &print, "Print every keyframe of the index", NULL },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, "FILE..." },
+    { NULL }
+};
+
+/* Longest stretch without a keyframe: the most a KEY_UNIT|SNAP_BEFORE seek
+ * can land before its target */
+static GstClockTime largest_gap(KeyframeIndex *index)
+{
+    GstClockTime gap = 0;
+
+    for (guint i = 1; i < keyframe_index_get_size(index); i++)
+        gap = MAX(gap, keyframe_index_get_keyframe(index, i) - keyframe_index_get_keyframe(index, i - 1));
+    return gap;
+}
+
+/* Loads or builds the index of one file, says where it is stored and how dense its keyframes are */
+static gboolean index_file(const gchar *path)
+{
+    gint64 start = g_get_monotonic_time();
+    KeyframeIndex *index = force ? NULL : keyframe_index_load(path);
+    gboolean built = (index == NULL);
+    gchar *cache_path;
+    guint size;
+
+    if (built)
+        index = keyframe_index_build(path);
+    if (index == NULL)
+    {
+        g_printerr("%s: no keyframes found\n", path);
+        return FALSE;
+    }
+
+    size = keyframe_index_get_size(index);
+    cache_path = keyframe_index_cache_path(path);
+    g_print("%s: %u keyframes, largest gap %" GST_TIME_FORMAT ", %s in %.3f s -> %s\n", path, size,
+        GST_TIME_ARGS(largest_gap(index)), built ? "built" : "loaded",
+        (double)(g_get_monotonic_time() - start) / G_USEC_PER_SEC, cache_path);
+    g_free(cache_path);
+
+    if (print)
+    {
+        for (guint i = 0; i < size; i++)
+            g_print("  %" GST_TIME_FORMAT "\n", GST_TIME_ARGS(keyframe_index_get_keyframe(index, i)));
+    }
+    keyframe_index_free(index);
+    return TRUE;
+}
+
+int
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    gboolean ok = TRUE;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- build the keyframe index of local files ahead of playback");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (files == NULL)
+    {
+        g_printerr("Usage: %s [--force] [--print] FILE...\n", argv[0]);
+        return -1;
+    }
+
+    for (gchar **file = files; *file != NULL; file++)
+        ok &= index_file(*file);
+
+    g_strfreev(files);
+    return ok ? 0 : 1;
+}
@@ -1,60 +1,211 @@
 #include <iostream>
+#include <stdio.h>
 #include <gst/gst.h>
 
+#include "BusDispatcher.h"
+#include "FileCache.h"
+#include "KeyframeFilter.h"
+#include "KeyframeIndex.h"
+#include "PositionTracker.h"
+#include "ProcessStats.h"
+#include "StaticPlugins.h"
+#include "StreamRouter.h"
+
+/* Continuity of one stream across loops, seen where it leaves the decoder.
+ * Only touched by that stream's thread until the pipeline is stopped */
+typedef struct _LoopWatch {
+    const gchar *name;
+    GstElement *pipeline;
+    PositionTracker *position;  /* Told when a new loop starts */
+    GstSegment segment;
+    gboolean has_segment;       /* A segment was received since the last flush */
+    gboolean boundary;          /* A new loop's segment came, its first buffer has not */
+    GstClockTime last_end;      /* Running time the last buffer ended at */
+    GstClockTime last_duration; /* For buffers without a duration */
+    guint loops;                /* Boundaries measured */
+    gdouble max_gap;            /* Largest running time gap between loops, in ms */
+    gdouble min_slack;          /* Least time a loop's first buffer arrived before it was due, in ms */
+} LoopWatch;
+
 /* Structure to contain all our information, so we can pass it to CBs */
 typedef struct _CustomData {
     GstElement *pipeline;
     GstElement *source;
-    GstElement *video_convert;
-    GstElement *audio_convert;
-    GstElement *resample;
-    GstElement *video_sink;
-    GstElement *audio_sink;
-    gboolean playing;           /* Are we in the PLAYING state of the pipeline? */
-    gboolean terminate;         /* Should we terminate the execution? */
-    gboolean seek_enabled;      /* Is seeking enabled for this media? */
+    StreamRouter *router;       /* Links each decoded stream to a branch of its own */
+    BusDispatcher *bus_dispatcher;
+    PositionTracker *position;  /* Position and duration without a query every refresh */
+    GMutex lock;
+    GCond terminated;
+
+    /* Written by the bus callbacks, read by the main thread */
+    gint playing;               /* Are we in the PLAYING state of the pipeline? */
+    gint terminate;             /* Should we terminate the execution? */
+    gint seek_enabled;          /* Is seeking enabled for this media? */
+
+    /* Main thread only */
     gboolean seek_done;         /* Have we performed the seek already? */
-    gint64 duration;            /* How long does this media last, in nanoseconds? */
-} CustomData;
 
-/** Callback functions **/
-/* Handler for the pad-added signal */
-static void pad_added_handler(GstElement *src, GstPad *pad, CustomData *data);
+    /* Scan mode. The start is taken by the bus callbacks once the scan seek completed */
+    gint scan_pending;          /* The scan seek was issued, its ASYNC_DONE is awaited */
+    gint scan_measuring;        /* The start below is set */
+    gint64 scan_start_position;
+    ProcessStats scan_start;
+    gint64 scan_last_position;  /* Main thread only */
+    KeyframeFilter *keyframe_filter;    /* Counts the frames decoded, drops the delta ones in trick mode */
+
+    /* Loop mode */
+    gint loops_done;            /* SEGMENT_DONEs handled by the bus callbacks */
+    LoopWatch loop_watch[STREAM_KIND_COUNT];
+} CustomData;
 
 /** Utility functions **/
 /* Checks if the elements could or not be created */
 static bool check_error_elements_created(CustomData &data);
-/* Tries to acquire information on pad */
-static void retrive_pad_info(GstPad *pad);
-/* Handler for the message processing function */
-static void handle_message(CustomData *data, GstMessage *msg);
+/* Prints the position, and seeks once 10 s are reached */
+static void refresh_position(CustomData *data);
+static void request_terminate(CustomData *data);
+/* Starts the scan at --scan rate */
+static void start_scan(CustomData *data, gint64 current, gint64 duration);
+/* Prints the speed and CPU cost of the scan */
+static void print_scan_result(CustomData *data);
+/* Runs the scan with and without trick modes in child processes and compares them */
+static int scan_compare(const gchar *self);
+/* Starts playing the loop range with a flushing SEGMENT seek */
+static void start_loop(CustomData *data);
+/* Watches the first stream of each kind for gaps between loops */
+static void stream_linked_handler(GstPad *pad, GstElement *branch, StreamKind kind, guint index, gpointer user_data);
+
+/** Bus callbacks, called on the dispatcher's thread **/
+static void error_cb(GstObject *src, const GError *err, const gchar *debug_info, gpointer user_data);
+static void eos_cb(gpointer user_data);
+static void state_changed_cb(GstState old_state, GstState new_state, GstState pending_state, gpointer user_data);
+static void duration_changed_cb(gpointer user_data);
+static void async_done_cb(gpointer user_data);
+static void segment_done_cb(GstFormat format, gint64 position, gpointer user_data);
+
+static const BusDispatcherCallbacks bus_callbacks = {
+    error_cb, eos_cb, state_changed_cb, duration_changed_cb, async_done_cb, segment_done_cb
+};
+
+/* Set from the indexing thread once the keyframe index of a local file is ready */
+static KeyframeIndex *keyframes = NULL;
+
+static void keyframe_index_ready_cb(KeyframeIndex *index, gpointer user_data);
+
+/* Command line options */
+static gchar *uri = NULL;
+static gchar *decode = NULL;
+static gdouble scan_rate = 0.0;
+static gboolean scan_naive = FALSE;
+static gint scan_seconds = 10;
+static gboolean scan_compare_mode = FALSE;
+static gboolean loop = FALSE;
+static gdouble loop_start = 0.0;
+static gdouble loop_end = -1.0;
+static gint loops = 0;
+
+static GOptionEntry entries[] = {
+    { "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play instead of the tutorial's trailer", "URI" },
+    { "scan", 0, 0, G_OPTION_ARG_DOUBLE, &scan_rate,
+      "Scan at RATE (8, 64, -16...) with keyframes only, instead of seeking at 10 s. Negative rates scan back from the end", "RATE" },
+    { "scan-naive", 0, 0, G_OPTION_ARG_NONE, &scan_naive,
+      "Scan by plain playback at the rate: every frame is decoded", NULL },
+    { "scan-seconds", 0, 0, G_OPTION_ARG_INT, &scan_seconds, "Stop scanning after S seconds (default 10)", "S" },
+    { "scan-compare", 0, 0, G_OPTION_ARG_NONE, &scan_compare_mode,
+      "Run the scan with keyframes only and by plain playback, and compare their speed and CPU cost", NULL },
+    { "loop", 'l', 0, G_OPTION_ARG_NONE, &loop,
+      "Loop without gaps: SEGMENT seeks, each one queued as the previous segment ends, instead of the seek at 10 s", NULL },
+    { "loop-start", 0, 0, G_OPTION_ARG_DOUBLE, &loop_start, "Start of the loop, in seconds (default 0)", "S" },
+    { "loop-end", 0, 0, G_OPTION_ARG_DOUBLE, &loop_end, "End of the loop, in seconds (default: the end of the file)", "S" },
+    { "loops", 0, 0, G_OPTION_ARG_INT, &loops, "Stop after N loops (default 0: loop forever)", "N" },
+    { "decode", 'd', 0, G_OPTION_ARG_STRING, &decode,
+      "Streams to decode: both, video or audio. The others are never decoded (default: both)", "KIND" },
+    { NULL }
+};
 
 int 
 main(int argc, char* argv[])
 {
     CustomData data;
-    GstBus *bus;
-    GstMessage *msg;
     GstStateChangeReturn ret;
+    GOptionContext *context;
+    GError *err = NULL;
+    StreamDecode decode_mode;
+    PositionTrackerStats position_stats;
+    gchar *local_path;
     
     data.playing = FALSE;
     data.terminate = FALSE;
     data.seek_enabled = FALSE;
     data.seek_done = FALSE;
-    data.duration = GST_CLOCK_TIME_NONE;
+    data.scan_pending = FALSE;
+    data.scan_measuring = FALSE;
+    data.scan_last_position = -1;
+    data.keyframe_filter = NULL;
+    data.loops_done = 0;
+    for (gint kind = 0; kind < STREAM_KIND_COUNT; kind++)
+    {
+        LoopWatch *watch = &data.loop_watch[kind];
+
+        watch->name = kind == STREAM_KIND_VIDEO ? "video" : "audio";
+        watch->pipeline = NULL;
+        watch->has_segment = FALSE;
+        watch->boundary = FALSE;
+        watch->last_end = GST_CLOCK_TIME_NONE;
+        watch->last_duration = 0;
+        watch->loops = 0;
+        watch->max_gap = 0.0;
+        watch->min_slack = G_MAXDOUBLE;
+    }
+    g_mutex_init(&data.lock);
+    g_cond_init(&data.terminated);
+
+    /* Parse our own options. GStreamer's ones are left in argv for gst_init */
+    context = g_option_context_new("- time management tutorial");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_set_ignore_unknown_options(context, TRUE);
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (!stream_decode_from_string(decode != NULL ? decode : "both", &decode_mode))
+    {
+        g_printerr("Unknown --decode '%s', expected both, video or audio.\n", decode);
+        return -1;
+    }
+
+    if (scan_rate != 0.0 && ABS(scan_rate) < 2.0)
+    {
+        g_printerr("--scan expects a rate of at least 2 or at most -2.\n");
+        return -1;
+    }
+    if (scan_compare_mode)
+        return scan_compare(argv[0]);
+    if (loop && scan_rate != 0.0)
+    {
+        g_printerr("--loop and --scan cannot be combined.\n");
+        return -1;
+    }
+    if (loop && (loop_start < 0.0 || (loop_end >= 0.0 && loop_end <= loop_start)))
+    {
+        g_printerr("--loop-end must come after --loop-start.\n");
+        return -1;
+    }
 
     /* Initialize GStreamer */
     std::cout << "Init gst\n";
+    static_plugins_prepare();
     gst_init(&argc, &argv);
+    static_plugins_register();
 
     /* Create the elements */
     std::cout << "Create elements\n";
     data.source = gst_element_factory_make("uridecodebin", "source");
-    data.video_convert = gst_element_factory_make("videoconvert", "video_convert");
-    data.audio_convert = gst_element_factory_make("audioconvert", "audio_convert");
-    data.resample = gst_element_factory_make("audioresample", "resample");
-    data.video_sink = gst_element_factory_make("autovideosink", "video_sink");
-    data.audio_sink = gst_element_factory_make("autoaudiosink", "audio_sink");
 
     /* Create the empty pipeline */
     std::cout << "Create the empty pipeline\n";
@@ -65,316 +216,538 @@ main(int argc, char* argv[])
     if (check_error_elements_created(data) == TRUE)
         return -1;
 
-    /* Build the pipeline. We are NOT linking the source at this
-     * point. We will do it later. 
-     */
+    /* Build the pipeline. The source is linked later, one branch per stream.
+     * One branch of each kind we decode is built in the background meanwhile */
     std::cout << "Build the pipeline without link\n";
-    gst_bin_add_many(GST_BIN(data.pipeline), 
-                    data.source,
-                    data.video_convert,
-                    data.video_sink,
-                    data.audio_convert, 
-                    data.resample,
-                    data.audio_sink,
-                    NULL);
-
-    gboolean retval = gst_element_link_many(data.video_convert, data.video_sink, NULL);
-    if (retval == FALSE)
-    {
-        g_printerr("Elements in video chain could not be linked.\n");
-        gst_object_unref(data.pipeline);
-        return -1;
-    }
+    gst_bin_add(GST_BIN(data.pipeline), data.source);
+    data.router = stream_router_new(data.pipeline,
+                                    decode_mode != STREAM_DECODE_AUDIO ? 1 : 0,
+                                    decode_mode != STREAM_DECODE_VIDEO ? 1 : 0,
+                                    loop ? stream_linked_handler : NULL, &data);
+    stream_router_set_decode(data.router, decode_mode);
+
+    /* Set the URI to play */
+    if (uri == NULL)
+        uri = g_strdup("https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm");
+    g_object_set(data.source, "uri", uri, NULL);
 
-    retval = gst_element_link_many(data.audio_convert, data.resample, data.audio_sink, NULL);
-    if (retval == FALSE)
+    /* Local files get a keyframe index, read from the cache or built while we play */
+    local_path = file_cache_local_path(uri);
+    if (local_path != NULL)
     {
-        g_printerr("Elements audio chain could not be linked.\n");
-        gst_object_unref(data.pipeline);
-        return -1;
+        keyframe_index_open_async(local_path, keyframe_index_ready_cb, NULL);
+        g_free(local_path);
     }
     
+    /* Let the router link the source's pads as they appear */
+    stream_router_attach(data.router, data.source);
 
-    /* Set the URI to play */
-    g_object_set(data.source, "uri", "https://www.freedesktop.org/software/gstreamer-sdk/data/media/sintel_trailer-480p.webm", NULL);
-    
-    /* Connect to the pad-added signal */
-    g_signal_connect(data.source, "pad-added", G_CALLBACK(pad_added_handler), &data);
+    /* The decoders are plugged by uridecodebin, the filter watches for them.
+     * It lets every frame through until the scan starts */
+    if (scan_rate != 0.0)
+        data.keyframe_filter = keyframe_filter_new(data.pipeline, KEYFRAME_FILTER_PASS);
+
+    /* Check the extrapolated position against a real query every 5 s */
+    data.position = position_tracker_new(data.pipeline, 5 * GST_SECOND, 20 * GST_MSECOND);
+
+    /* Handle the bus from now on */
+    data.bus_dispatcher = bus_dispatcher_new(data.pipeline, &bus_callbacks, &data);
 
     /* Start playing */
     ret = gst_element_set_state(data.pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE)
     {
         g_printerr("Unable to set the pipeline to the playing state.\n");
+        gst_element_set_state(data.pipeline, GST_STATE_NULL);
+        bus_dispatcher_free(data.bus_dispatcher);
+        position_tracker_free(data.position);
+        stream_router_free(data.router);
+        if (data.keyframe_filter != NULL)
+            keyframe_filter_free(data.keyframe_filter);
         gst_object_unref(data.pipeline);
         return -1;
     }
 
-    /* Listen to the bus */
-    bus = gst_element_get_bus(data.pipeline);
-    do 
+    /* The bus is handled by the dispatcher's thread. This one only wakes up
+     * every 100 ms to refresh the position, or when told to terminate */
+    g_mutex_lock(&data.lock);
+    while (!g_atomic_int_get(&data.terminate))
     {
-        msg = gst_bus_timed_pop_filtered(bus, 100 * GST_MSECOND,
-            (GstMessageType)(   GST_MESSAGE_STATE_CHANGED |
-                                GST_MESSAGE_ERROR         | 
-                                GST_MESSAGE_EOS           |
-                                GST_MESSAGE_DURATION       ));
-        
-        /* Parse message */
-        if (msg != NULL)
-        {
-            handle_message(&data, msg);
-        }
-        else
-        {
-            /* We got no message, this means that timeout expired */
-            if (data.playing)
-            {
-                gint64 current = -1;
-
-                /* Query the current position of the stream */
-                if (!gst_element_query_position(data.pipeline, GST_FORMAT_TIME, &current))
-                {
-                    g_printerr("Could not query position.\n");
-                }
-
-                /* If we didn't know the duration yet, query the stream duration */
-                if (!GST_CLOCK_TIME_IS_VALID(data.duration))
-                {
-                    if (!gst_element_query_duration(data.pipeline, GST_FORMAT_TIME, &data.duration))
-                    {
-                        g_printerr("Could not query current duration.\n");
-                    }
-                }
-
-                /* Print current position and total duration */
-                g_print("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r",
-                    GST_TIME_ARGS(current), GST_TIME_ARGS(data.duration));
-                
-                /* If seeking is enabled, we have not done it yet, and the time is right, seek */
-                if (data.seek_enabled && !data.seek_done && current > 10 * GST_SECOND)
-                {
-                    g_print("\nReached 10s, performing seek to %" GST_TIME_FORMAT "...\n",
-                        GST_TIME_ARGS(data.duration - 2 * GST_SECOND));
-                    gst_element_seek_simple(data.pipeline, GST_FORMAT_TIME, 
-                        (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), data.duration - 2 * GST_SECOND);
-                        data.seek_done = TRUE;
-                }
-            }
-        }
-    } while (!data.terminate);
+        gint64 deadline = g_get_monotonic_time() + 100 * G_TIME_SPAN_MILLISECOND;
+
+        if (g_cond_wait_until(&data.terminated, &data.lock, deadline))
+            continue;
+        g_mutex_unlock(&data.lock);
+        if (g_atomic_int_get(&data.playing))
+            refresh_position(&data);
+        g_mutex_lock(&data.lock);
+    }
+    g_mutex_unlock(&data.lock);
+
+    if (g_atomic_int_get(&data.scan_measuring))
+        print_scan_result(&data);
 
     /* Free resources */
-    gst_object_unref(bus);
     gst_element_set_state(data.pipeline, GST_STATE_NULL);
+
+    /* The streaming threads are stopped, the loop watches can be read */
+    if (loop)
+    {
+        g_print("\nLoops queued without a flush: %d\n", g_atomic_int_get(&data.loops_done));
+        for (gint kind = 0; kind < STREAM_KIND_COUNT; kind++)
+        {
+            LoopWatch *watch = &data.loop_watch[kind];
+
+            if (watch->loops > 0)
+                g_print("  %s: largest gap %.3f ms, least slack %.1f ms over %u loops\n",
+                    watch->name, watch->max_gap, watch->min_slack, watch->loops);
+        }
+    }
+
+    bus_dispatcher_free(data.bus_dispatcher);
+    position_tracker_get_stats(data.position, &position_stats);
+    g_print("\nPosition reads: %u, real queries: %u, drift corrections: %u\n",
+        position_stats.reads, position_stats.queries, position_stats.corrections);
+    position_tracker_free(data.position);
+    stream_router_free(data.router);
+    if (data.keyframe_filter != NULL)
+        keyframe_filter_free(data.keyframe_filter);
     gst_object_unref(data.pipeline);
+    g_cond_clear(&data.terminated);
+    g_mutex_clear(&data.lock);
+    if (g_atomic_pointer_get(&keyframes) != NULL)
+        keyframe_index_free((KeyframeIndex *)g_atomic_pointer_get(&keyframes));
+    g_free(uri);
+    g_free(decode);
     return 0;
 }
 
-/* This is the definition of the callback funcion for when the pad is added */
-static void pad_added_handler(GstElement *src, GstPad *new_pad, CustomData *data)
+static bool check_error_elements_created(CustomData &data)
 {
-    GstPad *sink_pad = NULL;
-    GstPadLinkReturn ret;
-    GstCaps *new_pad_caps = NULL;
-    GstStructure *new_pad_struct = NULL;
-    const gchar *new_pad_type = NULL;
+    bool err_detected = false;
+    if (data.pipeline == nullptr)
+    {
+        g_printerr("Pipeline element could not be created. \n");
+        err_detected = true;
+    }
+    if (data.source == nullptr)
+    {
+        g_printerr("Source element could not be created. \n");
+        err_detected = true;
+    }
+    return err_detected;
+}
 
-    g_print("Received new pad '%s' from '%s': \n", GST_PAD_NAME(new_pad), GST_ELEMENT_NAME(src));
+static void refresh_position(CustomData *data)
+{
+    gint64 current = -1;
+    gint64 duration = GST_CLOCK_TIME_NONE;
 
-    /* Check the new pad's type and Attempt the link */
-    new_pad_caps = gst_pad_get_current_caps(new_pad);
-    new_pad_struct = gst_caps_get_structure(new_pad_caps, 0);
-    new_pad_type = gst_structure_get_name(new_pad_struct);
+    /* Extrapolated from the last real query */
+    if (!position_tracker_get_position(data->position, &current))
+    {
+        g_printerr("Could not query position.\n");
+    }
 
-    if (g_str_has_prefix(new_pad_type, "video/x-raw"))
+    /* Queried again only after the duration changed */
+    if (!position_tracker_get_duration(data->position, &duration))
     {
-        std::cout << "Linking video pads\n";
-        sink_pad = gst_element_get_compatible_pad(data->video_convert, new_pad, new_pad_caps);
+        g_printerr("Could not query current duration.\n");
+    }
 
-        /* Try to get info on the compatible pad */
-        retrive_pad_info(sink_pad);
+    /* Print current position and total duration */
+    g_print("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r",
+        GST_TIME_ARGS(current), GST_TIME_ARGS(duration));
 
-        if (gst_pad_is_linked(sink_pad))
+    /* In loop mode the loop replaces the seek */
+    if (loop)
+    {
+        if (g_atomic_int_get(&data->seek_enabled) && !data->seek_done && GST_CLOCK_TIME_IS_VALID(duration))
         {
-            g_print("Video pad already linked. Ignoring...\n");
-            goto exit;
+            start_loop(data);
+            data->seek_done = TRUE;
         }
-        ret = gst_pad_link(new_pad, sink_pad);
+        return;
     }
-    else if (g_str_has_prefix(new_pad_type, "audio/x-raw"))
-    {
-        std::cout << "Linking audio pads\n";
-        sink_pad = gst_element_get_compatible_pad(data->audio_convert, new_pad, new_pad_caps);
-
-        /* Try to get info on the compatible pad */
-        retrive_pad_info(sink_pad);
 
-        if (gst_pad_is_linked(sink_pad))
+    /* In scan mode the scan replaces the seek, and ends the run after --scan-seconds */
+    if (scan_rate != 0.0)
+    {
+        if (g_atomic_int_get(&data->seek_enabled) && !data->seek_done && GST_CLOCK_TIME_IS_VALID(duration))
         {
-            g_print("Audio pad already linked. Ignoring...\n");
-            goto exit;
+            start_scan(data, current, duration);
+            data->seek_done = TRUE;
         }
-        ret = gst_pad_link(new_pad, sink_pad);
-    }
-    else
-    {
-        g_print("It has type '%s' which is not necessary. Ignoring...\n", new_pad_type);
-        goto exit;
+        else if (g_atomic_int_get(&data->scan_measuring))
+        {
+            data->scan_last_position = current;
+            if (g_get_monotonic_time() - data->scan_start.wall_time >= scan_seconds * G_USEC_PER_SEC)
+                request_terminate(data);
+        }
+        return;
     }
 
-    if (GST_PAD_LINK_FAILED(ret))
-    {
-        g_print("Type is '%s' but link failed. \n", new_pad_type);
-    }
-    else
+    /* If seeking is enabled, we have not done it yet, and the time is right, seek */
+    if (g_atomic_int_get(&data->seek_enabled) && !data->seek_done && current > 10 * GST_SECOND &&
+        GST_CLOCK_TIME_IS_VALID(duration))
     {
-        g_print("Link succeeded (type '%s'). \n", new_pad_type);
-    }
+        KeyframeIndex *index = (KeyframeIndex *)g_atomic_pointer_get(&keyframes);
+        gint64 target = duration - 2 * GST_SECOND;
 
-exit:
-    /* Unreference the new pad's caps, if we got them */
-    if (new_pad_caps != NULL)
-    {
-        gst_caps_unref(new_pad_caps);
+        /* Land on the keyframe before the target: decoding starts right
+         * there, nothing is decoded only to be dropped. With the index we
+         * know which keyframe that is before seeking */
+        if (index != NULL)
+        {
+            GstClockTime keyframe = keyframe_index_lookup(index, target);
+
+            g_print("\nReached 10s, performing seek to %" GST_TIME_FORMAT ", landing on the keyframe at %"
+                GST_TIME_FORMAT "...\n", GST_TIME_ARGS(target), GST_TIME_ARGS(keyframe));
+            target = keyframe;
+        }
+        else
+        {
+            g_print("\nReached 10s, performing seek to %" GST_TIME_FORMAT "...\n", GST_TIME_ARGS(target));
+        }
+        gst_element_seek_simple(data->pipeline, GST_FORMAT_TIME,
+            (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE), target);
+        position_tracker_invalidate(data->position);
+        data->seek_done = TRUE;
     }
+}
+
+static void start_scan(CustomData *data, gint64 current, gint64 duration)
+{
+    GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+
+    /* Keyframes only, and no audio to decode and clip at this speed. The
+     * decoders are also told to skip delta frames by the keyframe filter, in
+     * case the demuxer sends them anyway */
+    if (!scan_naive)
+        flags = (GstSeekFlags)(flags | GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS |
+                               GST_SEEK_FLAG_TRICKMODE_NO_AUDIO);
+
+    g_print("\nScanning at %.1fx %s...\n", scan_rate, scan_naive ? "by plain playback" : "with keyframes only");
+    keyframe_filter_set_mode(data->keyframe_filter, scan_naive ? KEYFRAME_FILTER_COUNT : KEYFRAME_FILTER_DROP);
+    g_atomic_int_set(&data->scan_pending, TRUE);
+
+    /* Forward from here, or backward from the end */
+    if (scan_rate > 0)
+        gst_element_seek(data->pipeline, scan_rate, GST_FORMAT_TIME, flags,
+            GST_SEEK_TYPE_SET, current, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+    else
+        gst_element_seek(data->pipeline, scan_rate, GST_FORMAT_TIME, flags,
+            GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, duration);
+    position_tracker_invalidate(data->position);
+}
 
-    /* Unreference the sink pads */
-    if (sink_pad != nullptr)
-        gst_object_unref(sink_pad);
+static void print_scan_result(CustomData *data)
+{
+    ProcessStats now;
+    KeyframeFilterStats frames;
+    gdouble media, wall, cpu;
+
+    process_stats_sample(&now);
+    keyframe_filter_get_stats(data->keyframe_filter, &frames);
+    media = (gdouble)ABS(data->scan_last_position - data->scan_start_position) / GST_SECOND;
+    wall = (gdouble)(now.wall_time - data->scan_start.wall_time) / G_USEC_PER_SEC;
+    cpu = (gdouble)(now.cpu_time - data->scan_start.cpu_time) / G_USEC_PER_SEC;
+
+    /* Parsed by --scan-compare, keep the format in sync with run_scan_child() */
+    g_print("\nScan %s at %.1fx: %.1f s of media in %.2f s = %.2fx, CPU %.3f s/s, %d frames decoded, %d skipped\n",
+        scan_naive ? "naive" : "trick", scan_rate, media, wall, wall > 0 ? media / wall : 0.0,
+        wall > 0 ? cpu / wall : 0.0, frames.decoded, frames.skipped);
 }
 
-static bool check_error_elements_created(CustomData &data)
+/* Runs this program with the given scan mode and reads its result line */
+static gboolean run_scan_child(const gchar *self, gboolean naive, gdouble *speed, gdouble *cpu, gint *decoded)
 {
-    bool err_detected = false;
-    if (data.pipeline == nullptr)
+    gchar rate[G_ASCII_DTOSTR_BUF_SIZE], seconds[16];
+    const gchar *argv[12] = { self, "--scan", g_ascii_dtostr(rate, sizeof(rate), scan_rate),
+                              "--scan-seconds", NULL };
+    gint n_args = 4;
+    gchar *out = NULL;
+    gchar **lines;
+    gint status;
+    gboolean found = FALSE;
+    GError *err = NULL;
+
+    g_snprintf(seconds, sizeof(seconds), "%d", scan_seconds);
+    argv[n_args++] = seconds;
+    if (uri != NULL)
     {
-        g_printerr("Pipeline element could not be created. \n");
-        err_detected = true;
+        argv[n_args++] = "--uri";
+        argv[n_args++] = uri;
     }
-    if (data.source == nullptr)
+    if (decode != NULL)
     {
-        g_printerr("Source element could not be created. \n");
-        err_detected = true;
+        argv[n_args++] = "--decode";
+        argv[n_args++] = decode;
     }
-    if (data.video_convert == nullptr)
+    if (naive)
+        argv[n_args++] = "--scan-naive";
+
+    if (!g_spawn_sync(NULL, (gchar **)argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, &out, NULL, &status, &err))
     {
-        g_printerr("Video convert element could not be created. \n");
-        err_detected = true;
+        g_printerr("Could not run %s: %s\n", self, err->message);
+        g_clear_error(&err);
+        return FALSE;
     }
-    if (data.audio_convert == nullptr)
+
+    lines = g_strsplit(out, "\n", -1);
+    for (gchar **line = lines; *line != NULL && !found; line++)
     {
-        g_printerr("Audio convert element could not be created. \n");
-        err_detected = true;
+        gchar mode[16];
+        gdouble r, media, wall;
+        gint skipped;
+
+        found = sscanf(*line, "Scan %15s at %lfx: %lf s of media in %lf s = %lfx, CPU %lf s/s, %d frames decoded, %d skipped",
+                       mode, &r, &media, &wall, speed, cpu, decoded, &skipped) == 8;
     }
-    if (data.resample == nullptr)
+    if (!found)
+        g_printerr("The %s scan did not report a result.\n", naive ? "naive" : "trick");
+    g_strfreev(lines);
+    g_free(out);
+    return found;
+}
+
+static int scan_compare(const gchar *self)
+{
+    gdouble trick_speed, trick_cpu, naive_speed, naive_cpu;
+    gint trick_decoded, naive_decoded;
+
+    if (scan_rate == 0.0)
     {
-        g_printerr("Resample element could not be created. \n");
-        err_detected = true;
+        g_printerr("--scan-compare needs --scan RATE.\n");
+        return -1;
     }
-    if (data.video_sink == nullptr)
+    if (!run_scan_child(self, FALSE, &trick_speed, &trick_cpu, &trick_decoded) ||
+        !run_scan_child(self, TRUE, &naive_speed, &naive_cpu, &naive_decoded))
+        return -1;
+
+    g_print("%-8s %12s %12s %16s %16s\n", "scan", "speed", "CPU s/s", "CPU s/media s", "frames decoded");
+    g_print("%-8s %11.2fx %12.3f %16.4f %16d\n", "trick", trick_speed, trick_cpu,
+        trick_speed > 0 ? trick_cpu / trick_speed : 0.0, trick_decoded);
+    g_print("%-8s %11.2fx %12.3f %16.4f %16d\n", "naive", naive_speed, naive_cpu,
+        naive_speed > 0 ? naive_cpu / naive_speed : 0.0, naive_decoded);
+    return 0;
+}
+
+/* Seeks to the loop range. A SEGMENT seek ends with SEGMENT_DONE instead of EOS,
+ * and leaves the pipeline running so the next loop can be queued behind it.
+ * The last of --loops is a plain seek, so the run ends with EOS once it played */
+static void loop_seek(CustomData *data, GstSeekFlags flags, gboolean last)
+{
+    GstClockTime start = (GstClockTime)(loop_start * GST_SECOND);
+
+    if (!last)
+        flags = (GstSeekFlags)(flags | GST_SEEK_FLAG_SEGMENT);
+    gst_element_seek(data->pipeline, 1.0, GST_FORMAT_TIME,
+        (GstSeekFlags)(flags | GST_SEEK_FLAG_ACCURATE),
+        GST_SEEK_TYPE_SET, start,
+        loop_end >= 0.0 ? GST_SEEK_TYPE_SET : GST_SEEK_TYPE_NONE,
+        loop_end >= 0.0 ? (GstClockTime)(loop_end * GST_SECOND) : GST_CLOCK_TIME_NONE);
+}
+
+static void start_loop(CustomData *data)
+{
+    g_print("\nLooping from %.3f s to ", loop_start);
+    if (loop_end >= 0.0)
+        g_print("%.3f s\n", loop_end);
+    else
+        g_print("the end\n");
+
+    /* Only the first one flushes, to get into the range */
+    loop_seek(data, GST_SEEK_FLAG_FLUSH, loops == 1);
+    position_tracker_invalidate(data->position);
+}
+
+/* Measures, per stream, the running time gap between the end of a loop and
+ * the start of the next, and how early the next one arrived compared to
+ * when it has to be rendered. A gap or a late arrival is visible or audible */
+static GstPadProbeReturn loop_watch_cb(GstPad *pad, GstPadProbeInfo *info, LoopWatch *watch)
+{
+    if (!(info->type & GST_PAD_PROBE_TYPE_BUFFER))
     {
-        g_printerr("Video sink element could not be created. \n");
-        err_detected = true;
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+        if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+        {
+            watch->has_segment = FALSE;
+            watch->boundary = FALSE;
+            watch->last_end = GST_CLOCK_TIME_NONE;
+        }
+        else if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+        {
+            /* Without a flush in between, a new segment is the next loop */
+            watch->boundary = watch->has_segment && GST_CLOCK_TIME_IS_VALID(watch->last_end);
+            gst_event_copy_segment(event, &watch->segment);
+            watch->has_segment = TRUE;
+
+            /* The position wraps to the loop start here, which no
+             * extrapolation from the previous loop can follow */
+            if (watch->boundary)
+                position_tracker_invalidate(watch->position);
+        }
+        return GST_PAD_PROBE_OK;
     }
-    if (data.audio_sink == nullptr)
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime start, end, duration;
+
+    if (!watch->has_segment || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    if (GST_BUFFER_DURATION_IS_VALID(buffer))
+        watch->last_duration = GST_BUFFER_DURATION(buffer);
+    duration = watch->last_duration;
+    start = gst_segment_to_running_time(&watch->segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    end = gst_segment_to_running_time(&watch->segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer) + duration);
+    if (!GST_CLOCK_TIME_IS_VALID(start))
+        return GST_PAD_PROBE_OK;
+
+    if (watch->boundary)
     {
-        g_printerr("Audio sink element could not be created. \n");
-        err_detected = true;
+        gdouble gap = (gdouble)GST_CLOCK_DIFF(watch->last_end, start) / GST_MSECOND;
+        gdouble slack = 0.0;
+        GstClock *clock = gst_element_get_clock(watch->pipeline);
+
+        if (clock != NULL)
+        {
+            GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(watch->pipeline);
+
+            slack = (gdouble)GST_CLOCK_DIFF(now, start) / GST_MSECOND;
+            gst_object_unref(clock);
+        }
+
+        g_print("\nLoop %u, %s: gap %.3f ms, arrived %.1f ms before it is due\n",
+            watch->loops + 1, watch->name, gap, slack);
+        watch->max_gap = MAX(watch->max_gap, ABS(gap));
+        watch->min_slack = MIN(watch->min_slack, slack);
+        watch->loops++;
+        watch->boundary = FALSE;
     }
-    return err_detected;
+    if (GST_CLOCK_TIME_IS_VALID(end))
+        watch->last_end = end;
+    return GST_PAD_PROBE_OK;
 }
 
-static void retrive_pad_info(GstPad *pad)
+static void stream_linked_handler(GstPad *pad, GstElement *branch, StreamKind kind, guint index, gpointer user_data)
 {
-    GstCaps *pad_caps = nullptr;
-    GstStructure *pad_struct = nullptr;
-    const gchar *pad_type = nullptr;
+    CustomData *data = (CustomData *)user_data;
 
-    std::cout << "Trying to retrieve pad info about "<< GST_PAD_NAME(pad) << " pad\n";
+    /* The first stream of each kind is enough to hear or see a gap */
+    if (index != 0)
+        return;
 
-    if (gst_pad_has_current_caps(pad))
-    {
-            pad_caps = gst_pad_get_current_caps(pad);
-            pad_struct = gst_caps_get_structure(pad_caps, 0);
-            pad_type = gst_structure_get_name(pad_struct);
-            std::cout << "Compatible pad name is " << pad_type << "\n"; 
-    }
-    else
+    data->loop_watch[kind].pipeline = data->pipeline;
+    data->loop_watch[kind].position = data->position;
+    gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+                                             GST_PAD_PROBE_TYPE_EVENT_FLUSH),
+        (GstPadProbeCallback)loop_watch_cb, &data->loop_watch[kind], NULL);
+}
+
+static void keyframe_index_ready_cb(KeyframeIndex *index, gpointer user_data)
+{
+    if (index == NULL)
+        return;
+    g_print("\nKeyframe index ready: %u keyframes\n", keyframe_index_get_size(index));
+    g_atomic_pointer_set(&keyframes, index);
+}
+
+static void request_terminate(CustomData *data)
+{
+    g_mutex_lock(&data->lock);
+    g_atomic_int_set(&data->terminate, TRUE);
+    g_cond_signal(&data->terminated);
+    g_mutex_unlock(&data->lock);
+}
+
+static void error_cb(GstObject *src, const GError *err, const gchar *debug_info, gpointer user_data)
+{
+    g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(src), err->message);
+    g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
+    request_terminate((CustomData *)user_data);
+}
+
+static void eos_cb(gpointer user_data)
+{
+    g_print("End-Of-Stream reached.\n");
+    request_terminate((CustomData *)user_data);
+}
+
+static void duration_changed_cb(gpointer user_data)
+{
+    CustomData *data = (CustomData *)user_data;
+
+    position_tracker_invalidate(data->position);
+}
+
+static void async_done_cb(gpointer user_data)
+{
+    CustomData *data = (CustomData *)user_data;
+
+    /* A seek completed: the position jumped */
+    position_tracker_invalidate(data->position);
+
+    /* The scan starts where its seek landed */
+    if (g_atomic_int_compare_and_exchange(&data->scan_pending, TRUE, FALSE))
     {
-        std::cout << "No current caps for "<< GST_PAD_NAME(pad) << " pad\n";
+        if (!gst_element_query_position(data->pipeline, GST_FORMAT_TIME, &data->scan_start_position))
+            data->scan_start_position = 0;
+        process_stats_sample(&data->scan_start);
+        keyframe_filter_reset_stats(data->keyframe_filter);
+        g_atomic_int_set(&data->scan_measuring, TRUE);
     }
 }
 
-static void handle_message(CustomData *data, GstMessage *msg)
+static void segment_done_cb(GstFormat format, gint64 position, gpointer user_data)
+{
+    CustomData *data = (CustomData *)user_data;
+    gint done = g_atomic_int_add(&data->loops_done, 1) + 1;
+
+    /* The sinks still have the end of this loop queued: a seek without a
+     * flush appends the next loop behind it */
+    loop_seek(data, GST_SEEK_FLAG_NONE, loops > 0 && done + 1 >= loops);
+}
+
+static void state_changed_cb(GstState old_state, GstState new_state, GstState pending_state, gpointer user_data)
 {
-    GError *err;
-    gchar *debug_info;
+    CustomData *data = (CustomData *)user_data;
+    gboolean playing = (new_state == GST_STATE_PLAYING);
+
+    g_print("Pipeline state changed from %s to %s:\n",
+        gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
 
-    switch (GST_MESSAGE_TYPE(msg)) 
+    /* Remember wheter we are in the PLAYING state or not */
+    g_atomic_int_set(&data->playing, playing);
+    position_tracker_invalidate(data->position);
+
+    if (playing)
     {
-        case GST_MESSAGE_ERROR:
-        gst_message_parse_error(msg, &err, &debug_info);
-        g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
-        g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
-        g_clear_error(&err);
-        g_free(debug_info);
-        data->terminate = TRUE;
-        break;
-
-        case GST_MESSAGE_EOS:
-        g_print("End-Of-Stream reached.\n");
-        data->terminate = TRUE;
-        break;
-
-        case GST_MESSAGE_DURATION:
-        /* The duration has changed, mark the current one as invalid */
-        data->duration = GST_CLOCK_TIME_NONE;
-        break;
-
-        case GST_MESSAGE_STATE_CHANGED:
-        /* We are only interested in state-changed messages from the pipeline */
-        if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data->pipeline)) {
-            GstState old_state, new_state, pending_state;
-            gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
-            g_print("Pipeline state changed from %s to %s:\n",
-                gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
-        
-            /* Remember wheter we are in the PLAYING state or not */
-            data->playing = (new_state == GST_STATE_PLAYING);
-
-            if (data->playing)
+        /* We just moved to PLAYING. Check if seeking is possible */
+        GstQuery *query;
+        gint64 start, end;
+        gboolean seek_enabled;
+
+        query = gst_query_new_seeking(GST_FORMAT_TIME);
+        if (gst_element_query(data->pipeline, query))
+        {
+            gst_query_parse_seeking(query, NULL, &seek_enabled, &start, &end);
+            g_atomic_int_set(&data->seek_enabled, seek_enabled);
+            if (seek_enabled)
+            {
+                g_print("Seeking is ENABLED from %" GST_TIME_FORMAT "to %" GST_TIME_FORMAT "\n",
+                    GST_TIME_ARGS(start), GST_TIME_ARGS(end));
+            }
+            else
             {
-                /* We just moved to PLAYING. Check if seeking is possible */
-                GstQuery *query;
-                gint64 start, end;
-                query = gst_query_new_seeking(GST_FORMAT_TIME);
-                if (gst_element_query(data->pipeline, query))
-                {
-                    gst_query_parse_seeking(query, NULL, &data->seek_enabled, &start, &end);
-                    if (data->seek_enabled)
-                    {
-                        g_print("Seeking is ENABLED from %" GST_TIME_FORMAT "to %" GST_TIME_FORMAT "\n",
-                            GST_TIME_ARGS(start), GST_TIME_ARGS(end));
-                    }
-                    else
-                    {
-                        g_print("Seeking is DISABLED for this stream.\n");
-                    }
-                }
-                else
-                {
-                    g_printerr("Seeking query failed.\n");
-                }
-                gst_query_unref(query);
+                g_print("Seeking is DISABLED for this stream.\n");
             }
         }
-        break;
-
-        default:
-        /* We should not reach here */
-        g_printerr("Unexpected message received.\n");
-        break;
+        else
+        {
+            g_printerr("Seeking query failed.\n");
+        }
+        gst_query_unref(query);
     }
-    gst_message_unref(msg);
-}
\ No newline at end of file
+}
@@ -0,0 +1,137 @@
+#include <vector>
+
+#include <gst/gst.h>
+
+#include "MediaInfoCache.h"
+
+/* Totals of the scan, updated by the workers */
+typedef struct _ScanTotals {
+    GMutex lock;
+    guint cached;
+    guint discovered;
+    guint failed;
+} ScanTotals;
+
+/* Command line options */
+static gint jobs = 0;
+static gboolean force = FALSE;
+static gboolean print = FALSE;
+static gint timeout = 10;
+static gchar **inputs = NULL;
+
+static GOptionEntry entries[] = {
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Files discovered at once (default 0: one per two cores)", "N" },
+    { "force", 'f', 0, G_OPTION_ARG_NONE, &force, "Discover the files again even if they are cached", NULL },
+    { "print", 'p', 0, G_OPTION_ARG_NONE, &print, "Print what is known about every file", NULL },
+    { "timeout", 't', 0, G_OPTION_ARG_INT, &timeout, "Seconds the discovery of one file may take (default 10)", "S" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &inputs, NULL, "FILE|DIR..." },
+    { NULL }
+};
+
+/* Adds path, or the regular files below it if it is a directory */
+static void collect(const gchar *path, std::vector<gchar *> &files)
+{
+    GDir *dir;
+    const gchar *name;
+
+    if (!g_file_test(path, G_FILE_TEST_IS_DIR))
+    {
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+            files.push_back(g_strdup(path));
+        return;
+    }
+
+    dir = g_dir_open(path, 0, NULL);
+    if (dir == NULL)
+        return;
+    while ((name = g_dir_read_name(dir)) != NULL)
+    {
+        gchar *child = g_build_filename(path, name, NULL);
+
+        collect(child, files);
+        g_free(child);
+    }
+    g_dir_close(dir);
+}
+
+static void file_done_cb(const gchar *path, const MediaInfo *info, gboolean cached, ScanTotals *totals)
+{
+    g_mutex_lock(&totals->lock);
+    if (info == NULL)
+        totals->failed++;
+    else if (cached)
+        totals->cached++;
+    else
+        totals->discovered++;
+
+    /* Under the lock, so the lines of a file stay together */
+    if (print && info != NULL)
+    {
+        g_print("%s: %" GST_TIME_FORMAT ", %s, %u kbit/s%s\n", path, GST_TIME_ARGS(info->duration),
+            info->seekable ? "seekable" : "not seekable", info->bitrate / 1000, cached ? " (cached)" : "");
+        for (guint i = 0; i < info->n_streams; i++)
+        {
+            const MediaStreamInfo *stream = &info->streams[i];
+
+            g_print("  %s: %s", stream->type, stream->codec != NULL ? stream->codec : "unknown codec");
+            if (stream->language != NULL)
+                g_print(", %s", stream->language);
+            if (stream->bitrate != 0)
+                g_print(", %u kbit/s", stream->bitrate / 1000);
+            g_print("\n");
+        }
+    }
+    g_mutex_unlock(&totals->lock);
+}
+
+int
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    std::vector<gchar *> files;
+    ScanTotals totals = {};
+    gint64 start;
+    gdouble elapsed;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- cache the duration, seekability and streams of a media library");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (inputs == NULL || jobs < 0 || timeout <= 0)
+    {
+        g_printerr("Usage: %s [--jobs N] [--force] [--print] FILE|DIR...\n", argv[0]);
+        return -1;
+    }
+    if (jobs == 0)
+        jobs = MAX(1, g_get_num_processors() / 2);
+
+    for (gchar **input = inputs; *input != NULL; input++)
+        collect(*input, files);
+    files.push_back(NULL);
+
+    g_mutex_init(&totals.lock);
+    start = g_get_monotonic_time();
+    media_info_cache_scan(files.data(), jobs, force, timeout * GST_SECOND,
+                          (MediaInfoScanFunc)file_done_cb, &totals);
+    elapsed = (gdouble)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+    g_print("%zu files in %.2f s (%.1f files/s) with %d workers: %u cached, %u discovered, %u failed\n",
+        files.size() - 1, elapsed, elapsed > 0 ? (files.size() - 1) / elapsed : 0.0, jobs,
+        totals.cached, totals.discovered, totals.failed);
+
+    g_mutex_clear(&totals.lock);
+    for (gchar *file : files)
+        g_free(file);
+    g_strfreev(inputs);
+    return totals.failed > 0 ? 1 : 0;
+}
@@ -5,6 +5,13 @@
 #include <gst/gst.h>
 #include <gst/video/videooverlay.h>
 
+#include "FileCache.h"
+#include "KeyframeIndex.h"
+#include "MediaInfoCache.h"
+#include "PositionTracker.h"
+#include "SeekScheduler.h"
+#include "StaticPlugins.h"
+
 #include <gdk/gdk.h>
 #if defined (GDK_WINDOWING_X11)
 #include <gdk/gdkx.h>
@@ -24,8 +31,22 @@ typedef struct _CustomData {
 
     GstState state;                 /* Current state of the pipeline */
     gint64 duration;                /* Duration of the clip, in nanoseconds */
+    PositionTracker *position;      /* Position without a query every refresh */
+    SeekScheduler *seeks;           /* One slider seek in flight at a time */
+    gboolean dragging;              /* Is the slider's button held down? */
+    KeyframeIndex *keyframes;       /* Set from the indexing thread, NULL until ready */
+    GstClockTime drag_keyframe;     /* Keyframe the last drag seek lands on, NONE if unknown */
+    guint drag_seeks_skipped;       /* Drag seeks that would have shown the same keyframe again */
 } CustomData;
 
+/* Command line options */
+static gchar *uri = NULL;
+
+static GOptionEntry entries[] = {
+    { "uri", 'u', 0, G_OPTION_ARG_STRING, &uri, "URI to play instead of the tutorial's trailer", "URI" },
+    { NULL }
+};
+
 /* This function is called when the GUI toolkit creates the physical window that will hold the video.
  * At this point we can retrieve its handler (which has a different meaning depending on the windowing system)
  * and pass it to GStreamer through the VideoOverlay interface. */
@@ -105,9 +126,113 @@ static gboolean draw_cb(GtkWidget *widget, cairo_t *cr, CustomData *data)
 static void slider_cb(GtkRange *range, CustomData *data)
 {
     gdouble value = gtk_range_get_value(GTK_RANGE(data->slider));
-    gst_element_seek_simple(data->playbin, GST_FORMAT_TIME, 
-                        (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), 
-                        (gint64)(value * GST_SECOND));
+
+    /* Released or moved with the keyboard: land exactly where asked */
+    if (!data->dragging)
+    {
+        seek_scheduler_request(data->seeks, (gint64)(value * GST_SECOND),
+                               (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE));
+    }
+    else
+    {
+        KeyframeIndex *index = (KeyframeIndex *)g_atomic_pointer_get(&data->keyframes);
+        GstClockTime target = (GstClockTime)(value * GST_SECOND);
+
+        /* With the index we know which keyframe the seek lands on. If the last
+         * drag seek already lands there, it would only show the same frame */
+        if (index != NULL)
+        {
+            target = keyframe_index_lookup(index, target);
+            if (target == data->drag_keyframe)
+            {
+                data->drag_seeks_skipped++;
+                return;
+            }
+            data->drag_keyframe = target;
+        }
+
+        /* While dragging only the keyframe before the slider is decoded, it is
+         * the fastest frame to show */
+        seek_scheduler_request(data->seeks, (gint64)target,
+                               (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE));
+    }
+    position_tracker_invalidate(data->position);
+}
+
+/* The slider seeks to keyframes while its button is held down */
+static gboolean slider_press_cb(GtkWidget *widget, GdkEventButton *event, CustomData *data)
+{
+    data->dragging = TRUE;
+    data->drag_keyframe = GST_CLOCK_TIME_NONE;
+    return FALSE;
+}
+
+/* And once exactly where it was released */
+static gboolean slider_release_cb(GtkWidget *widget, GdkEventButton *event, CustomData *data)
+{
+    data->dragging = FALSE;
+    slider_cb(GTK_RANGE(data->slider), data);
+    return FALSE;
+}
+
+/* Called from the indexing thread once the keyframe index of a local file is ready */
+static void keyframe_index_ready_cb(KeyframeIndex *index, CustomData *data)
+{
+    if (index != NULL)
+        g_atomic_pointer_set(&data->keyframes, index);
+}
+
+/* Lays out the slider and the stream list from the media cache, before the
+ * pipeline has prerolled. playbin's own view replaces it once it is known */
+static void show_media_info(CustomData *data, const MediaInfo *info)
+{
+    GtkTextBuffer *text = gtk_text_view_get_buffer(GTK_TEXT_VIEW(data->streams_list));
+    guint n_kind[3] = { 0, 0, 0 };
+
+    if (GST_CLOCK_TIME_IS_VALID(info->duration) && info->duration > 0)
+    {
+        data->duration = info->duration;
+        gtk_range_set_range(GTK_RANGE(data->slider), 0, (gdouble)data->duration / GST_SECOND);
+    }
+    gtk_widget_set_sensitive(data->slider, info->seekable);
+
+    gtk_text_buffer_set_text(text, "", -1);
+    for (guint i = 0; i < info->n_streams; i++)
+    {
+        const MediaStreamInfo *stream = &info->streams[i];
+        guint kind = g_strcmp0(stream->type, "video") == 0 ? 0 : g_strcmp0(stream->type, "audio") == 0 ? 1 : 2;
+        gchar *str;
+
+        if (kind == 2 && g_strcmp0(stream->type, "subtitle") != 0)
+            continue;
+        str = g_strdup_printf("%s%s stream %u:\n  codec: %s\n", i > 0 ? "\n" : "", stream->type, n_kind[kind]++,
+            stream->codec != NULL ? stream->codec : "unknown");
+        gtk_text_buffer_insert_at_cursor(text, str, -1);
+        g_free(str);
+        if (stream->language != NULL)
+        {
+            str = g_strdup_printf("  language: %s\n", stream->language);
+            gtk_text_buffer_insert_at_cursor(text, str, -1);
+            g_free(str);
+        }
+        if (stream->bitrate != 0)
+        {
+            str = g_strdup_printf("  bitrate: %u\n", stream->bitrate);
+            gtk_text_buffer_insert_at_cursor(text, str, -1);
+            g_free(str);
+        }
+    }
+}
+
+/* Fills the media cache for the next time this file is opened */
+static gpointer discover_thread(gchar *path)
+{
+    MediaInfo *info = media_info_cache_discover(path, 10 * GST_SECOND);
+
+    if (info != NULL)
+        media_info_free(info);
+    g_free(path);
+    return NULL;
 }
 
 /* This creates all the GTK+ widgets that compose our application, and registers the callbacks */
@@ -140,6 +265,8 @@ static void create_ui (CustomData *data)
     data->slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 100 , 1);
     gtk_scale_set_draw_value(GTK_SCALE(data->slider), 0);
     data->slider_update_signal_id = g_signal_connect(G_OBJECT(data->slider), "value-changed", G_CALLBACK(slider_cb), data);
+    g_signal_connect(G_OBJECT(data->slider), "button-press-event", G_CALLBACK(slider_press_cb), data);
+    g_signal_connect(G_OBJECT(data->slider), "button-release-event", G_CALLBACK(slider_release_cb), data);
 
     data->streams_list = gtk_text_view_new();
     gtk_text_view_set_editable(GTK_TEXT_VIEW(data->streams_list), FALSE);
@@ -176,7 +303,7 @@ static gboolean refresh_ui(CustomData *data)
     /* If we didn't know it yet, query the stream duration */
     if (!GST_CLOCK_TIME_IS_VALID(data->duration))
     {
-        if (!gst_element_query_duration(data->playbin, GST_FORMAT_TIME, &data->duration))
+        if (!position_tracker_get_duration(data->position, &data->duration))
         {
             g_printerr("Could not query current duration.\n");
         }
@@ -187,7 +314,10 @@ static gboolean refresh_ui(CustomData *data)
         }
     }
 
-    if (gst_element_query_position(data->playbin, GST_FORMAT_TIME, &current))
+    /* Extrapolated from the last real query, which is only repeated after seeks,
+     * state changes or to check for drift. Left alone while the slider is
+     * dragged, so it stays under the user's pointer */
+    if (!data->dragging && position_tracker_get_position(data->position, &current))
     {
         /* Block the "value-changed" signal, so the slider_cb function is not called
          * (which would trigger a seek the user has not requested) */
@@ -244,6 +374,9 @@ static void state_changed_cb(GstBus *bus, GstMessage *msg, CustomData *data)
     if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data->playbin))
     {
         data->state = new_state;
+        position_tracker_invalidate(data->position);
+        if (new_state < GST_STATE_PAUSED)
+            seek_scheduler_reset(data->seeks);
         g_print("State set to %s\n", gst_element_state_get_name(new_state));
         if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED)
         {
@@ -253,6 +386,21 @@ static void state_changed_cb(GstBus *bus, GstMessage *msg, CustomData *data)
     }
 }
 
+/* A seek completed, the next slider seek can go */
+static void async_done_cb(GstBus *bus, GstMessage *msg, CustomData *data)
+{
+    seek_scheduler_seek_done(data->seeks);
+}
+
+/* This function is called when a seek completed or the duration changed. The
+ * position tracker has to ask the pipeline again */
+static void position_changed_cb(GstBus *bus, GstMessage *msg, CustomData *data)
+{
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_DURATION_CHANGED)
+        data->duration = GST_CLOCK_TIME_NONE;
+    position_tracker_invalidate(data->position);
+}
+
 static void analyze_streams(CustomData *data)
 {
     gint i;
@@ -363,15 +511,35 @@ int main(int argc, char *argv[])
     CustomData data;
     GstStateChangeReturn ret;
     GstBus *bus;
+    SeekSchedulerStats seek_stats;
+    GOptionContext *context;
+    GError *err = NULL;
+    gchar *local_path;
 
     /* Init GTK */
     gtk_init(&argc, &argv);
+
+    /* Parse our own options. GStreamer's ones are left in argv for gst_init */
+    context = g_option_context_new("- GUI tutorial");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_set_ignore_unknown_options(context, TRUE);
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
     
     /* Init GStreamer */
+    static_plugins_prepare();
     gst_init(&argc, &argv);
+    static_plugins_register();
     
     /* Init our data structure */
     memset(&data, 0, sizeof(data));
+    data.drag_keyframe = GST_CLOCK_TIME_NONE;
     data.duration = GST_CLOCK_TIME_NONE;
 
     /* Create the elements */
@@ -384,7 +552,18 @@ int main(int argc, char *argv[])
     }
     
     /* Set URL to play */
-    g_object_set(data.playbin, "uri", "https://gstreamer.freedesktop.org/data/media/sintel_trailer-480p.webm", NULL);
+    if (uri == NULL)
+        uri = g_strdup("https://gstreamer.freedesktop.org/data/media/sintel_trailer-480p.webm");
+    g_object_set(data.playbin, "uri", uri, NULL);
+
+    /* Local files get a keyframe index, read from the cache or built while we play */
+    local_path = file_cache_local_path(uri);
+    if (local_path != NULL)
+        keyframe_index_open_async(local_path, (KeyframeIndexReadyFunc)keyframe_index_ready_cb, &data);
+
+    /* Check the extrapolated position against a real query every 5 s */
+    data.position = position_tracker_new(data.playbin, 5 * GST_SECOND, 20 * GST_MSECOND);
+    data.seeks = seek_scheduler_new(data.playbin);
 
     /* Connect to interesting signals in playbin */
     g_signal_connect(G_OBJECT(data.playbin), "video-tags-changed", (GCallback)tags_cb, &data);
@@ -394,12 +573,32 @@ int main(int argc, char *argv[])
     /* Create the GUI */
     create_ui(&data);
 
+    /* Size the slider before the pipeline starts, if the file is in the media cache */
+    if (local_path != NULL)
+    {
+        MediaInfo *info = media_info_cache_lookup(local_path);
+
+        if (info != NULL)
+        {
+            show_media_info(&data, info);
+            media_info_free(info);
+        }
+        else
+        {
+            g_thread_unref(g_thread_new("media-info", (GThreadFunc)discover_thread, g_strdup(local_path)));
+        }
+        g_free(local_path);
+    }
+
     /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
     bus = gst_element_get_bus(data.playbin);
     gst_bus_add_signal_watch(bus);
     g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb, &data);
     g_signal_connect (G_OBJECT (bus), "message::state-changed", (GCallback)state_changed_cb, &data);
     g_signal_connect (G_OBJECT (bus), "message::application", (GCallback)application_cb, &data);
+    g_signal_connect (G_OBJECT (bus), "message::async-done", (GCallback)position_changed_cb, &data);
+    g_signal_connect (G_OBJECT (bus), "message::async-done", (GCallback)async_done_cb, &data);
+    g_signal_connect (G_OBJECT (bus), "message::duration-changed", (GCallback)position_changed_cb, &data);
     gst_object_unref(bus);
 
     /* Start playing */
@@ -407,6 +606,8 @@ int main(int argc, char *argv[])
     if (ret == GST_STATE_CHANGE_FAILURE)
     {
         g_printerr("Unable to set the pipeline to the playing state.\n");
+        position_tracker_free(data.position);
+        seek_scheduler_free(data.seeks);
         gst_object_unref(data.playbin);
         return -1;
     }
@@ -419,6 +620,14 @@ int main(int argc, char *argv[])
 
     /* Free resources */
     gst_element_set_state (data.playbin, GST_STATE_NULL);
+    seek_scheduler_get_stats(data.seeks, &seek_stats);
+    g_print("Slider seeks requested: %u, issued: %u, skipped as the same keyframe: %u\n",
+            seek_stats.requested, seek_stats.issued, data.drag_seeks_skipped);
+    seek_scheduler_free(data.seeks);
+    position_tracker_free(data.position);
+    if (g_atomic_pointer_get(&data.keyframes) != NULL)
+        keyframe_index_free((KeyframeIndex *)g_atomic_pointer_get(&data.keyframes));
     gst_object_unref (data.playbin);
+    g_free(uri);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include <vector>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "KeyframeFilter.h"
+#include "Preroll.h"
+
+/* One file of the batch, handled by one worker */
+typedef struct _Job {
+    gchar *path;
+    guint written;
+    gint64 elapsed;             /* Wall time, in microseconds */
+} Job;
+
+/* Command line options */
+static gchar *at = NULL;
+static gdouble every = 0.0;
+static gint width = 320;
+static gchar *format = NULL;
+static gchar *output_dir = NULL;
+static gint jobs = 0;
+static gint timeout = 10;
+static gchar **inputs = NULL;
+
+static GOptionEntry entries[] = {
+    { "at", 'a', 0, G_OPTION_ARG_STRING, &at, "Comma separated timestamps, in seconds", "LIST" },
+    { "every", 'e', 0, G_OPTION_ARG_DOUBLE, &every, "One thumbnail every S seconds", "S" },
+    { "width", 'w', 0, G_OPTION_ARG_INT, &width, "Width of the thumbnails, the height keeps the aspect ratio (default 320)", "PIXELS" },
+    { "format", 'f', 0, G_OPTION_ARG_STRING, &format, "jpeg (default) or png", "FORMAT" },
+    { "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &output_dir, "Where to write the thumbnails (default: the current directory)", "DIR" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Files handled at once (default 0: one per two cores)", "N" },
+    { "timeout", 't', 0, G_OPTION_ARG_INT, &timeout, "Seconds a seek may take before the file is given up (default 10)", "S" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &inputs, NULL, "FILE..." },
+    { NULL }
+};
+
+/* Audio is left encoded: nothing of it is needed */
+static gboolean autoplug_continue_cb(GstElement *bin, GstPad *pad, GstCaps *caps, gpointer user_data)
+{
+    return !g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "audio/");
+}
+
+/* The first raw video stream goes to the appsink */
+static void pad_added_cb(GstElement *source, GstPad *pad, GstElement *appsink)
+{
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstPad *sink_pad = gst_element_get_static_pad(appsink, "sink");
+
+    if (caps != NULL && g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/x-raw") &&
+        !gst_pad_is_linked(sink_pad))
+        gst_pad_link(pad, sink_pad);
+    if (caps != NULL)
+        gst_caps_unref(caps);
+    gst_object_unref(sink_pad);
+}
+
+/* Timestamps to take for a file of the given duration */
+static std::vector<GstClockTime> targets(GstClockTime duration)
+{
+    std::vector<GstClockTime> result;
+
+    if (at != NULL)
+    {
+        gchar **list = g_strsplit(at, ",", -1);
+
+        for (gchar **item = list; *item != NULL; item++)
+        {
+            GstClockTime target = (GstClockTime)(g_ascii_strtod(*item, NULL) * GST_SECOND);
+
+            if (!GST_CLOCK_TIME_IS_VALID(duration) || target < duration)
+                result.push_back(target);
+        }
+        g_strfreev(list);
+    }
+    else if (GST_CLOCK_TIME_IS_VALID(duration))
+    {
+        for (GstClockTime target = 0; target < duration; target += (GstClockTime)(every * GST_SECOND))
+            result.push_back(target);
+    }
+    return result;
+}
+
+/* Scales and encodes the prerolled frame and writes it */
+static gboolean write_thumbnail(GstSample *sample, const gchar *path, guint index)
+{
+    GstVideoInfo info;
+    GstCaps *caps;
+    GstSample *image;
+    GstBuffer *buffer;
+    GstMapInfo map;
+    gchar *basename, *name, *file;
+    gint height;
+    GError *err = NULL;
+    gboolean ok;
+
+    if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample)))
+        return FALSE;
+    height = (gint)gst_util_uint64_scale_int(width, info.height * info.par_d, info.width * info.par_n);
+    caps = gst_caps_new_simple(g_strcmp0(format, "png") == 0 ? "image/png" : "image/jpeg",
+        "width", G_TYPE_INT, width, "height", G_TYPE_INT, MAX(height & ~1, 2),
+        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+    image = gst_video_convert_sample(sample, caps, timeout * GST_SECOND, &err);
+    gst_caps_unref(caps);
+    if (image == NULL)
+    {
+        g_printerr("%s: could not convert frame %u: %s\n", path, index, err != NULL ? err->message : "unknown error");
+        g_clear_error(&err);
+        return FALSE;
+    }
+
+    basename = g_path_get_basename(path);
+    name = g_strdup_printf("%s-%04u.%s", basename, index, g_strcmp0(format, "png") == 0 ? "png" : "jpg");
+    file = g_build_filename(output_dir, name, NULL);
+    buffer = gst_sample_get_buffer(image);
+    gst_buffer_map(buffer, &map, GST_MAP_READ);
+    ok = g_file_set_contents(file, (const gchar *)map.data, map.size, &err);
+    gst_buffer_unmap(buffer, &map);
+    if (!ok)
+    {
+        g_printerr("%s\n", err->message);
+        g_clear_error(&err);
+    }
+
+    g_free(file);
+    g_free(name);
+    g_free(basename);
+    gst_sample_unref(image);
+    return ok;
+}
+
+/* All thumbnails of one file, from one pipeline */
+static void thumbnail_file(Job *job, gpointer user_data)
+{
+    GstElement *pipeline = gst_pipeline_new(NULL);
+    GstElement *source = gst_element_factory_make("uridecodebin", NULL);
+    GstElement *appsink = gst_element_factory_make("appsink", NULL);
+    gchar *uri = gst_filename_to_uri(job->path, NULL);
+    GstCaps *caps;
+    KeyframeFilter *filter;
+    gint64 start = g_get_monotonic_time();
+    gint64 duration = GST_CLOCK_TIME_NONE;
+    guint index = 0;
+
+    if (source == NULL || appsink == NULL || uri == NULL)
+    {
+        g_printerr("%s: not all elements could be created\n", job->path);
+        if (source != NULL)
+            gst_object_unref(source);
+        if (appsink != NULL)
+            gst_object_unref(appsink);
+        gst_object_unref(pipeline);
+        g_free(uri);
+        return;
+    }
+
+    caps = gst_caps_new_empty_simple("video/x-raw");
+    g_object_set(source, "uri", uri, NULL);
+    g_object_set(appsink, "caps", caps, "sync", FALSE, "max-buffers", 1, NULL);
+    gst_caps_unref(caps);
+    g_free(uri);
+    gst_bin_add_many(GST_BIN(pipeline), source, appsink, NULL);
+    g_signal_connect(source, "autoplug-continue", G_CALLBACK(autoplug_continue_cb), NULL);
+    g_signal_connect(source, "pad-added", G_CALLBACK(pad_added_cb), appsink);
+
+    /* A thumbnail only needs the keyframe the seek snapped to. The frames that
+     * depend on it are dropped before the decoder, instead of being decoded
+     * while the pipeline waits in PAUSED */
+    filter = keyframe_filter_new(pipeline, KEYFRAME_FILTER_DROP);
+
+    /* Every frame is taken in PAUSED, from the preroll of a seek */
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    if (preroll_wait(pipeline, timeout * GST_SECOND, job->path))
+    {
+        gst_element_query_duration(pipeline, GST_FORMAT_TIME, &duration);
+        for (GstClockTime target : targets(duration))
+        {
+            GstSample *sample;
+
+            if (!gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
+                    (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE), target) ||
+                !preroll_wait(pipeline, timeout * GST_SECOND, job->path))
+                break;
+
+            sample = gst_app_sink_try_pull_preroll(GST_APP_SINK(appsink), timeout * GST_SECOND);
+            if (sample == NULL)
+                break;
+            if (write_thumbnail(sample, job->path, index++))
+                job->written++;
+            gst_sample_unref(sample);
+        }
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    keyframe_filter_free(filter);
+    gst_object_unref(pipeline);
+
+    job->elapsed = g_get_monotonic_time() - start;
+    g_print("%s: %u thumbnails in %.2f s\n", job->path, job->written, (gdouble)job->elapsed / G_USEC_PER_SEC);
+}
+
+int
+main(int argc, char* argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    std::vector<Job> batch;
+    GThreadPool *pool;
+    gint64 start;
+    gdouble elapsed;
+    guint written = 0;
+
+    /* Initialize GStreamer. The GStreamer option group calls gst_init for us */
+    context = g_option_context_new("- keyframe thumbnails of many files, several at once");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+    {
+        g_printerr("Failed to parse options: %s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return -1;
+    }
+    g_option_context_free(context);
+
+    if (inputs == NULL || (at == NULL) == (every <= 0.0) || width <= 0 || jobs < 0 || timeout <= 0 ||
+        (format != NULL && g_strcmp0(format, "jpeg") != 0 && g_strcmp0(format, "png") != 0))
+    {
+        g_printerr("Usage: %s (--at S,S,... | --every S) [--width PIXELS] [--format jpeg|png] "
+                   "[--output-dir DIR] [--jobs N] FILE...\n", argv[0]);
+        return -1;
+    }
+    if (output_dir == NULL)
+        output_dir = g_strdup(".");
+    if (jobs == 0)
+        jobs = MAX(1, g_get_num_processors() / 2);
+    g_mkdir_with_parents(output_dir, 0755);
+
+    for (gchar **input = inputs; *input != NULL; input++)
+        batch.push_back({ *input, 0, 0 });
+
+    /* One pipeline per worker at a time */
+    start = g_get_monotonic_time();
+    pool = g_thread_pool_new((GFunc)thumbnail_file, NULL, jobs, TRUE, NULL);
+    for (Job &job : batch)
+        g_thread_pool_push(pool, &job, NULL);
+    g_thread_pool_free(pool, FALSE, TRUE);
+    elapsed = (gdouble)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+    for (const Job &job : batch)
+        written += job.written;
+    g_print("%u thumbnails of %zu files in %.2f s with %d workers: %.1f thumbnails/s\n",
+        written, batch.size(), elapsed, jobs, elapsed > 0 ? written / elapsed : 0.0);
+
+    g_strfreev(inputs);
+    g_free(at);
+    g_free(format);
+    g_free(output_dir);
+    return 0;
+}
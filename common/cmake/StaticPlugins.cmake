@@ -0,0 +1,41 @@
+# Fast-start builds: link only the plugins an example needs into its binary and
+# register them with gst_plugin_register_static, so gst_init does not have to
+# scan and load every plugin installed on the host.
+#
+# The plugins must be available as static libraries with their own pkg-config
+# files (gst<plugin>.pc), as installed by a GStreamer built with
+# -Ddefault_library=static. Add <prefix>/lib/gstreamer-1.0/pkgconfig to
+# PKG_CONFIG_PATH so they can be found.
+#
+# Usage:
+#   include(${COMMON_DIR}/cmake/StaticPlugins.cmake)
+#   gst_static_plugins(<target> <plugin> [<plugin> ...])
+#
+# The binary is renamed to <target>-static so both flavours can live side by
+# side in bin/, and GST_STATIC_PLUGINS is defined for its sources, which turns
+# the calls in StaticPlugins.h into real ones.
+
+function(gst_static_plugins target)
+    set(declares "")
+    set(registers "")
+
+    foreach(plugin ${ARGN})
+        string(TOUPPER ${plugin} plugin_upper)
+        pkg_check_modules(GST_PLUGIN_${plugin_upper} REQUIRED gst${plugin})
+        target_link_libraries(${target} ${GST_PLUGIN_${plugin_upper}_STATIC_LDFLAGS})
+
+        string(APPEND declares "GST_PLUGIN_STATIC_DECLARE(${plugin});\n")
+        string(APPEND registers "    GST_PLUGIN_STATIC_REGISTER(${plugin});\n")
+    endforeach()
+
+    set(GST_STATIC_PLUGIN_DECLARES ${declares})
+    set(GST_STATIC_PLUGIN_REGISTERS ${registers})
+    configure_file(${COMMON_DIR}/src/StaticPluginsRegister.cpp.in
+                   ${CMAKE_CURRENT_BINARY_DIR}/StaticPluginsRegister.cpp @ONLY)
+
+    target_sources(${target} PRIVATE
+                   ${COMMON_DIR}/src/StaticPlugins.cpp
+                   ${CMAKE_CURRENT_BINARY_DIR}/StaticPluginsRegister.cpp)
+    target_compile_definitions(${target} PRIVATE GST_STATIC_PLUGINS)
+    set_target_properties(${target} PROPERTIES OUTPUT_NAME ${target}-static)
+endfunction()
@@ -0,0 +1,44 @@
+#ifndef BUS_DISPATCHER_H
+#define BUS_DISPATCHER_H
+
+#include <gst/gst.h>
+
+/* Event-driven replacement for polling a pipeline's bus.
+ *
+ * A sync handler looks at every message in the thread that posts it and
+ * drops, right there, the ones the application has no callback for (and the
+ * state changes of anything but the pipeline itself). The rest go through a
+ * lock-free queue to a control thread of the dispatcher, which calls the
+ * matching callback. Producers only wake the control thread when the queue
+ * was empty, so a burst of messages costs one wakeup. */
+
+typedef struct _BusDispatcher BusDispatcher;
+
+/* All run on the control thread. Any of them can be NULL */
+typedef struct _BusDispatcherCallbacks {
+    void (*error)(GstObject *src, const GError *err, const gchar *debug_info, gpointer user_data);
+    void (*eos)(gpointer user_data);
+    /* Only for the state of the pipeline itself */
+    void (*state_changed)(GstState old_state, GstState new_state, GstState pending_state, gpointer user_data);
+    void (*duration_changed)(gpointer user_data);
+    void (*async_done)(gpointer user_data);
+    /* Only from the pipeline, which posts it once every stream finished a SEGMENT seek's segment */
+    void (*segment_done)(GstFormat format, gint64 position, gpointer user_data);
+} BusDispatcherCallbacks;
+
+typedef struct _BusDispatcherStats {
+    guint posted;               /* Messages seen by the sync handler */
+    guint dropped;              /* Messages dropped by the sync handler */
+    guint wakeups;              /* Times the control thread was woken up */
+} BusDispatcherStats;
+
+/* Takes over the bus of pipeline and starts the control thread. callbacks is copied */
+BusDispatcher *bus_dispatcher_new(GstElement *pipeline, const BusDispatcherCallbacks *callbacks, gpointer user_data);
+
+void bus_dispatcher_get_stats(BusDispatcher *dispatcher, BusDispatcherStats *stats);
+
+/* Dispatches what is queued, stops the control thread and gives the bus back.
+ * Call once the pipeline is in the NULL state, and not from a callback */
+void bus_dispatcher_free(BusDispatcher *dispatcher);
+
+#endif /* BUS_DISPATCHER_H */
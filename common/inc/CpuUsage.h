@@ -0,0 +1,21 @@
+#ifndef CPU_USAGE_H
+#define CPU_USAGE_H
+
+#include <vector>
+#include <gst/gst.h>
+
+/* Jiffies spent by one core, as read from /proc/stat */
+typedef struct _CpuTimes {
+    guint64 busy;
+    guint64 total;
+} CpuTimes;
+
+/* Reads the per-core counters of /proc/stat (the aggregated "cpu" line is skipped).
+ * Returns an empty vector when /proc/stat is not available. */
+std::vector<CpuTimes> cpu_usage_sample(void);
+
+/* Utilisation of each core between two samples, in percent */
+std::vector<double> cpu_usage_between(const std::vector<CpuTimes> &before,
+                                      const std::vector<CpuTimes> &after);
+
+#endif /* CPU_USAGE_H */
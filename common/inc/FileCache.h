@@ -0,0 +1,21 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <glib.h>
+
+/* Where the tools keep what they learn about a local file, so it is only
+ * learnt once: ~/.cache/gst-tutorials/KIND/, one file per media file. The
+ * name is a hash of the media file's path, size and modification time, so a
+ * changed file simply misses the cache. */
+
+/* Turns a local path or a file:// URI into a path. Returns NULL for any other URI */
+gchar *file_cache_local_path(const gchar *uri);
+
+/* Cache file of the given kind for path. Returns NULL if path cannot be stat'ed */
+gchar *file_cache_path(const gchar *path, const gchar *kind, const gchar *extension);
+
+/* Writes contents to cache_path, creating its directory. Readers never see a
+ * half written file */
+gboolean file_cache_store(const gchar *cache_path, const gchar *contents, gssize length);
+
+#endif /* FILE_CACHE_H */
@@ -0,0 +1,39 @@
+#ifndef KEYFRAME_FILTER_H
+#define KEYFRAME_FILTER_H
+
+#include <gst/gst.h>
+
+/* Drops the delta frames in front of every video decoder of a pipeline, so
+ * only keyframes get decoded. That is all a fast scan shows, and all a
+ * thumbnail taken where a key unit seek snapped needs.
+ *
+ * The decoders are found as uridecodebin or decodebin plug them, through the
+ * pipeline's "deep-element-added" signal: create the filter before the
+ * pipeline leaves the NULL state. The probes run on the streaming threads,
+ * the mode and the counters can be changed and read from any thread. */
+
+typedef enum {
+    KEYFRAME_FILTER_PASS,       /* Every frame goes through, nothing is counted */
+    KEYFRAME_FILTER_COUNT,      /* Every frame goes through and is counted */
+    KEYFRAME_FILTER_DROP        /* Delta frames are dropped, both kinds are counted */
+} KeyframeFilterMode;
+
+typedef struct _KeyframeFilter KeyframeFilter;
+
+typedef struct _KeyframeFilterStats {
+    guint decoded;              /* Frames given to the decoders */
+    guint skipped;              /* Delta frames dropped in front of them */
+} KeyframeFilterStats;
+
+KeyframeFilter *keyframe_filter_new(GstElement *pipeline, KeyframeFilterMode mode);
+
+void keyframe_filter_set_mode(KeyframeFilter *filter, KeyframeFilterMode mode);
+
+/* Counts since the filter was created or last reset */
+void keyframe_filter_get_stats(KeyframeFilter *filter, KeyframeFilterStats *stats);
+void keyframe_filter_reset_stats(KeyframeFilter *filter);
+
+/* The pipeline must be in the NULL state: its decoders keep their probes */
+void keyframe_filter_free(KeyframeFilter *filter);
+
+#endif /* KEYFRAME_FILTER_H */
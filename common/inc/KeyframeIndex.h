@@ -0,0 +1,52 @@
+#ifndef KEYFRAME_INDEX_H
+#define KEYFRAME_INDEX_H
+
+#include <gst/gst.h>
+
+/* Keyframe index of a local file: the timestamp of every keyframe of its
+ * first video stream, with the frame count and duration of the file.
+ *
+ * The index is built by demuxing and parsing the file once (nothing is
+ * decoded) and stored in the file cache (see FileCache.h), so the scan is
+ * only paid once per version of the file. Seeks still go through the
+ * demuxer by time, but with the index a player knows which keyframe a
+ * KEY_UNIT|SNAP_BEFORE seek lands on before sending it: a drag seek that
+ * would land on the keyframe already shown is not sent at all. */
+
+typedef struct _KeyframeIndex KeyframeIndex;
+
+/* Called with the index, or NULL if it could not be built. The callback owns it */
+typedef void (*KeyframeIndexReadyFunc)(KeyframeIndex *index, gpointer user_data);
+
+/* Where the index of path is stored. Returns NULL if path cannot be stat'ed */
+gchar *keyframe_index_cache_path(const gchar *path);
+
+/* Reads the stored index of path. Returns NULL if there is none for this version of the file */
+KeyframeIndex *keyframe_index_load(const gchar *path);
+
+/* Scans path and stores the index. Returns NULL if it could not be read or has no keyframe */
+KeyframeIndex *keyframe_index_build(const gchar *path);
+
+/* Loads the index of path, or builds it if there is none */
+KeyframeIndex *keyframe_index_open(const gchar *path);
+
+/* keyframe_index_open on a thread of its own. func is called from that thread */
+void keyframe_index_open_async(const gchar *path, KeyframeIndexReadyFunc func, gpointer user_data);
+
+/* Keyframe at or before target: where a KEY_UNIT|SNAP_BEFORE seek to target lands */
+GstClockTime keyframe_index_lookup(KeyframeIndex *index, GstClockTime target);
+
+guint keyframe_index_get_size(KeyframeIndex *index);
+
+/* Timestamp of the i-th keyframe, in presentation order */
+GstClockTime keyframe_index_get_keyframe(KeyframeIndex *index, guint i);
+
+/* Frames of the indexed stream, keyframes or not */
+guint64 keyframe_index_get_frames(KeyframeIndex *index);
+
+/* Duration of the file, GST_CLOCK_TIME_NONE if the demuxer did not report one */
+GstClockTime keyframe_index_get_duration(KeyframeIndex *index);
+
+void keyframe_index_free(KeyframeIndex *index);
+
+#endif /* KEYFRAME_INDEX_H */
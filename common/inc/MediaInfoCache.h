@@ -0,0 +1,46 @@
+#ifndef MEDIA_INFO_CACHE_H
+#define MEDIA_INFO_CACHE_H
+
+#include <gst/gst.h>
+
+/* What a player needs to know about a local file before it opens it:
+ * duration, seekability and the list of streams.
+ *
+ * It is found once by GstDiscoverer and kept in the file cache (see
+ * FileCache.h), so lookups only read a small file and never build a
+ * pipeline. A library is discovered by a fixed number of workers, each with
+ * one pipeline at a time, however many files it holds. */
+
+typedef struct _MediaStreamInfo {
+    gchar *type;                /* "video", "audio", "subtitle" or "other" */
+    gchar *codec;               /* NULL if unknown */
+    gchar *language;            /* NULL if unknown */
+    guint bitrate;              /* In bits per second, 0 if unknown */
+} MediaStreamInfo;
+
+typedef struct _MediaInfo {
+    GstClockTime duration;
+    gboolean seekable;
+    guint bitrate;              /* Of the whole file, in bits per second */
+    guint n_streams;
+    MediaStreamInfo *streams;
+} MediaInfo;
+
+/* Called from a worker for every file of a scan. info is NULL if the file
+ * could not be discovered, and is freed once the callback returns */
+typedef void (*MediaInfoScanFunc)(const gchar *path, const MediaInfo *info, gboolean cached, gpointer user_data);
+
+/* Cached information of path. Returns NULL if this version of the file was never discovered */
+MediaInfo *media_info_cache_lookup(const gchar *path);
+
+/* Discovers path in the calling thread and caches the result. Returns NULL on failure */
+MediaInfo *media_info_cache_discover(const gchar *path, GstClockTime timeout);
+
+/* Looks up every path and discovers those that are not cached (all of them
+ * with force), n_workers at a time. Returns once every file is done */
+void media_info_cache_scan(gchar **paths, guint n_workers, gboolean force, GstClockTime timeout,
+                           MediaInfoScanFunc func, gpointer user_data);
+
+void media_info_free(MediaInfo *info);
+
+#endif /* MEDIA_INFO_CACHE_H */
@@ -0,0 +1,44 @@
+#ifndef POSITION_TRACKER_H
+#define POSITION_TRACKER_H
+
+#include <gst/gst.h>
+
+/* Position of a pipeline without a position query per read.
+ *
+ * One real position query anchors the tracker: the position it returned, the
+ * pipeline clock's time when it did, the playback rate and whether the
+ * pipeline was PLAYING. Reads then extrapolate from the anchor with the
+ * clock, and only take a seqlock-style snapshot of it, so they never block.
+ * A read queries the pipeline again only after position_tracker_invalidate()
+ * (state changes, seeks, rate or duration changes), and once per check
+ * interval to catch drift: when the extrapolation is off by more than the
+ * threshold, that counts as a drift correction. */
+
+typedef struct _PositionTracker PositionTracker;
+
+typedef struct _PositionTrackerStats {
+    guint reads;                /* position_tracker_get_position calls */
+    guint queries;              /* Real position queries sent to the pipeline */
+    guint corrections;          /* Drift checks that found more than the threshold */
+} PositionTrackerStats;
+
+/* check_interval is how often a read verifies the extrapolation with a real
+ * query, drift_threshold how far off it may be before that counts as a
+ * correction */
+PositionTracker *position_tracker_new(GstElement *pipeline, GstClockTime check_interval,
+                                      GstClockTime drift_threshold);
+
+/* The next read anchors again. Safe to call from any thread */
+void position_tracker_invalidate(PositionTracker *tracker);
+
+/* Current position in nanoseconds. Returns FALSE if the pipeline cannot tell yet */
+gboolean position_tracker_get_position(PositionTracker *tracker, gint64 *position);
+
+/* Duration in nanoseconds, queried again after each invalidation. Returns FALSE if unknown */
+gboolean position_tracker_get_duration(PositionTracker *tracker, gint64 *duration);
+
+void position_tracker_get_stats(PositionTracker *tracker, PositionTrackerStats *stats);
+
+void position_tracker_free(PositionTracker *tracker);
+
+#endif /* POSITION_TRACKER_H */
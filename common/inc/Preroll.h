@@ -0,0 +1,14 @@
+#ifndef PREROLL_H
+#define PREROLL_H
+
+#include <gst/gst.h>
+
+/* Waits for the ASYNC_DONE of pipeline: its preroll after going to PAUSED, or
+ * after a flushing seek in PAUSED. Messages are popped off the bus, so it
+ * suits tools that drive a pipeline without a bus watch.
+ *
+ * Returns FALSE on an error or after timeout, and prints which one, after
+ * "what: " unless what is NULL. */
+gboolean preroll_wait(GstElement *pipeline, GstClockTime timeout, const gchar *what);
+
+#endif /* PREROLL_H */
@@ -0,0 +1,21 @@
+#ifndef PROCESS_STATS_H
+#define PROCESS_STATS_H
+
+#include <gst/gst.h>
+
+/* Snapshot of the resources used by this process so far */
+typedef struct _ProcessStats {
+    gint64 wall_time;           /* Monotonic time, in microseconds */
+    gint64 cpu_time;            /* User + system CPU time, in microseconds */
+    gint64 peak_rss;            /* Peak resident set size, in kilobytes */
+} ProcessStats;
+
+/* Fills stats with the current values for this process */
+void process_stats_sample(ProcessStats *stats);
+
+/* Resets the kernel's peak RSS counter (VmHWM), so the next sample reports the
+ * peak since this call instead of the peak since the process started.
+ * Returns FALSE when the kernel does not support it. */
+gboolean process_stats_reset_peak_rss(void);
+
+#endif /* PROCESS_STATS_H */
@@ -0,0 +1,38 @@
+#ifndef SEEK_SCHEDULER_H
+#define SEEK_SCHEDULER_H
+
+#include <gst/gst.h>
+
+/* Coalesces the seeks of a UI control, such as a slider being dragged.
+ *
+ * At most one seek is in flight: a flushing seek sent while another one is
+ * still prerolling aborts it, so a burst of them shows nothing until the
+ * burst ends. Requests made meanwhile only replace the pending target, and
+ * the latest one is sent once the pipeline posts ASYNC_DONE, or once the
+ * seek in flight timed out. Not thread safe: call everything from the
+ * thread running the default main context, which handles the bus messages. */
+
+typedef struct _SeekScheduler SeekScheduler;
+
+typedef struct _SeekSchedulerStats {
+    guint requested;            /* seek_scheduler_request calls */
+    guint issued;               /* Seeks actually sent to the pipeline */
+} SeekSchedulerStats;
+
+SeekScheduler *seek_scheduler_new(GstElement *pipeline);
+
+/* Seeks to position with flags now, or once the seek in flight completed */
+void seek_scheduler_request(SeekScheduler *scheduler, gint64 position, GstSeekFlags flags);
+
+/* Call on ASYNC_DONE: the seek in flight completed, the pending one is sent */
+void seek_scheduler_seek_done(SeekScheduler *scheduler);
+
+/* Call when the pipeline goes below PAUSED: no ASYNC_DONE will come for the
+ * seek in flight, and the pending one is dropped */
+void seek_scheduler_reset(SeekScheduler *scheduler);
+
+void seek_scheduler_get_stats(SeekScheduler *scheduler, SeekSchedulerStats *stats);
+
+void seek_scheduler_free(SeekScheduler *scheduler);
+
+#endif /* SEEK_SCHEDULER_H */
@@ -0,0 +1,41 @@
+#ifndef STARTUP_TIMER_H
+#define STARTUP_TIMER_H
+
+#include <gst/gst.h>
+
+/* Timing layer for the path from process start to the first frame at the sink.
+ *
+ * Phases are marked with startup_timer_mark() from any thread and printed, in
+ * the order they happened, by startup_timer_print_report(). Each line of the
+ * report is "startup <phase> <ms since startup_timer_init>", which is also what
+ * startup_timer_compare() parses from its children. */
+
+/* Records the reference time. Call it first thing in main() */
+void startup_timer_init(void);
+
+/* Records that phase happened now. Safe to call from streaming threads.
+ * phase must not contain spaces */
+void startup_timer_mark(const gchar *phase);
+
+/* Points GST_REGISTRY to a fresh file, so the following gst_init has to scan
+ * every plugin as on a cold start. Must be called before gst_init. */
+void startup_timer_use_cold_registry(void);
+
+/* Removes the temporary registry created by startup_timer_use_cold_registry */
+void startup_timer_cleanup(void);
+
+/* Marks phase when the first buffer goes through the sink pad of element */
+void startup_timer_watch_first_buffer(GstElement *element, const gchar *phase);
+
+/* Marks "typefound" when any typefind element inside bin finds the media type */
+void startup_timer_watch_typefind(GstElement *bin);
+
+/* Prints all the phases marked so far */
+void startup_timer_print_report(void);
+
+/* Runs self twice, once with a cold registry (self <args> --startup-report=cold)
+ * and once with a warm one (--startup-report=warm), and prints both reports
+ * side by side. args is a NULL terminated list forwarded to both runs. */
+int startup_timer_compare(const gchar *self, gchar **args);
+
+#endif /* STARTUP_TIMER_H */
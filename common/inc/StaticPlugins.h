@@ -0,0 +1,24 @@
+#ifndef STATIC_PLUGINS_H
+#define STATIC_PLUGINS_H
+
+/* Plugins linked into the binary by common/cmake/StaticPlugins.cmake.
+ *
+ * Call static_plugins_prepare() before gst_init and static_plugins_register()
+ * right after it. In regular (dynamic) builds both calls do nothing. */
+
+#ifdef GST_STATIC_PLUGINS
+
+/* Keeps gst_init from scanning the plugin directories of the host */
+void static_plugins_prepare(void);
+
+/* Registers the plugins that were linked into the binary */
+void static_plugins_register(void);
+
+#else
+
+static inline void static_plugins_prepare(void) {}
+static inline void static_plugins_register(void) {}
+
+#endif /* GST_STATIC_PLUGINS */
+
+#endif /* STATIC_PLUGINS_H */
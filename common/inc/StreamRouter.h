@@ -0,0 +1,64 @@
+#ifndef STREAM_ROUTER_H
+#define STREAM_ROUTER_H
+
+#include <gst/gst.h>
+
+/* Links every raw audio and video pad of a decoder (uridecodebin, decodebin)
+ * to a branch of its own, instead of only the first one of each kind.
+ *
+ * A video branch is videoconvert ! autovideosink, an audio branch is
+ * audioconvert ! audioresample ! autoaudiosink, both in a bin with a "sink"
+ * ghost pad. Branches are built by a background thread and brought to READY
+ * (where the autodetect sinks open their device) while the decoder is still
+ * typefinding, so pad-added only has to link one and set it playing. When the
+ * decoder removes the pad, its branch is torn down. */
+
+typedef enum {
+    STREAM_KIND_VIDEO,
+    STREAM_KIND_AUDIO,
+    STREAM_KIND_COUNT
+} StreamKind;
+
+/* Which streams a decoder turns into raw audio or video */
+typedef enum {
+    STREAM_DECODE_BOTH,
+    STREAM_DECODE_VIDEO,
+    STREAM_DECODE_AUDIO
+} StreamDecode;
+
+typedef struct _StreamRouter StreamRouter;
+
+typedef struct _StreamRouterStats {
+    guint linked[STREAM_KIND_COUNT];    /* Branches linked so far */
+    guint active[STREAM_KIND_COUNT];    /* Branches linked and not removed yet */
+    guint pool_hits;                    /* Branches that were ready when their pad came */
+    guint pool_misses;                  /* Branches built on the streaming thread */
+} StreamRouterStats;
+
+/* Called on the streaming thread once pad is linked to branch. index counts
+ * the streams of that kind from 0 */
+typedef void (*StreamLinkedFunc)(GstPad *pad, GstElement *branch, StreamKind kind, guint index, gpointer user_data);
+
+/* Starts building n_video video and n_audio audio branches in the background,
+ * and keeps that many ready as they get used. linked can be NULL */
+StreamRouter *stream_router_new(GstElement *pipeline, guint n_video, guint n_audio,
+                                StreamLinkedFunc linked, gpointer user_data);
+
+/* Parses "both", "video" or "audio" into decode. Returns FALSE for anything else */
+gboolean stream_decode_from_string(const gchar *name, StreamDecode *decode);
+
+/* Restricts the source attached next to decode. Streams of the other kind are
+ * exposed as they come out of the demuxer, without a parser or decoder, and
+ * are not linked. Pass 0 branches of that kind to stream_router_new as well,
+ * so none are built */
+void stream_router_set_decode(StreamRouter *router, StreamDecode decode);
+
+/* Routes the pads source adds and removes from now on */
+void stream_router_attach(StreamRouter *router, GstElement *source);
+
+void stream_router_get_stats(StreamRouter *router, StreamRouterStats *stats);
+
+/* Call once the pipeline is in the NULL state */
+void stream_router_free(StreamRouter *router);
+
+#endif /* STREAM_ROUTER_H */
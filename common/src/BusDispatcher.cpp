@@ -0,0 +1,228 @@
+#include "BusDispatcher.h"
+
+/* A queued message. The queue is a stack producers push onto with a CAS, and
+ * that the control thread empties in one exchange and reverses, which keeps
+ * it lock-free without an ABA problem: there is a single consumer and it
+ * never pops one node at a time */
+typedef struct _Node {
+    GstMessage *msg;            /* NULL asks the control thread to stop */
+    struct _Node *next;
+} Node;
+
+struct _BusDispatcher {
+    GstElement *pipeline;
+    GstBus *bus;
+    BusDispatcherCallbacks callbacks;
+    gpointer user_data;
+    GThread *thread;
+
+    Node *head;                 /* Newest node, only touched atomically */
+
+    GMutex lock;                /* Only to sleep and wake the control thread */
+    GCond wake;
+
+    gint posted;
+    gint dropped;
+    gint wakeups;
+};
+
+/* Called from any thread */
+static void bus_dispatcher_push(BusDispatcher *dispatcher, GstMessage *msg)
+{
+    Node *node = g_new(Node, 1);
+    Node *head;
+
+    node->msg = msg;
+    do
+    {
+        head = (Node *)g_atomic_pointer_get(&dispatcher->head);
+        node->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&dispatcher->head, head, node));
+
+    /* The control thread is only asleep, or about to be, when the queue was empty */
+    if (head == NULL)
+    {
+        g_mutex_lock(&dispatcher->lock);
+        g_cond_signal(&dispatcher->wake);
+        g_mutex_unlock(&dispatcher->lock);
+    }
+}
+
+static gboolean bus_dispatcher_wanted(BusDispatcher *dispatcher, GstMessage *msg)
+{
+    const BusDispatcherCallbacks *cb = &dispatcher->callbacks;
+
+    switch (GST_MESSAGE_TYPE(msg))
+    {
+        case GST_MESSAGE_ERROR:
+        return cb->error != NULL;
+
+        case GST_MESSAGE_EOS:
+        return cb->eos != NULL;
+
+        case GST_MESSAGE_STATE_CHANGED:
+        return cb->state_changed != NULL && GST_MESSAGE_SRC(msg) == GST_OBJECT(dispatcher->pipeline);
+
+        case GST_MESSAGE_DURATION_CHANGED:
+        return cb->duration_changed != NULL;
+
+        case GST_MESSAGE_ASYNC_DONE:
+        return cb->async_done != NULL;
+
+        case GST_MESSAGE_SEGMENT_DONE:
+        return cb->segment_done != NULL && GST_MESSAGE_SRC(msg) == GST_OBJECT(dispatcher->pipeline);
+
+        default:
+        return FALSE;
+    }
+}
+
+/* Runs in the thread that posts msg, so it has to be quick */
+static GstBusSyncReply bus_dispatcher_sync_handler(GstBus *bus, GstMessage *msg, BusDispatcher *dispatcher)
+{
+    g_atomic_int_inc(&dispatcher->posted);
+    if (!bus_dispatcher_wanted(dispatcher, msg))
+    {
+        g_atomic_int_inc(&dispatcher->dropped);
+        return GST_BUS_DROP;
+    }
+
+    /* GST_BUS_DROP unrefs the message, our reference keeps it for the control thread */
+    bus_dispatcher_push(dispatcher, gst_message_ref(msg));
+    return GST_BUS_DROP;
+}
+
+static void bus_dispatcher_dispatch(BusDispatcher *dispatcher, GstMessage *msg)
+{
+    const BusDispatcherCallbacks *cb = &dispatcher->callbacks;
+
+    switch (GST_MESSAGE_TYPE(msg))
+    {
+        case GST_MESSAGE_ERROR:
+        {
+            GError *err;
+            gchar *debug_info;
+
+            gst_message_parse_error(msg, &err, &debug_info);
+            cb->error(GST_MESSAGE_SRC(msg), err, debug_info, dispatcher->user_data);
+            g_clear_error(&err);
+            g_free(debug_info);
+            break;
+        }
+
+        case GST_MESSAGE_EOS:
+        cb->eos(dispatcher->user_data);
+        break;
+
+        case GST_MESSAGE_STATE_CHANGED:
+        {
+            GstState old_state, new_state, pending_state;
+
+            gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
+            cb->state_changed(old_state, new_state, pending_state, dispatcher->user_data);
+            break;
+        }
+
+        case GST_MESSAGE_DURATION_CHANGED:
+        cb->duration_changed(dispatcher->user_data);
+        break;
+
+        case GST_MESSAGE_ASYNC_DONE:
+        cb->async_done(dispatcher->user_data);
+        break;
+
+        case GST_MESSAGE_SEGMENT_DONE:
+        {
+            GstFormat format;
+            gint64 position;
+
+            gst_message_parse_segment_done(msg, &format, &position);
+            cb->segment_done(format, position, dispatcher->user_data);
+            break;
+        }
+
+        default:
+        break;
+    }
+}
+
+static gpointer bus_dispatcher_thread(BusDispatcher *dispatcher)
+{
+    gboolean running = TRUE;
+
+    while (running)
+    {
+        Node *node, *fifo = NULL;
+
+        g_mutex_lock(&dispatcher->lock);
+        while (g_atomic_pointer_get(&dispatcher->head) == NULL)
+            g_cond_wait(&dispatcher->wake, &dispatcher->lock);
+        g_mutex_unlock(&dispatcher->lock);
+        g_atomic_int_inc(&dispatcher->wakeups);
+
+        /* Take everything queued so far, and put it back in posting order */
+        node = (Node *)g_atomic_pointer_exchange(&dispatcher->head, NULL);
+        while (node != NULL)
+        {
+            Node *next = node->next;
+            node->next = fifo;
+            fifo = node;
+            node = next;
+        }
+
+        while (fifo != NULL)
+        {
+            Node *next = fifo->next;
+
+            if (fifo->msg == NULL)
+            {
+                running = FALSE;
+            }
+            else
+            {
+                bus_dispatcher_dispatch(dispatcher, fifo->msg);
+                gst_message_unref(fifo->msg);
+            }
+            g_free(fifo);
+            fifo = next;
+        }
+    }
+    return NULL;
+}
+
+BusDispatcher *bus_dispatcher_new(GstElement *pipeline, const BusDispatcherCallbacks *callbacks, gpointer user_data)
+{
+    BusDispatcher *dispatcher = g_new0(BusDispatcher, 1);
+
+    dispatcher->pipeline = pipeline;
+    dispatcher->callbacks = *callbacks;
+    dispatcher->user_data = user_data;
+    g_mutex_init(&dispatcher->lock);
+    g_cond_init(&dispatcher->wake);
+
+    dispatcher->thread = g_thread_new("bus-dispatcher", (GThreadFunc)bus_dispatcher_thread, dispatcher);
+    dispatcher->bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(dispatcher->bus, (GstBusSyncHandler)bus_dispatcher_sync_handler, dispatcher, NULL);
+    return dispatcher;
+}
+
+void bus_dispatcher_get_stats(BusDispatcher *dispatcher, BusDispatcherStats *stats)
+{
+    stats->posted = g_atomic_int_get(&dispatcher->posted);
+    stats->dropped = g_atomic_int_get(&dispatcher->dropped);
+    stats->wakeups = g_atomic_int_get(&dispatcher->wakeups);
+}
+
+void bus_dispatcher_free(BusDispatcher *dispatcher)
+{
+    gst_bus_set_sync_handler(dispatcher->bus, NULL, NULL, NULL);
+    gst_object_unref(dispatcher->bus);
+
+    /* Stop marker: everything queued before it is still dispatched */
+    bus_dispatcher_push(dispatcher, NULL);
+    g_thread_join(dispatcher->thread);
+
+    g_cond_clear(&dispatcher->wake);
+    g_mutex_clear(&dispatcher->lock);
+    g_free(dispatcher);
+}
@@ -0,0 +1,48 @@
+#include "CpuUsage.h"
+
+#include <stdio.h>
+#include <string.h>
+
+std::vector<CpuTimes> cpu_usage_sample(void)
+{
+    std::vector<CpuTimes> cores;
+    FILE *stat = fopen("/proc/stat", "r");
+    char line[512];
+
+    if (stat == NULL)
+        return cores;
+
+    while (fgets(line, sizeof(line), stat) != NULL)
+    {
+        unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+        CpuTimes times;
+
+        /* Only "cpuN" lines, the first "cpu " line is the sum of all of them */
+        if (strncmp(line, "cpu", 3) != 0 || !g_ascii_isdigit(line[3]))
+            continue;
+
+        if (sscanf(line, "%*s %llu %llu %llu %llu %llu %llu %llu %llu",
+                   &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) != 8)
+            continue;
+
+        times.busy = user + nice + system + irq + softirq + steal;
+        times.total = times.busy + idle + iowait;
+        cores.push_back(times);
+    }
+    fclose(stat);
+    return cores;
+}
+
+std::vector<double> cpu_usage_between(const std::vector<CpuTimes> &before,
+                                      const std::vector<CpuTimes> &after)
+{
+    std::vector<double> usage;
+
+    for (size_t i = 0; i < before.size() && i < after.size(); i++)
+    {
+        guint64 total = after[i].total - before[i].total;
+        guint64 busy = after[i].busy - before[i].busy;
+        usage.push_back(total > 0 ? 100.0 * busy / total : 0.0);
+    }
+    return usage;
+}
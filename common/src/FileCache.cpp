@@ -0,0 +1,50 @@
+#include "FileCache.h"
+
+#include <glib/gstdio.h>
+
+gchar *file_cache_local_path(const gchar *uri)
+{
+    gchar *scheme = g_uri_parse_scheme(uri);
+    gchar *path;
+
+    if (scheme == NULL)
+        path = g_strdup(uri);
+    else if (g_ascii_strcasecmp(scheme, "file") == 0)
+        path = g_filename_from_uri(uri, NULL, NULL);
+    else
+        path = NULL;
+    g_free(scheme);
+    return path;
+}
+
+gchar *file_cache_path(const gchar *path, const gchar *kind, const gchar *extension)
+{
+    GStatBuf st;
+    gchar *absolute, *identity, *key, *name, *cache_path;
+
+    if (g_stat(path, &st) != 0)
+        return NULL;
+    absolute = g_canonicalize_filename(path, NULL);
+    identity = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT,
+        absolute, (gint64)st.st_size, (gint64)st.st_mtime);
+    key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, identity, -1);
+    name = g_strdup_printf("%s.%s", key, extension);
+    cache_path = g_build_filename(g_get_user_cache_dir(), "gst-tutorials", kind, name, NULL);
+
+    g_free(name);
+    g_free(key);
+    g_free(identity);
+    g_free(absolute);
+    return cache_path;
+}
+
+gboolean file_cache_store(const gchar *cache_path, const gchar *contents, gssize length)
+{
+    gchar *dir = g_path_get_dirname(cache_path);
+    gboolean ok;
+
+    /* g_file_set_contents writes a temporary file and renames it */
+    ok = g_mkdir_with_parents(dir, 0755) == 0 && g_file_set_contents(cache_path, contents, length, NULL);
+    g_free(dir);
+    return ok;
+}
@@ -0,0 +1,83 @@
+#include "KeyframeFilter.h"
+
+#include <string.h>
+
+struct _KeyframeFilter {
+    GstElement *pipeline;
+    gulong element_added_id;
+    gint mode;                  /* KeyframeFilterMode */
+    gint decoded;
+    gint skipped;
+};
+
+static GstPadProbeReturn keyframe_filter_probe_cb(GstPad *pad, GstPadProbeInfo *info, KeyframeFilter *filter)
+{
+    gint mode = g_atomic_int_get(&filter->mode);
+
+    if (mode == KEYFRAME_FILTER_PASS)
+        return GST_PAD_PROBE_OK;
+    if (mode == KEYFRAME_FILTER_DROP &&
+        GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT))
+    {
+        g_atomic_int_inc(&filter->skipped);
+        return GST_PAD_PROBE_DROP;
+    }
+    g_atomic_int_inc(&filter->decoded);
+    return GST_PAD_PROBE_OK;
+}
+
+/* Puts the probe on the sink pad of every video decoder plugged */
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, KeyframeFilter *filter)
+{
+    GstElementFactory *factory = gst_element_get_factory(element);
+    const gchar *klass;
+    GstPad *pad;
+
+    if (factory == NULL)
+        return;
+    klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    if (klass == NULL || strstr(klass, "Decoder") == NULL || strstr(klass, "Video") == NULL)
+        return;
+
+    pad = gst_element_get_static_pad(element, "sink");
+    if (pad != NULL)
+    {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)keyframe_filter_probe_cb, filter, NULL);
+        gst_object_unref(pad);
+    }
+}
+
+KeyframeFilter *keyframe_filter_new(GstElement *pipeline, KeyframeFilterMode mode)
+{
+    KeyframeFilter *filter = g_new0(KeyframeFilter, 1);
+
+    filter->pipeline = (GstElement *)gst_object_ref(pipeline);
+    filter->mode = mode;
+    filter->element_added_id = g_signal_connect(pipeline, "deep-element-added",
+                                                G_CALLBACK(deep_element_added_cb), filter);
+    return filter;
+}
+
+void keyframe_filter_set_mode(KeyframeFilter *filter, KeyframeFilterMode mode)
+{
+    g_atomic_int_set(&filter->mode, mode);
+}
+
+void keyframe_filter_get_stats(KeyframeFilter *filter, KeyframeFilterStats *stats)
+{
+    stats->decoded = g_atomic_int_get(&filter->decoded);
+    stats->skipped = g_atomic_int_get(&filter->skipped);
+}
+
+void keyframe_filter_reset_stats(KeyframeFilter *filter)
+{
+    g_atomic_int_set(&filter->decoded, 0);
+    g_atomic_int_set(&filter->skipped, 0);
+}
+
+void keyframe_filter_free(KeyframeFilter *filter)
+{
+    g_signal_handler_disconnect(filter->pipeline, filter->element_added_id);
+    gst_object_unref(filter->pipeline);
+    g_free(filter);
+}
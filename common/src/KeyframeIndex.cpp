@@ -0,0 +1,257 @@
+#include "KeyframeIndex.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+#include "FileCache.h"
+
+#define INDEX_MAGIC "keyframe-index 2"
+
+struct _KeyframeIndex {
+    std::vector<GstClockTime> keyframes;    /* Sorted */
+    guint64 frames;
+    GstClockTime duration;
+};
+
+/* What a scan collects. Only touched by the streaming thread until EOS */
+typedef struct _Scan {
+    KeyframeIndex *index;
+    GstPad *video_pad;                  /* The parsed stream we index */
+} Scan;
+
+gchar *keyframe_index_cache_path(const gchar *path)
+{
+    return file_cache_path(path, "keyframes", "idx");
+}
+
+/* The magic line, "frames duration", then one keyframe timestamp per line */
+KeyframeIndex *keyframe_index_load(const gchar *path)
+{
+    gchar *cache_path = keyframe_index_cache_path(path);
+    gchar *contents = NULL;
+    gchar **lines;
+    KeyframeIndex *index = NULL;
+
+    if (cache_path == NULL || !g_file_get_contents(cache_path, &contents, NULL, NULL))
+    {
+        g_free(cache_path);
+        return NULL;
+    }
+
+    lines = g_strsplit(contents, "\n", -1);
+    if (g_strv_length(lines) > 2 && g_strcmp0(lines[0], INDEX_MAGIC) == 0)
+    {
+        index = new KeyframeIndex();
+        if (sscanf(lines[1], "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &index->frames, &index->duration) != 2)
+            index->frames = 0;
+        for (gchar **line = lines + 2; *line != NULL; line++)
+        {
+            GstClockTime pts;
+
+            if (sscanf(*line, "%" G_GUINT64_FORMAT, &pts) == 1)
+                index->keyframes.push_back(pts);
+        }
+        if (index->frames == 0 || index->keyframes.empty())
+            g_clear_pointer(&index, keyframe_index_free);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    g_free(cache_path);
+    return index;
+}
+
+static gboolean keyframe_index_save(KeyframeIndex *index, const gchar *path)
+{
+    gchar *cache_path = keyframe_index_cache_path(path);
+    std::string contents = INDEX_MAGIC "\n";
+    gchar *line;
+    gboolean ok;
+
+    if (cache_path == NULL)
+        return FALSE;
+    line = g_strdup_printf("%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n", index->frames, index->duration);
+    contents += line;
+    g_free(line);
+    for (GstClockTime pts : index->keyframes)
+    {
+        line = g_strdup_printf("%" G_GUINT64_FORMAT "\n", pts);
+        contents += line;
+        g_free(line);
+    }
+
+    ok = file_cache_store(cache_path, contents.c_str(), contents.size());
+    g_free(cache_path);
+    return ok;
+}
+
+static GstPadProbeReturn keyframe_probe_cb(GstPad *pad, GstPadProbeInfo *info, Scan *scan)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime pts = GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) : GST_BUFFER_DTS(buffer);
+
+    scan->index->frames++;
+    if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) && GST_CLOCK_TIME_IS_VALID(pts))
+        scan->index->keyframes.push_back(pts);
+    return GST_PAD_PROBE_OK;
+}
+
+/* Every stream goes to a fakesink, the first video one is indexed on the way */
+static void pad_added_cb(GstElement *parsebin, GstPad *pad, Scan *scan)
+{
+    GstElement *pipeline = GST_ELEMENT(gst_element_get_parent(parsebin));
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstPad *sink_pad;
+
+    g_object_set(sink, "sync", FALSE, NULL);
+    gst_bin_add(GST_BIN(pipeline), sink);
+    sink_pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_link(pad, sink_pad);
+    gst_object_unref(sink_pad);
+    gst_element_sync_state_with_parent(sink);
+
+    if (scan->video_pad == NULL && caps != NULL &&
+        g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/"))
+    {
+        scan->video_pad = pad;
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)keyframe_probe_cb, scan, NULL);
+    }
+    if (caps != NULL)
+        gst_caps_unref(caps);
+    gst_object_unref(pipeline);
+}
+
+KeyframeIndex *keyframe_index_build(const gchar *path)
+{
+    GstElement *pipeline = gst_pipeline_new(NULL);
+    GstElement *source = gst_element_factory_make("filesrc", NULL);
+    GstElement *parsebin = gst_element_factory_make("parsebin", NULL);
+    Scan scan = { new KeyframeIndex(), NULL };
+    GstBus *bus;
+    GstMessage *msg;
+    gint64 duration;
+
+    scan.index->frames = 0;
+    scan.index->duration = GST_CLOCK_TIME_NONE;
+    if (source == NULL || parsebin == NULL)
+    {
+        g_printerr("Not all elements could be created.\n");
+        if (source != NULL)
+            gst_object_unref(source);
+        if (parsebin != NULL)
+            gst_object_unref(parsebin);
+        gst_object_unref(pipeline);
+        keyframe_index_free(scan.index);
+        return NULL;
+    }
+    g_object_set(source, "location", path, NULL);
+    gst_bin_add_many(GST_BIN(pipeline), source, parsebin, NULL);
+    gst_element_link(source, parsebin);
+    g_signal_connect(parsebin, "pad-added", G_CALLBACK(pad_added_cb), &scan);
+
+    /* As fast as the file can be read and demuxed */
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    bus = gst_element_get_bus(pipeline);
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+    {
+        GError *err;
+
+        gst_message_parse_error(msg, &err, NULL);
+        g_printerr("Could not index %s: %s\n", path, err->message);
+        g_clear_error(&err);
+        scan.index->keyframes.clear();
+    }
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+    if (gst_element_query_duration(pipeline, GST_FORMAT_TIME, &duration))
+        scan.index->duration = duration;
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    /* Demuxers do not always output in presentation order */
+    std::vector<GstClockTime> &keyframes = scan.index->keyframes;
+    std::sort(keyframes.begin(), keyframes.end());
+    keyframes.erase(std::unique(keyframes.begin(), keyframes.end()), keyframes.end());
+
+    if (keyframes.empty())
+    {
+        keyframe_index_free(scan.index);
+        return NULL;
+    }
+    if (!keyframe_index_save(scan.index, path))
+        g_printerr("Could not store the keyframe index of %s\n", path);
+    return scan.index;
+}
+
+KeyframeIndex *keyframe_index_open(const gchar *path)
+{
+    KeyframeIndex *index = keyframe_index_load(path);
+
+    if (index == NULL)
+        index = keyframe_index_build(path);
+    return index;
+}
+
+typedef struct _OpenRequest {
+    gchar *path;
+    KeyframeIndexReadyFunc func;
+    gpointer user_data;
+} OpenRequest;
+
+static gpointer open_thread(OpenRequest *request)
+{
+    request->func(keyframe_index_open(request->path), request->user_data);
+    g_free(request->path);
+    g_free(request);
+    return NULL;
+}
+
+void keyframe_index_open_async(const gchar *path, KeyframeIndexReadyFunc func, gpointer user_data)
+{
+    OpenRequest *request = g_new(OpenRequest, 1);
+
+    request->path = g_strdup(path);
+    request->func = func;
+    request->user_data = user_data;
+    g_thread_unref(g_thread_new("keyframe-index", (GThreadFunc)open_thread, request));
+}
+
+GstClockTime keyframe_index_lookup(KeyframeIndex *index, GstClockTime target)
+{
+    auto it = std::upper_bound(index->keyframes.begin(), index->keyframes.end(), target);
+
+    /* Before the first keyframe there is nothing to snap to but the first one */
+    if (it == index->keyframes.begin())
+        return index->keyframes.front();
+    return *(it - 1);
+}
+
+guint keyframe_index_get_size(KeyframeIndex *index)
+{
+    return index->keyframes.size();
+}
+
+GstClockTime keyframe_index_get_keyframe(KeyframeIndex *index, guint i)
+{
+    return index->keyframes[i];
+}
+
+guint64 keyframe_index_get_frames(KeyframeIndex *index)
+{
+    return index->frames;
+}
+
+GstClockTime keyframe_index_get_duration(KeyframeIndex *index)
+{
+    return index->duration;
+}
+
+void keyframe_index_free(KeyframeIndex *index)
+{
+    delete index;
+}
@@ -0,0 +1,234 @@
+#include "MediaInfoCache.h"
+
+#include <glib/gstdio.h>
+#include <gst/pbutils/pbutils.h>
+
+#include "FileCache.h"
+
+#define MEDIA_GROUP "media"
+
+/* A scan shared by its workers */
+typedef struct _Scan {
+    gboolean force;
+    GstClockTime timeout;
+    MediaInfoScanFunc func;
+    gpointer user_data;
+} Scan;
+
+static gchar *stream_group(guint i)
+{
+    return g_strdup_printf("stream %u", i);
+}
+
+MediaInfo *media_info_cache_lookup(const gchar *path)
+{
+    gchar *cache_path = file_cache_path(path, "media-info", "ini");
+    GKeyFile *file = g_key_file_new();
+    MediaInfo *info = NULL;
+
+    if (cache_path != NULL && g_key_file_load_from_file(file, cache_path, G_KEY_FILE_NONE, NULL) &&
+        g_key_file_has_group(file, MEDIA_GROUP))
+    {
+        info = g_new0(MediaInfo, 1);
+        info->duration = g_key_file_get_uint64(file, MEDIA_GROUP, "duration", NULL);
+        info->seekable = g_key_file_get_boolean(file, MEDIA_GROUP, "seekable", NULL);
+        info->bitrate = g_key_file_get_integer(file, MEDIA_GROUP, "bitrate", NULL);
+        info->n_streams = g_key_file_get_integer(file, MEDIA_GROUP, "streams", NULL);
+        info->streams = g_new0(MediaStreamInfo, info->n_streams);
+        for (guint i = 0; i < info->n_streams; i++)
+        {
+            gchar *group = stream_group(i);
+            MediaStreamInfo *stream = &info->streams[i];
+
+            stream->type = g_key_file_get_string(file, group, "type", NULL);
+            stream->codec = g_key_file_get_string(file, group, "codec", NULL);
+            stream->language = g_key_file_get_string(file, group, "language", NULL);
+            stream->bitrate = g_key_file_get_integer(file, group, "bitrate", NULL);
+            if (stream->type == NULL)
+                stream->type = g_strdup("other");
+            g_free(group);
+        }
+    }
+    g_key_file_free(file);
+    g_free(cache_path);
+    return info;
+}
+
+static void media_info_store(const gchar *path, const MediaInfo *info)
+{
+    gchar *cache_path = file_cache_path(path, "media-info", "ini");
+    GKeyFile *file;
+    gchar *contents;
+    gsize length;
+
+    if (cache_path == NULL)
+        return;
+    file = g_key_file_new();
+    g_key_file_set_uint64(file, MEDIA_GROUP, "duration", info->duration);
+    g_key_file_set_boolean(file, MEDIA_GROUP, "seekable", info->seekable);
+    g_key_file_set_integer(file, MEDIA_GROUP, "bitrate", info->bitrate);
+    g_key_file_set_integer(file, MEDIA_GROUP, "streams", info->n_streams);
+    for (guint i = 0; i < info->n_streams; i++)
+    {
+        gchar *group = stream_group(i);
+        const MediaStreamInfo *stream = &info->streams[i];
+
+        g_key_file_set_string(file, group, "type", stream->type);
+        if (stream->codec != NULL)
+            g_key_file_set_string(file, group, "codec", stream->codec);
+        if (stream->language != NULL)
+            g_key_file_set_string(file, group, "language", stream->language);
+        g_key_file_set_integer(file, group, "bitrate", stream->bitrate);
+        g_free(group);
+    }
+
+    contents = g_key_file_to_data(file, &length, NULL);
+    if (!file_cache_store(cache_path, contents, length))
+        g_printerr("Could not store the media information of %s\n", path);
+    g_free(contents);
+    g_key_file_free(file);
+    g_free(cache_path);
+}
+
+/* Fills stream from what the discoverer found about one elementary stream */
+static void fill_stream(MediaStreamInfo *stream, GstDiscovererStreamInfo *stream_info)
+{
+    GstCaps *caps = gst_discoverer_stream_info_get_caps(stream_info);
+    const GstTagList *tags = gst_discoverer_stream_info_get_tags(stream_info);
+    const gchar *language = NULL;
+
+    if (GST_IS_DISCOVERER_VIDEO_INFO(stream_info))
+    {
+        stream->type = g_strdup("video");
+        stream->bitrate = gst_discoverer_video_info_get_bitrate(GST_DISCOVERER_VIDEO_INFO(stream_info));
+    }
+    else if (GST_IS_DISCOVERER_AUDIO_INFO(stream_info))
+    {
+        stream->type = g_strdup("audio");
+        stream->bitrate = gst_discoverer_audio_info_get_bitrate(GST_DISCOVERER_AUDIO_INFO(stream_info));
+        language = gst_discoverer_audio_info_get_language(GST_DISCOVERER_AUDIO_INFO(stream_info));
+    }
+    else if (GST_IS_DISCOVERER_SUBTITLE_INFO(stream_info))
+    {
+        stream->type = g_strdup("subtitle");
+        language = gst_discoverer_subtitle_info_get_language(GST_DISCOVERER_SUBTITLE_INFO(stream_info));
+    }
+    else
+    {
+        stream->type = g_strdup("other");
+    }
+
+    stream->language = g_strdup(language);
+    if (caps != NULL)
+    {
+        stream->codec = gst_pb_utils_get_codec_description(caps);
+        gst_caps_unref(caps);
+    }
+    if (stream->bitrate == 0 && tags != NULL &&
+        !gst_tag_list_get_uint(tags, GST_TAG_BITRATE, &stream->bitrate))
+        gst_tag_list_get_uint(tags, GST_TAG_NOMINAL_BITRATE, &stream->bitrate);
+}
+
+MediaInfo *media_info_cache_discover(const gchar *path, GstClockTime timeout)
+{
+    GstDiscoverer *discoverer;
+    GstDiscovererInfo *discovered;
+    GList *streams;
+    MediaInfo *info;
+    gchar *uri;
+    GError *err = NULL;
+    GStatBuf st;
+    guint i = 0;
+
+    gst_pb_utils_init();
+    uri = gst_filename_to_uri(path, &err);
+    discoverer = uri != NULL ? gst_discoverer_new(timeout, &err) : NULL;
+    if (discoverer == NULL)
+    {
+        g_printerr("Could not discover %s: %s\n", path, err->message);
+        g_clear_error(&err);
+        g_free(uri);
+        return NULL;
+    }
+
+    discovered = gst_discoverer_discover_uri(discoverer, uri, &err);
+    g_free(uri);
+    g_object_unref(discoverer);
+    if (discovered == NULL || gst_discoverer_info_get_result(discovered) != GST_DISCOVERER_OK)
+    {
+        g_printerr("Could not discover %s: %s\n", path, err != NULL ? err->message : "unknown error");
+        g_clear_error(&err);
+        if (discovered != NULL)
+            gst_discoverer_info_unref(discovered);
+        return NULL;
+    }
+    g_clear_error(&err);
+
+    info = g_new0(MediaInfo, 1);
+    info->duration = gst_discoverer_info_get_duration(discovered);
+    info->seekable = gst_discoverer_info_get_seekable(discovered);
+
+    /* The elementary streams, containers are only their parents */
+    streams = gst_discoverer_info_get_stream_list(discovered);
+    for (GList *l = streams; l != NULL; l = l->next)
+    {
+        if (!GST_IS_DISCOVERER_CONTAINER_INFO(l->data))
+            info->n_streams++;
+    }
+    info->streams = g_new0(MediaStreamInfo, info->n_streams);
+    for (GList *l = streams; l != NULL; l = l->next)
+    {
+        if (!GST_IS_DISCOVERER_CONTAINER_INFO(l->data))
+            fill_stream(&info->streams[i++], GST_DISCOVERER_STREAM_INFO(l->data));
+    }
+    gst_discoverer_stream_info_list_free(streams);
+    gst_discoverer_info_unref(discovered);
+
+    /* The average over the whole file, whatever its streams announce */
+    if (GST_CLOCK_TIME_IS_VALID(info->duration) && info->duration > 0 && g_stat(path, &st) == 0)
+        info->bitrate = (guint)gst_util_uint64_scale(st.st_size * 8, GST_SECOND, info->duration);
+
+    media_info_store(path, info);
+    return info;
+}
+
+static void scan_file(gchar *path, Scan *scan)
+{
+    MediaInfo *info = scan->force ? NULL : media_info_cache_lookup(path);
+    gboolean cached = (info != NULL);
+
+    if (!cached)
+        info = media_info_cache_discover(path, scan->timeout);
+    scan->func(path, info, cached, scan->user_data);
+    if (info != NULL)
+        media_info_free(info);
+}
+
+void media_info_cache_scan(gchar **paths, guint n_workers, gboolean force, GstClockTime timeout,
+                           MediaInfoScanFunc func, gpointer user_data)
+{
+    Scan scan = { force, timeout, func, user_data };
+    GThreadPool *pool;
+
+    /* Once, before the workers need it */
+    gst_pb_utils_init();
+    pool = g_thread_pool_new((GFunc)scan_file, &scan, MAX(n_workers, 1), TRUE, NULL);
+
+    for (gchar **path = paths; *path != NULL; path++)
+        g_thread_pool_push(pool, *path, NULL);
+
+    /* Waits for the queued files */
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+void media_info_free(MediaInfo *info)
+{
+    for (guint i = 0; i < info->n_streams; i++)
+    {
+        g_free(info->streams[i].type);
+        g_free(info->streams[i].codec);
+        g_free(info->streams[i].language);
+    }
+    g_free(info->streams);
+    g_free(info);
+}
@@ -0,0 +1,237 @@
+#include "PositionTracker.h"
+
+#include <atomic>
+
+struct _PositionTracker {
+    GstElement *pipeline;
+    GstClockTime check_interval;
+    GstClockTime drift_threshold;
+
+    GMutex lock;                        /* Serialises the writers, readers never take it */
+    GSList *clocks;                     /* Every clock anchored to, kept alive for the readers */
+    std::atomic<gboolean> valid;        /* Cleared by position_tracker_invalidate */
+
+    /* The anchor. Written under seq, which is odd while a write is going on */
+    std::atomic<guint> seq;
+    std::atomic<gint64> position;       /* -1 while the pipeline cannot tell */
+    std::atomic<gint64> duration;       /* -1 when unknown */
+    std::atomic<GstClockTime> anchored_at;  /* Clock time of the query */
+    std::atomic<gdouble> rate;
+    std::atomic<gboolean> playing;
+    std::atomic<GstClock *> clock;      /* NULL before the pipeline picked one */
+
+    gint reads;
+    gint queries;
+    gint corrections;
+};
+
+/* A consistent copy of the anchor */
+typedef struct _Anchor {
+    gint64 position;
+    gint64 duration;
+    GstClockTime anchored_at;
+    gdouble rate;
+    gboolean playing;
+    GstClock *clock;
+} Anchor;
+
+static void position_tracker_read(PositionTracker *tracker, Anchor *anchor)
+{
+    guint before, after;
+
+    do
+    {
+        before = tracker->seq.load(std::memory_order_acquire);
+        anchor->position = tracker->position.load(std::memory_order_relaxed);
+        anchor->duration = tracker->duration.load(std::memory_order_relaxed);
+        anchor->anchored_at = tracker->anchored_at.load(std::memory_order_relaxed);
+        anchor->rate = tracker->rate.load(std::memory_order_relaxed);
+        anchor->playing = tracker->playing.load(std::memory_order_relaxed);
+        anchor->clock = tracker->clock.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = tracker->seq.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+}
+
+static void position_tracker_write(PositionTracker *tracker, const Anchor *anchor)
+{
+    guint seq = tracker->seq.load(std::memory_order_relaxed);
+
+    tracker->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    tracker->position.store(anchor->position, std::memory_order_relaxed);
+    tracker->duration.store(anchor->duration, std::memory_order_relaxed);
+    tracker->anchored_at.store(anchor->anchored_at, std::memory_order_relaxed);
+    tracker->rate.store(anchor->rate, std::memory_order_relaxed);
+    tracker->playing.store(anchor->playing, std::memory_order_relaxed);
+    tracker->clock.store(anchor->clock, std::memory_order_relaxed);
+    tracker->seq.store(seq + 2, std::memory_order_release);
+}
+
+/* Where the pipeline should be now according to anchor */
+static gint64 position_tracker_extrapolate(const Anchor *anchor, GstClockTime now)
+{
+    gint64 position = anchor->position;
+
+    if (anchor->playing && GST_CLOCK_TIME_IS_VALID(now) && now > anchor->anchored_at)
+        position += (gint64)((now - anchor->anchored_at) * anchor->rate);
+    if (position < 0)
+        position = 0;
+    if (anchor->duration >= 0 && position > anchor->duration)
+        position = anchor->duration;
+    return position;
+}
+
+static GstClockTime position_tracker_now(GstClock *clock)
+{
+    return clock != NULL ? gst_clock_get_time(clock) : GST_CLOCK_TIME_NONE;
+}
+
+/* Queries the pipeline and anchors to the answer. Called with the lock held */
+static void position_tracker_anchor(PositionTracker *tracker, Anchor *anchor)
+{
+    GstClock *clock = gst_element_get_clock(tracker->pipeline);
+    GstQuery *query;
+    GstState state = GST_STATE_NULL;
+    gint64 position = -1, duration = -1;
+
+    /* The readers may still hold the clock we anchored to before */
+    if (clock != NULL)
+    {
+        if (g_slist_find(tracker->clocks, clock) == NULL)
+            tracker->clocks = g_slist_prepend(tracker->clocks, gst_object_ref(clock));
+        gst_object_unref(clock);
+    }
+
+    g_atomic_int_inc(&tracker->queries);
+    if (!gst_element_query_position(tracker->pipeline, GST_FORMAT_TIME, &position))
+        position = -1;
+    anchor->anchored_at = position_tracker_now(clock);
+    anchor->position = position;
+    anchor->clock = clock;
+
+    /* Only the current state, a pending change will invalidate us when it is done */
+    gst_element_get_state(tracker->pipeline, &state, NULL, 0);
+    anchor->playing = (state == GST_STATE_PLAYING);
+
+    anchor->rate = 1.0;
+    query = gst_query_new_segment(GST_FORMAT_TIME);
+    if (gst_element_query(tracker->pipeline, query))
+        gst_query_parse_segment(query, &anchor->rate, NULL, NULL, NULL);
+    gst_query_unref(query);
+
+    if (!gst_element_query_duration(tracker->pipeline, GST_FORMAT_TIME, &duration))
+        duration = -1;
+    anchor->duration = duration;
+
+    position_tracker_write(tracker, anchor);
+}
+
+PositionTracker *position_tracker_new(GstElement *pipeline, GstClockTime check_interval,
+                                      GstClockTime drift_threshold)
+{
+    PositionTracker *tracker = new PositionTracker();
+
+    tracker->pipeline = pipeline;
+    tracker->check_interval = check_interval;
+    tracker->drift_threshold = drift_threshold;
+    g_mutex_init(&tracker->lock);
+    tracker->clocks = NULL;
+    tracker->valid = FALSE;
+    tracker->seq = 0;
+    tracker->position = -1;
+    tracker->duration = -1;
+    tracker->anchored_at = GST_CLOCK_TIME_NONE;
+    tracker->rate = 1.0;
+    tracker->playing = FALSE;
+    tracker->clock = NULL;
+    tracker->reads = 0;
+    tracker->queries = 0;
+    tracker->corrections = 0;
+    return tracker;
+}
+
+void position_tracker_invalidate(PositionTracker *tracker)
+{
+    tracker->valid.store(FALSE, std::memory_order_release);
+}
+
+/* Anchors again if invalidated, then copies the anchor */
+static void position_tracker_current(PositionTracker *tracker, Anchor *anchor)
+{
+    if (!tracker->valid.load(std::memory_order_acquire))
+    {
+        g_mutex_lock(&tracker->lock);
+        /* Set before the queries, so an invalidation that comes during them is not lost */
+        if (tracker->valid.exchange(TRUE))
+        {
+            g_mutex_unlock(&tracker->lock);
+            position_tracker_read(tracker, anchor);
+            return;
+        }
+        position_tracker_anchor(tracker, anchor);
+        /* Nothing to extrapolate from yet, ask again next time */
+        if (anchor->position < 0)
+            tracker->valid.store(FALSE, std::memory_order_release);
+        g_mutex_unlock(&tracker->lock);
+        return;
+    }
+    position_tracker_read(tracker, anchor);
+}
+
+gboolean position_tracker_get_position(PositionTracker *tracker, gint64 *position)
+{
+    Anchor anchor;
+    GstClockTime now;
+
+    g_atomic_int_inc(&tracker->reads);
+    position_tracker_current(tracker, &anchor);
+    if (anchor.position < 0)
+        return FALSE;
+
+    now = position_tracker_now(anchor.clock);
+    *position = position_tracker_extrapolate(&anchor, now);
+
+    /* Time to check the extrapolation. Whoever is already anchoring will do */
+    if (anchor.playing && GST_CLOCK_TIME_IS_VALID(now) &&
+        now - anchor.anchored_at >= tracker->check_interval && g_mutex_trylock(&tracker->lock))
+    {
+        Anchor fresh;
+
+        position_tracker_anchor(tracker, &fresh);
+        g_mutex_unlock(&tracker->lock);
+        if (fresh.position >= 0)
+        {
+            gint64 expected = position_tracker_extrapolate(&anchor, fresh.anchored_at);
+            if ((GstClockTime)ABS(expected - fresh.position) > tracker->drift_threshold)
+                g_atomic_int_inc(&tracker->corrections);
+            *position = fresh.position;
+        }
+    }
+    return TRUE;
+}
+
+gboolean position_tracker_get_duration(PositionTracker *tracker, gint64 *duration)
+{
+    Anchor anchor;
+
+    position_tracker_current(tracker, &anchor);
+    if (anchor.duration < 0)
+        return FALSE;
+    *duration = anchor.duration;
+    return TRUE;
+}
+
+void position_tracker_get_stats(PositionTracker *tracker, PositionTrackerStats *stats)
+{
+    stats->reads = g_atomic_int_get(&tracker->reads);
+    stats->queries = g_atomic_int_get(&tracker->queries);
+    stats->corrections = g_atomic_int_get(&tracker->corrections);
+}
+
+void position_tracker_free(PositionTracker *tracker)
+{
+    g_slist_free_full(tracker->clocks, gst_object_unref);
+    g_mutex_clear(&tracker->lock);
+    delete tracker;
+}
@@ -0,0 +1,27 @@
+#include "Preroll.h"
+
+gboolean preroll_wait(GstElement *pipeline, GstClockTime timeout, const gchar *what)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, timeout,
+        (GstMessageType)(GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR));
+    gboolean ok = (msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ASYNC_DONE);
+
+    if (msg != NULL && !ok)
+    {
+        GError *err;
+
+        gst_message_parse_error(msg, &err, NULL);
+        g_printerr("%s%sError received from element %s: %s\n", what != NULL ? what : "", what != NULL ? ": " : "",
+            GST_OBJECT_NAME(msg->src), err->message);
+        g_clear_error(&err);
+    }
+    else if (msg == NULL)
+    {
+        g_printerr("%s%sTimed out waiting for ASYNC_DONE.\n", what != NULL ? what : "", what != NULL ? ": " : "");
+    }
+    if (msg != NULL)
+        gst_message_unref(msg);
+    gst_object_unref(bus);
+    return ok;
+}
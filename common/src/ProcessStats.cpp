@@ -0,0 +1,57 @@
+#include "ProcessStats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/* Reads the VmHWM line from /proc/self/status, in kilobytes */
+static gint64 read_vm_hwm(void)
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    char line[256];
+    gint64 value = -1;
+
+    if (status == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, "VmHWM:", 6) == 0)
+        {
+            value = g_ascii_strtoll(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(status);
+    return value;
+}
+
+void process_stats_sample(ProcessStats *stats)
+{
+    struct rusage usage;
+
+    stats->wall_time = g_get_monotonic_time();
+
+    getrusage(RUSAGE_SELF, &usage);
+    stats->cpu_time = (gint64)usage.ru_utime.tv_sec * G_USEC_PER_SEC + usage.ru_utime.tv_usec +
+                      (gint64)usage.ru_stime.tv_sec * G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+
+    /* ru_maxrss never goes down, so prefer VmHWM which can be reset */
+    stats->peak_rss = read_vm_hwm();
+    if (stats->peak_rss < 0)
+        stats->peak_rss = usage.ru_maxrss;
+}
+
+gboolean process_stats_reset_peak_rss(void)
+{
+    FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+    gboolean ok;
+
+    if (clear_refs == NULL)
+        return FALSE;
+
+    /* Writing "5" resets the peak RSS to the current RSS (Linux >= 4.0) */
+    ok = fputs("5", clear_refs) >= 0;
+    fclose(clear_refs);
+    return ok;
+}
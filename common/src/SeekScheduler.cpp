@@ -0,0 +1,91 @@
+#include "SeekScheduler.h"
+
+/* A seek in flight for longer than this is assumed lost, so a missing
+ * ASYNC_DONE cannot block the control for good, in ms */
+#define SEEK_TIMEOUT 2000
+
+struct _SeekScheduler {
+    GstElement *pipeline;
+    gboolean in_flight;
+    guint timeout_id;           /* Ends the seek in flight if no ASYNC_DONE comes */
+    gboolean pending;
+    gint64 pending_position;
+    GstSeekFlags pending_flags;
+    SeekSchedulerStats stats;
+};
+
+SeekScheduler *seek_scheduler_new(GstElement *pipeline)
+{
+    SeekScheduler *scheduler = g_new0(SeekScheduler, 1);
+
+    scheduler->pipeline = (GstElement *)gst_object_ref(pipeline);
+    return scheduler;
+}
+
+static void seek_scheduler_cancel_timeout(SeekScheduler *scheduler)
+{
+    if (scheduler->timeout_id != 0)
+    {
+        g_source_remove(scheduler->timeout_id);
+        scheduler->timeout_id = 0;
+    }
+}
+
+/* The seek in flight is lost: send the pending one as if it completed */
+static gboolean seek_timeout_cb(SeekScheduler *scheduler)
+{
+    scheduler->timeout_id = 0;
+    seek_scheduler_seek_done(scheduler);
+    return G_SOURCE_REMOVE;
+}
+
+static void seek_scheduler_issue(SeekScheduler *scheduler, gint64 position, GstSeekFlags flags)
+{
+    scheduler->pending = FALSE;
+    scheduler->stats.issued++;
+    scheduler->in_flight = gst_element_seek_simple(scheduler->pipeline, GST_FORMAT_TIME, flags, position);
+    seek_scheduler_cancel_timeout(scheduler);
+    if (scheduler->in_flight)
+        scheduler->timeout_id = g_timeout_add(SEEK_TIMEOUT, (GSourceFunc)seek_timeout_cb, scheduler);
+}
+
+void seek_scheduler_request(SeekScheduler *scheduler, gint64 position, GstSeekFlags flags)
+{
+    scheduler->stats.requested++;
+    if (scheduler->in_flight)
+    {
+        /* Only the latest target matters */
+        scheduler->pending = TRUE;
+        scheduler->pending_position = position;
+        scheduler->pending_flags = flags;
+        return;
+    }
+    seek_scheduler_issue(scheduler, position, flags);
+}
+
+void seek_scheduler_seek_done(SeekScheduler *scheduler)
+{
+    seek_scheduler_cancel_timeout(scheduler);
+    scheduler->in_flight = FALSE;
+    if (scheduler->pending)
+        seek_scheduler_issue(scheduler, scheduler->pending_position, scheduler->pending_flags);
+}
+
+void seek_scheduler_reset(SeekScheduler *scheduler)
+{
+    seek_scheduler_cancel_timeout(scheduler);
+    scheduler->in_flight = FALSE;
+    scheduler->pending = FALSE;
+}
+
+void seek_scheduler_get_stats(SeekScheduler *scheduler, SeekSchedulerStats *stats)
+{
+    *stats = scheduler->stats;
+}
+
+void seek_scheduler_free(SeekScheduler *scheduler)
+{
+    seek_scheduler_cancel_timeout(scheduler);
+    gst_object_unref(scheduler->pipeline);
+    g_free(scheduler);
+}
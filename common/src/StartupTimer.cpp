@@ -0,0 +1,187 @@
+#include "StartupTimer.h"
+
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+#include <glib/gstdio.h>
+
+/* A phase and when it happened, in microseconds since startup_timer_init */
+typedef struct _Phase {
+    std::string name;
+    gint64 at;
+} Phase;
+
+static gint64 start_time = 0;
+static GMutex phases_lock;
+static std::vector<Phase> phases;
+static gchar *cold_registry_dir = NULL;
+
+void startup_timer_init(void)
+{
+    start_time = g_get_monotonic_time();
+}
+
+void startup_timer_mark(const gchar *phase)
+{
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&phases_lock);
+    phases.push_back({ phase, now - start_time });
+    g_mutex_unlock(&phases_lock);
+}
+
+void startup_timer_use_cold_registry(void)
+{
+    gchar *registry;
+
+    cold_registry_dir = g_dir_make_tmp("startup-registry-XXXXXX", NULL);
+    if (cold_registry_dir == NULL)
+    {
+        g_printerr("Could not create a temporary registry, the registry will be warm.\n");
+        return;
+    }
+
+    /* GStreamer does not find a registry there, so it scans all plugins and writes one */
+    registry = g_build_filename(cold_registry_dir, "registry.bin", NULL);
+    g_setenv("GST_REGISTRY", registry, TRUE);
+    g_free(registry);
+
+    /* Removed on every way out of main(), not only after a successful run */
+    atexit(startup_timer_cleanup);
+}
+
+void startup_timer_cleanup(void)
+{
+    gchar *registry;
+
+    if (cold_registry_dir == NULL)
+        return;
+
+    registry = g_build_filename(cold_registry_dir, "registry.bin", NULL);
+    g_unlink(registry);
+    g_rmdir(cold_registry_dir);
+    g_free(registry);
+    g_clear_pointer(&cold_registry_dir, g_free);
+}
+
+/* Marks the phase passed as user data and removes itself */
+static GstPadProbeReturn first_buffer_probe_cb(GstPad *pad, GstPadProbeInfo *info, gchar *phase)
+{
+    startup_timer_mark(phase);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void startup_timer_watch_first_buffer(GstElement *element, const gchar *phase)
+{
+    GstPad *pad = gst_element_get_static_pad(element, "sink");
+
+    if (pad == NULL)
+    {
+        g_printerr("%s has no sink pad to watch.\n", GST_ELEMENT_NAME(element));
+        return;
+    }
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback)first_buffer_probe_cb, g_strdup(phase), g_free);
+    gst_object_unref(pad);
+}
+
+static void have_type_cb(GstElement *typefind, guint probability, GstCaps *caps, gpointer user_data)
+{
+    startup_timer_mark("typefound");
+}
+
+/* Called for every element added to the bin or any of its children */
+static void deep_element_added_cb(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+    GstElementFactory *factory = gst_element_get_factory(element);
+
+    if (factory != NULL && g_strcmp0(GST_OBJECT_NAME(factory), "typefind") == 0)
+        g_signal_connect(element, "have-type", G_CALLBACK(have_type_cb), NULL);
+}
+
+void startup_timer_watch_typefind(GstElement *bin)
+{
+    g_signal_connect(bin, "deep-element-added", G_CALLBACK(deep_element_added_cb), NULL);
+}
+
+void startup_timer_print_report(void)
+{
+    g_mutex_lock(&phases_lock);
+    for (const Phase &phase : phases)
+        g_print("startup %s %.3f\n", phase.name.c_str(), (double)phase.at / 1000.0);
+    g_mutex_unlock(&phases_lock);
+}
+
+/* Runs one child and collects the phases it printed */
+static gboolean run_child(const gchar *self, gchar **args, const gchar *mode, std::vector<Phase> &out)
+{
+    std::vector<gchar *> argv;
+    gchar *report_arg = g_strdup_printf("--startup-report=%s", mode);
+    gchar *output = NULL;
+    gchar **lines;
+    gint status;
+    GError *err = NULL;
+    gboolean ok;
+
+    argv.push_back((gchar *)self);
+    for (gchar **arg = args; arg != NULL && *arg != NULL; arg++)
+        argv.push_back(*arg);
+    argv.push_back(report_arg);
+    argv.push_back(NULL);
+
+    ok = g_spawn_sync(NULL, argv.data(), NULL, G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL,
+                      &output, NULL, &status, &err);
+    g_free(report_arg);
+    if (!ok)
+    {
+        g_printerr("Could not run %s: %s\n", self, err->message);
+        g_clear_error(&err);
+        return FALSE;
+    }
+
+    lines = g_strsplit(output, "\n", -1);
+    for (gchar **line = lines; *line != NULL; line++)
+    {
+        gchar **fields = g_strsplit(*line, " ", 3);
+        if (g_strv_length(fields) == 3 && g_strcmp0(fields[0], "startup") == 0)
+            out.push_back({ fields[1], (gint64)(g_ascii_strtod(fields[2], NULL) * 1000.0) });
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(output);
+    return TRUE;
+}
+
+int startup_timer_compare(const gchar *self, gchar **args)
+{
+    std::vector<Phase> cold, warm;
+    std::vector<Phase> priming;
+
+    /* The cold run leaves the default registry untouched, but run once more
+     * before measuring so the warm numbers do not include a stale-registry rescan */
+    if (!run_child(self, args, "cold", cold) ||
+        !run_child(self, args, "warm", priming) ||
+        !run_child(self, args, "warm", warm))
+        return -1;
+
+    g_print("%-32s %12s %12s\n", "phase", "cold (ms)", "warm (ms)");
+    for (const Phase &phase : cold)
+    {
+        const Phase *match = NULL;
+        for (const Phase &candidate : warm)
+        {
+            if (candidate.name == phase.name)
+            {
+                match = &candidate;
+                break;
+            }
+        }
+        if (match != NULL)
+            g_print("%-32s %12.3f %12.3f\n", phase.name.c_str(), phase.at / 1000.0, match->at / 1000.0);
+        else
+            g_print("%-32s %12.3f %12s\n", phase.name.c_str(), phase.at / 1000.0, "-");
+    }
+    return 0;
+}
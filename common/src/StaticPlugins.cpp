@@ -0,0 +1,25 @@
+#include "StaticPlugins.h"
+
+#include <gst/gst.h>
+
+void static_plugins_prepare(void)
+{
+    gchar *registry;
+
+    /* An empty system path means "scan nothing". GST_PLUGIN_PATH is left alone,
+     * so extra plugins can still be provided explicitly when debugging */
+    g_setenv("GST_PLUGIN_SYSTEM_PATH_1_0", "", TRUE);
+
+    /* Do not share the host's registry: ours only ever describes the (empty)
+     * scan above, so it stays tiny and is never invalidated by other plugins */
+    registry = g_build_filename(g_get_user_cache_dir(), "gstreamer-1.0",
+                                "registry-static-tutorials.bin", NULL);
+    g_setenv("GST_REGISTRY", registry, FALSE);
+    g_free(registry);
+
+    /* Once that registry exists, trust it instead of checking plugin mtimes */
+    g_setenv("GST_REGISTRY_UPDATE", "no", FALSE);
+
+    /* There is nothing to scan, so there is no point in forking a scanner */
+    gst_registry_fork_set_enabled(FALSE);
+}
@@ -0,0 +1,358 @@
+#include "StreamRouter.h"
+
+#include <string.h>
+
+/* Values of GstAutoplugSelectResult, which is not in the public headers */
+#define AUTOPLUG_SELECT_TRY    0
+#define AUTOPLUG_SELECT_EXPOSE 1
+
+/* Key of the branch linked to a decoder pad, in the pad's object data */
+#define BRANCH_KEY "stream-router-branch"
+/* Key of the StreamKind + 1 of a branch, in the branch's object data */
+#define KIND_KEY "stream-router-kind"
+
+struct _StreamRouter {
+    GstElement *pipeline;
+    GstElement *source;                 /* Element whose pads are routed */
+    gulong pad_added_id;
+    gulong pad_removed_id;
+    gulong autoplug_select_id;
+    StreamDecode decode;
+    GThreadPool *builder;               /* Builds branches away from the streaming threads */
+    StreamLinkedFunc linked;
+    gpointer user_data;
+
+    GMutex lock;                        /* Protects everything below */
+    GCond built;                        /* A build finished */
+    GQueue pool[STREAM_KIND_COUNT];     /* Branches in READY, waiting for a pad */
+    guint pending[STREAM_KIND_COUNT];   /* Builds queued or running */
+    guint target[STREAM_KIND_COUNT];    /* Branches to keep ready */
+    StreamRouterStats stats;
+};
+
+static const gchar *kind_names[STREAM_KIND_COUNT] = { "video", "audio" };
+
+/* Creates a branch for kind and brings it to READY. Returns a reference, or NULL */
+static GstElement *stream_router_build_branch(StreamKind kind)
+{
+    GstElement *branch = gst_bin_new(NULL);
+    GstElement *convert, *resample = NULL, *sink;
+    GstPad *pad;
+    gboolean linked;
+
+    gst_object_ref_sink(branch);
+    g_object_set_data(G_OBJECT(branch), KIND_KEY, GINT_TO_POINTER(kind + 1));
+    if (kind == STREAM_KIND_VIDEO)
+    {
+        convert = gst_element_factory_make("videoconvert", NULL);
+        sink = gst_element_factory_make("autovideosink", NULL);
+    }
+    else
+    {
+        convert = gst_element_factory_make("audioconvert", NULL);
+        resample = gst_element_factory_make("audioresample", NULL);
+        sink = gst_element_factory_make("autoaudiosink", NULL);
+    }
+
+    if (convert == NULL || sink == NULL || (kind == STREAM_KIND_AUDIO && resample == NULL))
+    {
+        g_printerr("Not all elements of a %s branch could be created.\n", kind_names[kind]);
+        if (convert != NULL)
+            gst_object_unref(convert);
+        if (resample != NULL)
+            gst_object_unref(resample);
+        if (sink != NULL)
+            gst_object_unref(sink);
+        gst_object_unref(branch);
+        return NULL;
+    }
+
+    if (resample != NULL)
+    {
+        gst_bin_add_many(GST_BIN(branch), convert, resample, sink, NULL);
+        linked = gst_element_link_many(convert, resample, sink, NULL);
+    }
+    else
+    {
+        gst_bin_add_many(GST_BIN(branch), convert, sink, NULL);
+        linked = gst_element_link(convert, sink);
+    }
+
+    pad = gst_element_get_static_pad(convert, "sink");
+    gst_element_add_pad(branch, gst_ghost_pad_new("sink", pad));
+    gst_object_unref(pad);
+
+    /* The slow part: the autodetect sinks look for a working sink and open it */
+    if (!linked || gst_element_set_state(branch, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("A %s branch could not be set up.\n", kind_names[kind]);
+        gst_element_set_state(branch, GST_STATE_NULL);
+        gst_object_unref(branch);
+        return NULL;
+    }
+    return branch;
+}
+
+/* Builder thread: data is the StreamKind + 1, GThreadPool does not take NULL */
+static void stream_router_build_func(gpointer data, gpointer user_data)
+{
+    StreamRouter *router = (StreamRouter *)user_data;
+    StreamKind kind = (StreamKind)(GPOINTER_TO_INT(data) - 1);
+    GstElement *branch = stream_router_build_branch(kind);
+
+    g_mutex_lock(&router->lock);
+    router->pending[kind]--;
+    if (branch != NULL)
+        g_queue_push_tail(&router->pool[kind], branch);
+    g_cond_broadcast(&router->built);
+    g_mutex_unlock(&router->lock);
+}
+
+/* Queues builds until the pool holds its target. Called with the lock held */
+static void stream_router_refill(StreamRouter *router, StreamKind kind)
+{
+    while (g_queue_get_length(&router->pool[kind]) + router->pending[kind] < router->target[kind])
+    {
+        router->pending[kind]++;
+        g_thread_pool_push(router->builder, GINT_TO_POINTER(kind + 1), NULL);
+    }
+}
+
+/* A ready branch for kind, with a reference. Returns NULL if none could be built */
+static GstElement *stream_router_take_branch(StreamRouter *router, StreamKind kind)
+{
+    GstElement *branch;
+
+    g_mutex_lock(&router->lock);
+    /* A build under way is done sooner than a new one */
+    while (g_queue_is_empty(&router->pool[kind]) && router->pending[kind] > 0)
+        g_cond_wait(&router->built, &router->lock);
+
+    branch = (GstElement *)g_queue_pop_head(&router->pool[kind]);
+    if (branch != NULL)
+        router->stats.pool_hits++;
+    else
+        router->stats.pool_misses++;
+    stream_router_refill(router, kind);
+    g_mutex_unlock(&router->lock);
+
+    if (branch == NULL)
+        branch = stream_router_build_branch(kind);
+    return branch;
+}
+
+static gboolean stream_router_pad_kind(GstPad *pad, StreamKind *kind)
+{
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    const gchar *type;
+    gboolean known = TRUE;
+
+    if (caps == NULL)
+        caps = gst_pad_query_caps(pad, NULL);
+    if (gst_caps_is_empty(caps) || gst_caps_is_any(caps))
+    {
+        gst_caps_unref(caps);
+        return FALSE;
+    }
+
+    type = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+    if (g_str_has_prefix(type, "video/x-raw"))
+        *kind = STREAM_KIND_VIDEO;
+    else if (g_str_has_prefix(type, "audio/x-raw"))
+        *kind = STREAM_KIND_AUDIO;
+    else
+    {
+        g_print("Pad '%s' has type '%s' which is not necessary. Ignoring...\n", GST_PAD_NAME(pad), type);
+        known = FALSE;
+    }
+    gst_caps_unref(caps);
+    return known;
+}
+
+static void stream_router_pad_added(GstElement *src, GstPad *pad, StreamRouter *router)
+{
+    GstElement *branch;
+    GstPad *sink_pad;
+    StreamKind kind;
+    guint index;
+
+    if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC || !stream_router_pad_kind(pad, &kind))
+        return;
+
+    branch = stream_router_take_branch(router, kind);
+    if (branch == NULL)
+        return;
+
+    /* Nothing flows on pad before we return, so linking first is safe */
+    gst_bin_add(GST_BIN(router->pipeline), branch);
+    sink_pad = gst_element_get_static_pad(branch, "sink");
+    if (GST_PAD_LINK_FAILED(gst_pad_link(pad, sink_pad)))
+    {
+        g_printerr("Pad '%s' could not be linked to a %s branch.\n", GST_PAD_NAME(pad), kind_names[kind]);
+        gst_object_unref(sink_pad);
+        gst_element_set_state(branch, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(router->pipeline), branch);
+        gst_object_unref(branch);
+        return;
+    }
+    gst_object_unref(sink_pad);
+    gst_element_sync_state_with_parent(branch);
+
+    /* Remembered on the pad, for pad-removed. The pipeline holds the branch */
+    g_object_set_data(G_OBJECT(pad), BRANCH_KEY, branch);
+
+    g_mutex_lock(&router->lock);
+    index = router->stats.linked[kind]++;
+    router->stats.active[kind]++;
+    g_mutex_unlock(&router->lock);
+
+    g_print("Linked pad '%s' to %s branch %u.\n", GST_PAD_NAME(pad), kind_names[kind], index);
+    if (router->linked != NULL)
+        router->linked(pad, branch, kind, index, router->user_data);
+    gst_object_unref(branch);
+}
+
+/* Runs on a GStreamer thread of its own: state changes from a streaming
+ * thread can deadlock */
+static void stream_router_remove_branch(GstElement *pipeline, gpointer user_data)
+{
+    GstElement *branch = GST_ELEMENT(user_data);
+
+    /* Keep the pipeline's own state changes away from it while it goes */
+    gst_element_set_locked_state(branch, TRUE);
+    gst_element_set_state(branch, GST_STATE_NULL);
+    if (GST_OBJECT_PARENT(branch) == GST_OBJECT(pipeline))
+        gst_bin_remove(GST_BIN(pipeline), branch);
+}
+
+static void stream_router_pad_removed(GstElement *src, GstPad *pad, StreamRouter *router)
+{
+    GstElement *branch = (GstElement *)g_object_steal_data(G_OBJECT(pad), BRANCH_KEY);
+    StreamKind kind;
+
+    if (branch == NULL)
+        return;
+
+    kind = (StreamKind)(GPOINTER_TO_INT(g_object_get_data(G_OBJECT(branch), KIND_KEY)) - 1);
+    g_mutex_lock(&router->lock);
+    router->stats.active[kind]--;
+    g_mutex_unlock(&router->lock);
+
+    g_print("Pad '%s' removed, tearing its %s branch down.\n", GST_PAD_NAME(pad), kind_names[kind]);
+    gst_element_call_async(router->pipeline, stream_router_remove_branch, gst_object_ref(branch),
+                           (GDestroyNotify)gst_object_unref);
+}
+
+StreamRouter *stream_router_new(GstElement *pipeline, guint n_video, guint n_audio,
+                                StreamLinkedFunc linked, gpointer user_data)
+{
+    StreamRouter *router = g_new0(StreamRouter, 1);
+    int kind;
+
+    router->pipeline = pipeline;
+    router->linked = linked;
+    router->user_data = user_data;
+    g_mutex_init(&router->lock);
+    g_cond_init(&router->built);
+    for (kind = 0; kind < STREAM_KIND_COUNT; kind++)
+        g_queue_init(&router->pool[kind]);
+    router->target[STREAM_KIND_VIDEO] = n_video;
+    router->target[STREAM_KIND_AUDIO] = n_audio;
+
+    /* One builder: the sinks of a kind share a device, opening them in
+     * parallel does not make it faster */
+    router->builder = g_thread_pool_new(stream_router_build_func, router, 1, FALSE, NULL);
+
+    g_mutex_lock(&router->lock);
+    for (kind = 0; kind < STREAM_KIND_COUNT; kind++)
+        stream_router_refill(router, (StreamKind)kind);
+    g_mutex_unlock(&router->lock);
+    return router;
+}
+
+/* Stops decodebin in front of the parsers and decoders of the kind we do not
+ * decode. Whatever it has plugged until then, demuxers included, stays */
+static gint stream_router_autoplug_select(GstElement *bin, GstPad *pad, GstCaps *caps,
+                                          GstElementFactory *factory, StreamRouter *router)
+{
+    const gchar *klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    const gchar *skipped = router->decode == STREAM_DECODE_VIDEO ? "Audio" : "Video";
+
+    if (klass == NULL || strstr(klass, skipped) == NULL)
+        return AUTOPLUG_SELECT_TRY;
+    if (strstr(klass, "Decoder") == NULL && strstr(klass, "Parser") == NULL)
+        return AUTOPLUG_SELECT_TRY;
+    return AUTOPLUG_SELECT_EXPOSE;
+}
+
+gboolean stream_decode_from_string(const gchar *name, StreamDecode *decode)
+{
+    if (g_strcmp0(name, "both") == 0)
+        *decode = STREAM_DECODE_BOTH;
+    else if (g_strcmp0(name, "video") == 0)
+        *decode = STREAM_DECODE_VIDEO;
+    else if (g_strcmp0(name, "audio") == 0)
+        *decode = STREAM_DECODE_AUDIO;
+    else
+        return FALSE;
+    return TRUE;
+}
+
+void stream_router_set_decode(StreamRouter *router, StreamDecode decode)
+{
+    router->decode = decode;
+
+    /* Branches already being built are freed with the router */
+    g_mutex_lock(&router->lock);
+    if (decode == STREAM_DECODE_VIDEO)
+        router->target[STREAM_KIND_AUDIO] = 0;
+    else if (decode == STREAM_DECODE_AUDIO)
+        router->target[STREAM_KIND_VIDEO] = 0;
+    g_mutex_unlock(&router->lock);
+}
+
+void stream_router_attach(StreamRouter *router, GstElement *source)
+{
+    router->source = source;
+    if (router->decode != STREAM_DECODE_BOTH)
+        router->autoplug_select_id = g_signal_connect(source, "autoplug-select",
+                                                      G_CALLBACK(stream_router_autoplug_select), router);
+    router->pad_added_id = g_signal_connect(source, "pad-added", G_CALLBACK(stream_router_pad_added), router);
+    router->pad_removed_id = g_signal_connect(source, "pad-removed", G_CALLBACK(stream_router_pad_removed), router);
+}
+
+void stream_router_get_stats(StreamRouter *router, StreamRouterStats *stats)
+{
+    g_mutex_lock(&router->lock);
+    *stats = router->stats;
+    g_mutex_unlock(&router->lock);
+}
+
+void stream_router_free(StreamRouter *router)
+{
+    GstElement *branch;
+    int kind;
+
+    if (router->source != NULL)
+    {
+        g_signal_handler_disconnect(router->source, router->pad_added_id);
+        g_signal_handler_disconnect(router->source, router->pad_removed_id);
+        if (router->autoplug_select_id != 0)
+            g_signal_handler_disconnect(router->source, router->autoplug_select_id);
+    }
+
+    /* Wait for the builds in flight, their branches end up in the pool */
+    g_thread_pool_free(router->builder, FALSE, TRUE);
+
+    for (kind = 0; kind < STREAM_KIND_COUNT; kind++)
+    {
+        while ((branch = (GstElement *)g_queue_pop_head(&router->pool[kind])) != NULL)
+        {
+            gst_element_set_state(branch, GST_STATE_NULL);
+            gst_object_unref(branch);
+        }
+    }
+    g_cond_clear(&router->built);
+    g_mutex_clear(&router->lock);
+    g_free(router);
+}
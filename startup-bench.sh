@@ -0,0 +1,61 @@
+#!/usr/bin/bash
+
+function show_help
+{
+    help_me="
+-----------------------------------------------------------------------
+ startup-bench.sh -- Compare startup time of the dynamic and the
+                     fast-start (static plugins) builds of an example
+
+ Usage: startup-bench.sh [options] path [runs]
+
+ Examples:
+
+    ./startup-bench.sh -h            --> View the help message
+    ./startup-bench.sh basics-2      --> Build basics-2 both ways and run each 10 times
+    ./startup-bench.sh basics-2 50   --> Same, with 50 runs each
+
+ The example must support --startup-report (basics-2 and basics-3 do).
+ The static plugins must be found by pkg-config, see
+ common/cmake/StaticPlugins.cmake.
+
+ Options:
+
+ -h                --> Shows help message
+-----------------------------------------------------------------------
+"
+    echo "$help_me"
+}
+
+if [ $# -lt 1 ] || [ "$1" == "-h" ]
+then
+    show_help
+    exit 1
+fi
+
+example_path=$(realpath $1)
+example=$(basename $example_path)
+runs=${2:-10}
+
+# Configure and build both flavours, they land in bin/ as <example> and <example>-static
+cmake -S $example_path -B $example_path/build-dynamic -DGST_STATIC_PLUGINS=OFF > /dev/null || exit 1
+cmake --build $example_path/build-dynamic > /dev/null || exit 1
+cmake -S $example_path -B $example_path/build-static -DGST_STATIC_PLUGINS=ON > /dev/null || exit 1
+cmake --build $example_path/build-static > /dev/null || exit 1
+rm -rf $example_path/build-dynamic $example_path/build-static
+
+# Prints the average time, in ms, of the given phases over all the runs
+function measure
+{
+    binary=$1
+    for i in $(seq $runs)
+    do
+        $binary --startup-report=warm 2> /dev/null | grep "^startup "
+    done | awk '{ sum[$2] += $3; count[$2]++ }
+                END { for (phase in sum) printf "%-28s %10.3f\n", phase, sum[phase] / count[phase] }' | sort
+}
+
+echo "== $example (dynamic, $runs runs, average ms)"
+measure $example_path/bin/$example
+echo "== $example-static (static plugins, $runs runs, average ms)"
+measure $example_path/bin/$example-static
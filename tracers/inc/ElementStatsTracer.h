@@ -0,0 +1,34 @@
+#ifndef ELEMENT_STATS_TRACER_H
+#define ELEMENT_STATS_TRACER_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_ELEMENT_STATS_TRACER (gst_element_stats_tracer_get_type())
+#define GST_ELEMENT_STATS_TRACER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_ELEMENT_STATS_TRACER, GstElementStatsTracer))
+
+/* Measures, for every element, the time its chain function takes without
+ * the elements it pushes to, and how many buffers and bytes go through it.
+ * When a pipeline reaches EOS, or goes back to READY before that, the numbers
+ * of its elements are printed and, with a dot-dir, drawn in a DOT graph.
+ *
+ * GST_TRACERS="elementstats(dot-dir=/tmp)" enables it. */
+typedef struct _GstElementStatsTracer {
+    GstTracer parent;
+
+    gchar *dot_dir;             /* Where graphs are written, NULL for no graph */
+
+    GMutex lock;                /* Protects elements */
+    GHashTable *elements;       /* GstElement * -> ElementStats *, dropped when the element goes away */
+} GstElementStatsTracer;
+
+typedef struct _GstElementStatsTracerClass {
+    GstTracerClass parent_class;
+} GstElementStatsTracerClass;
+
+GType gst_element_stats_tracer_get_type(void);
+
+G_END_DECLS
+
+#endif /* ELEMENT_STATS_TRACER_H */
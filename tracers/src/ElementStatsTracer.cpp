@@ -0,0 +1,520 @@
+#include "ElementStatsTracer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+GST_DEBUG_CATEGORY_STATIC(element_stats_debug);
+#define GST_CAT_DEFAULT element_stats_debug
+
+/* Histogram of the time per push: 4 buckets per power of two nanoseconds,
+ * so percentiles are within 25% of the real value */
+#define HISTOGRAM_SUB_BUCKETS 4
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+/* What one element did since it was first seen */
+typedef struct _ElementStats {
+    gchar *name;
+    gchar *factory;
+    guint64 pushes;             /* Calls of its chain or chain_list function */
+    guint64 buffers;
+    guint64 bytes;
+    GstClockTime time;          /* Spent in the element, not counting downstream */
+    GstClockTime first_ts;      /* First and last push, to turn counts into rates */
+    GstClockTime last_ts;
+    guint64 histogram[HISTOGRAM_BUCKETS];
+} ElementStats;
+
+/* A push going on in the current thread */
+typedef struct _PushFrame {
+    GstElement *element;        /* Receiving element, NULL when it is a bin or a proxy pad */
+    GstClockTime start;
+    GstClockTime downstream;    /* Time of the pushes the receiving element made itself */
+    guint buffers;
+    gsize bytes;
+} PushFrame;
+
+/* An element that pushes from its chain function nests one push in another,
+ * so every streaming thread keeps a stack of the pushes it is in */
+static thread_local std::vector<PushFrame> push_stack;
+
+/* Set on a pipeline once its report has been printed, until it prerolls again */
+static GQuark reported_quark;
+
+G_DEFINE_TYPE(GstElementStatsTracer, gst_element_stats_tracer, GST_TYPE_TRACER);
+
+static guint histogram_bucket(GstClockTime ns)
+{
+    guint msb;
+
+    if (ns < HISTOGRAM_SUB_BUCKETS)
+        return (guint)ns;
+
+    /* Power of two, then the next two bits */
+    msb = g_bit_storage(ns) - 1;
+    return msb * HISTOGRAM_SUB_BUCKETS + (guint)((ns >> (msb - 2)) & 3);
+}
+
+/* Upper bound of a bucket, in ns */
+static gdouble histogram_bucket_limit(guint bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    return ldexp(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS + 1,
+                 (int)(bucket / HISTOGRAM_SUB_BUCKETS) - 2);
+}
+
+static gdouble histogram_percentile(const ElementStats *stats, gdouble pct)
+{
+    guint64 rank = (guint64)ceil(pct / 100.0 * stats->pushes);
+    guint64 seen = 0;
+
+    for (guint i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += stats->histogram[i];
+        if (seen > 0 && seen >= rank)
+            return histogram_bucket_limit(i);
+    }
+    return 0.0;
+}
+
+static void element_stats_free(gpointer data)
+{
+    ElementStats *stats = (ElementStats *)data;
+
+    g_free(stats->name);
+    g_free(stats->factory);
+    g_free(stats);
+}
+
+/* Weak reference notification: the element is being finalized */
+static void element_gone(gpointer data, GObject *where_the_object_was)
+{
+    GstElementStatsTracer *self = GST_ELEMENT_STATS_TRACER(data);
+
+    g_mutex_lock(&self->lock);
+    g_hash_table_remove(self->elements, where_the_object_was);
+    g_mutex_unlock(&self->lock);
+}
+
+/* Element whose chain function a push on pad ends up in. Bins are skipped,
+ * their ghost pads push again to the element inside, which is counted */
+static GstElement *receiving_element(GstPad *pad)
+{
+    GstPad *peer = gst_pad_get_peer(pad);
+    GstElement *element = NULL;
+
+    if (peer != NULL)
+    {
+        element = gst_pad_get_parent_element(peer);
+        gst_object_unref(peer);
+    }
+    if (element != NULL)
+    {
+        /* It cannot be finalized while it handles the push, no need to keep a reference */
+        gst_object_unref(element);
+        if (GST_IS_BIN(element))
+            element = NULL;
+    }
+    return element;
+}
+
+static void push_begin(GstPad *pad, GstClockTime ts, guint buffers, gsize bytes)
+{
+    PushFrame frame = { receiving_element(pad), ts, 0, buffers, bytes };
+
+    push_stack.push_back(frame);
+}
+
+static void push_end(GstElementStatsTracer *self, GstClockTime ts)
+{
+    PushFrame frame;
+    GstClockTime elapsed, own;
+    ElementStats *stats;
+
+    /* The tracer was created in the middle of this push */
+    if (push_stack.empty())
+        return;
+
+    frame = push_stack.back();
+    push_stack.pop_back();
+    elapsed = ts - frame.start;
+    own = elapsed - MIN(frame.downstream, elapsed);
+
+    /* The pusher spent that time downstream, not in itself */
+    if (!push_stack.empty())
+        push_stack.back().downstream += elapsed;
+
+    if (frame.element == NULL)
+        return;
+
+    g_mutex_lock(&self->lock);
+    stats = (ElementStats *)g_hash_table_lookup(self->elements, frame.element);
+    if (stats == NULL)
+    {
+        GstElementFactory *factory = gst_element_get_factory(frame.element);
+
+        stats = g_new0(ElementStats, 1);
+        stats->name = gst_object_get_name(GST_OBJECT(frame.element));
+        stats->factory = g_strdup(factory ? GST_OBJECT_NAME(factory) : G_OBJECT_TYPE_NAME(frame.element));
+        stats->first_ts = frame.start;
+        g_hash_table_insert(self->elements, frame.element, stats);
+        g_object_weak_ref(G_OBJECT(frame.element), element_gone, self);
+    }
+    stats->pushes++;
+    stats->buffers += frame.buffers;
+    stats->bytes += frame.bytes;
+    stats->time += own;
+    stats->last_ts = ts;
+    stats->histogram[histogram_bucket(own)]++;
+    g_mutex_unlock(&self->lock);
+}
+
+/* Hooks, called from the streaming threads */
+
+static void on_pad_push_pre(GObject *self, GstClockTime ts, GstPad *pad, GstBuffer *buffer)
+{
+    push_begin(pad, ts, 1, gst_buffer_get_size(buffer));
+}
+
+static void on_pad_push_list_pre(GObject *self, GstClockTime ts, GstPad *pad, GstBufferList *list)
+{
+    push_begin(pad, ts, gst_buffer_list_length(list), gst_buffer_list_calculate_size(list));
+}
+
+static void on_pad_push_post(GObject *self, GstClockTime ts, GstPad *pad, GstFlowReturn res)
+{
+    push_end(GST_ELEMENT_STATS_TRACER(self), ts);
+}
+
+/* Element that really receives what pad pushes, going into and out of bins
+ * through their ghost pads. Returns a reference, or NULL */
+static GstElement *linked_element(GstPad *pad)
+{
+    GstPad *peer = gst_pad_get_peer(pad);
+
+    while (peer != NULL)
+    {
+        GstObject *parent = gst_object_get_parent(GST_OBJECT(peer));
+        GstPad *next;
+
+        if (GST_IS_GHOST_PAD(peer))
+        {
+            /* Sink ghost pad of a bin: go on with the pad inside */
+            next = gst_ghost_pad_get_target(GST_GHOST_PAD(peer));
+        }
+        else if (parent != NULL && GST_IS_GHOST_PAD(parent))
+        {
+            /* Internal pad of a source ghost pad: go on with what the bin is linked to */
+            next = gst_pad_get_peer(GST_PAD(parent));
+        }
+        else
+        {
+            gst_object_unref(peer);
+            if (parent != NULL && GST_IS_ELEMENT(parent))
+                return GST_ELEMENT(parent);
+            if (parent != NULL)
+                gst_object_unref(parent);
+            return NULL;
+        }
+
+        if (parent != NULL)
+            gst_object_unref(parent);
+        gst_object_unref(peer);
+        peer = next;
+    }
+    return NULL;
+}
+
+/* All the elements of the pipeline that are not bins, with a reference */
+static std::vector<GstElement *> pipeline_elements(GstElement *pipeline)
+{
+    std::vector<GstElement *> elements;
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    gboolean done = FALSE;
+
+    while (!done)
+    {
+        switch (gst_iterator_next(it, &item))
+        {
+            case GST_ITERATOR_OK:
+            {
+                GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+                if (!GST_IS_BIN(element))
+                    elements.push_back(GST_ELEMENT(gst_object_ref(element)));
+                g_value_reset(&item);
+                break;
+            }
+
+            case GST_ITERATOR_RESYNC:
+            for (GstElement *element : elements)
+                gst_object_unref(element);
+            elements.clear();
+            gst_iterator_resync(it);
+            break;
+
+            default:
+            done = TRUE;
+            break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    return elements;
+}
+
+/* One line of the report: a copy of the element's stats */
+typedef struct _ReportRow {
+    GstElement *element;
+    ElementStats stats;
+    gboolean seen;              /* Has the element received anything? */
+} ReportRow;
+
+static gdouble row_rate(const ReportRow &row, guint64 count)
+{
+    GstClockTime window = row.stats.last_ts - row.stats.first_ts;
+
+    return window > 0 ? (gdouble)count * GST_SECOND / window : 0.0;
+}
+
+/* Writes the pipeline as a DOT graph, every element labelled with its numbers
+ * and filled redder the bigger its share of the time */
+static void write_dot(GstElementStatsTracer *self, GstElement *pipeline,
+                      const std::vector<ReportRow> &rows, GstClockTime total)
+{
+    GString *dot = g_string_new(NULL);
+    gchar *name = gst_object_get_name(GST_OBJECT(pipeline));
+    gchar *file_name = g_strdup_printf("%s.elementstats.dot", name);
+    gchar *path = g_build_filename(self->dot_dir, file_name, NULL);
+    GError *err = NULL;
+
+    g_string_append_printf(dot, "digraph \"%s\" {\n  rankdir=LR;\n"
+                                "  node [shape=box, style=\"filled,rounded\", fontname=\"sans\"];\n", name);
+
+    for (const ReportRow &row : rows)
+    {
+        g_string_append_printf(dot, "  \"%p\" [label=\"%s\\n%s", (void *)row.element, row.stats.name, row.stats.factory);
+        if (row.seen)
+        {
+            gdouble share = total > 0 ? (gdouble)row.stats.time / total : 0.0;
+            guint shade = (guint)(255 * (1.0 - share));
+
+            g_string_append_printf(dot, "\\n%.1f ms (%.0f%%), p50 %.0f us, p99 %.0f us\\n%.1f buffers/s, %.2f MB/s\", "
+                                        "fillcolor=\"#ff%02x%02x\"];\n",
+                                   (gdouble)row.stats.time / GST_MSECOND, share * 100,
+                                   histogram_percentile(&row.stats, 50) / 1000, histogram_percentile(&row.stats, 99) / 1000,
+                                   row_rate(row, row.stats.buffers), row_rate(row, row.stats.bytes) / 1e6, shade, shade);
+        }
+        else
+        {
+            g_string_append(dot, "\", fillcolor=\"white\"];\n");
+        }
+    }
+
+    /* One edge per linked source pad */
+    for (const ReportRow &row : rows)
+    {
+        GstIterator *it = gst_element_iterate_src_pads(row.element);
+        GValue item = G_VALUE_INIT;
+
+        while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+        {
+            GstElement *peer = linked_element(GST_PAD(g_value_get_object(&item)));
+            if (peer != NULL)
+            {
+                g_string_append_printf(dot, "  \"%p\" -> \"%p\";\n", (void *)row.element, (void *)peer);
+                gst_object_unref(peer);
+            }
+            g_value_reset(&item);
+        }
+        g_value_unset(&item);
+        gst_iterator_free(it);
+    }
+    g_string_append(dot, "}\n");
+
+    if (g_file_set_contents(path, dot->str, -1, &err))
+        g_printerr("elementstats: graph written to %s\n", path);
+    else
+        g_printerr("elementstats: could not write %s: %s\n", path, err->message);
+
+    g_clear_error(&err);
+    g_string_free(dot, TRUE);
+    g_free(path);
+    g_free(file_name);
+    g_free(name);
+}
+
+/* Prints the numbers of every element of the pipeline, the slowest first */
+static void report(GstElementStatsTracer *self, GstElement *pipeline)
+{
+    std::vector<GstElement *> elements = pipeline_elements(pipeline);
+    std::vector<ReportRow> rows;
+    GstClockTime total = 0;
+
+    g_mutex_lock(&self->lock);
+    for (GstElement *element : elements)
+    {
+        ElementStats *stats = (ElementStats *)g_hash_table_lookup(self->elements, element);
+        ReportRow row = ReportRow();
+
+        /* The names stay valid as long as we hold a reference on the element */
+        row.element = element;
+        row.seen = stats != NULL;
+        if (stats != NULL)
+        {
+            row.stats = *stats;
+            total += stats->time;
+        }
+        else
+        {
+            row.stats.name = GST_OBJECT_NAME(element);
+            row.stats.factory = (gchar *)G_OBJECT_TYPE_NAME(element);
+        }
+        rows.push_back(row);
+    }
+    g_mutex_unlock(&self->lock);
+
+    std::sort(rows.begin(), rows.end(), [](const ReportRow &a, const ReportRow &b) {
+        return a.stats.time > b.stats.time;
+    });
+
+    g_printerr("elementstats: %s\n", GST_OBJECT_NAME(pipeline));
+    g_printerr("%-24s %-20s %10s %10s %6s %10s %10s %12s %10s\n", "element", "factory", "buffers",
+               "time_ms", "time%", "p50_us", "p99_us", "buffers/s", "MB/s");
+    for (const ReportRow &row : rows)
+    {
+        if (!row.seen)
+            continue;
+        g_printerr("%-24s %-20s %10" G_GUINT64_FORMAT " %10.2f %6.1f %10.1f %10.1f %12.1f %10.2f\n",
+                   row.stats.name, row.stats.factory, row.stats.buffers,
+                   (gdouble)row.stats.time / GST_MSECOND, total > 0 ? 100.0 * row.stats.time / total : 0.0,
+                   histogram_percentile(&row.stats, 50) / 1000, histogram_percentile(&row.stats, 99) / 1000,
+                   row_rate(row, row.stats.buffers), row_rate(row, row.stats.bytes) / 1e6);
+    }
+
+    if (self->dot_dir != NULL)
+        write_dot(self, pipeline, rows, total);
+
+    for (GstElement *element : elements)
+        gst_object_unref(element);
+}
+
+/* Reports the pipeline unless it was already done for this run */
+static void report_once(GstElementStatsTracer *self, GstElement *pipeline)
+{
+    gboolean reported;
+
+    g_mutex_lock(&self->lock);
+    reported = g_object_get_qdata(G_OBJECT(pipeline), reported_quark) != NULL;
+    g_object_set_qdata(G_OBJECT(pipeline), reported_quark, GINT_TO_POINTER(TRUE));
+    g_mutex_unlock(&self->lock);
+
+    if (!reported)
+        report(self, pipeline);
+}
+
+static gboolean is_top_level_pipeline(GstElement *element)
+{
+    return GST_IS_PIPELINE(element) && GST_OBJECT_PARENT(element) == NULL;
+}
+
+/* The pipeline posts EOS once all its sinks got it */
+static void on_element_post_message_pre(GObject *self, GstClockTime ts, GstElement *element, GstMessage *message)
+{
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS && is_top_level_pipeline(element))
+        report_once(GST_ELEMENT_STATS_TRACER(self), element);
+}
+
+/* Stopped before EOS (error, Ctrl+C, new URI...): report what was measured */
+static void on_element_change_state_pre(GObject *self, GstClockTime ts, GstElement *element, GstStateChange transition)
+{
+    if (!is_top_level_pipeline(element))
+        return;
+
+    if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+        report_once(GST_ELEMENT_STATS_TRACER(self), element);
+    else if (transition == GST_STATE_CHANGE_READY_TO_PAUSED)
+    {
+        GstElementStatsTracer *tracer = GST_ELEMENT_STATS_TRACER(self);
+
+        g_mutex_lock(&tracer->lock);
+        g_object_set_qdata(G_OBJECT(element), reported_quark, NULL);
+        g_mutex_unlock(&tracer->lock);
+    }
+}
+
+static void gst_element_stats_tracer_constructed(GObject *object)
+{
+    GstElementStatsTracer *self = GST_ELEMENT_STATS_TRACER(object);
+    gchar *params = NULL;
+
+    G_OBJECT_CLASS(gst_element_stats_tracer_parent_class)->constructed(object);
+
+    /* GST_TRACERS="elementstats(dot-dir=/tmp)" gives "dot-dir=/tmp" */
+    g_object_get(object, "params", &params, NULL);
+    if (params != NULL)
+    {
+        gchar *str = g_strdup_printf("elementstats,%s", params);
+        GstStructure *structure = gst_structure_from_string(str, NULL);
+
+        if (structure != NULL)
+        {
+            self->dot_dir = g_strdup(gst_structure_get_string(structure, "dot-dir"));
+            gst_structure_free(structure);
+        }
+        else
+        {
+            GST_WARNING_OBJECT(self, "Could not parse parameters '%s'", params);
+        }
+        g_free(str);
+        g_free(params);
+    }
+
+    /* Same place as the graphs of GST_DEBUG_BIN_TO_DOT_FILE */
+    if (self->dot_dir == NULL)
+        self->dot_dir = g_strdup(g_getenv("GST_DEBUG_DUMP_DOT_DIR"));
+}
+
+static void gst_element_stats_tracer_finalize(GObject *object)
+{
+    GstElementStatsTracer *self = GST_ELEMENT_STATS_TRACER(object);
+    GHashTableIter iter;
+    gpointer element;
+
+    g_hash_table_iter_init(&iter, self->elements);
+    while (g_hash_table_iter_next(&iter, &element, NULL))
+        g_object_weak_unref(G_OBJECT(element), element_gone, self);
+
+    g_hash_table_destroy(self->elements);
+    g_mutex_clear(&self->lock);
+    g_free(self->dot_dir);
+
+    G_OBJECT_CLASS(gst_element_stats_tracer_parent_class)->finalize(object);
+}
+
+static void gst_element_stats_tracer_class_init(GstElementStatsTracerClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+    gobject_class->constructed = gst_element_stats_tracer_constructed;
+    gobject_class->finalize = gst_element_stats_tracer_finalize;
+
+    reported_quark = g_quark_from_static_string("elementstats-reported");
+    GST_DEBUG_CATEGORY_INIT(element_stats_debug, "elementstats", 0, "per-element time and throughput tracer");
+}
+
+static void gst_element_stats_tracer_init(GstElementStatsTracer *self)
+{
+    GstTracer *tracer = GST_TRACER(self);
+
+    g_mutex_init(&self->lock);
+    self->elements = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, element_stats_free);
+
+    gst_tracing_register_hook(tracer, "pad-push-pre", G_CALLBACK(on_pad_push_pre));
+    gst_tracing_register_hook(tracer, "pad-push-post", G_CALLBACK(on_pad_push_post));
+    gst_tracing_register_hook(tracer, "pad-push-list-pre", G_CALLBACK(on_pad_push_list_pre));
+    gst_tracing_register_hook(tracer, "pad-push-list-post", G_CALLBACK(on_pad_push_post));
+    gst_tracing_register_hook(tracer, "element-post-message-pre", G_CALLBACK(on_element_post_message_pre));
+    gst_tracing_register_hook(tracer, "element-change-state-pre", G_CALLBACK(on_element_change_state_pre));
+}
@@ -0,0 +1,15 @@
+#include <gst/gst.h>
+
+#include "ElementStatsTracer.h"
+
+/* Everything the plugin provides. GST_TRACERS picks the tracers by name */
+static gboolean plugin_init(GstPlugin *plugin)
+{
+    return gst_tracer_register(plugin, "elementstats", GST_TYPE_ELEMENT_STATS_TRACER);
+}
+
+/* The library is libgsttutorialtracers.so, so GStreamer looks for the
+ * description under the "tutorialtracers" name */
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, tutorialtracers,
+                  "Tracers measuring the tutorial pipelines",
+                  plugin_init, "1.0", "LGPL", "gstreamer-tutorials", "https://gstreamer.freedesktop.org")